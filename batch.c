@@ -0,0 +1,500 @@
+/*
+ * Batch mode (-b): execute many Mini-ELF images in one process.
+ *
+ * Every argument is an image, a directory (all regular files in it, in
+ * name order) or @file, a manifest naming one image per line. Each image
+ * runs as with -q and gets a single result line, followed by a summary.
+ * With -j N the images are spread over N threads, each with its own
+ * context; the output is the same as with one. With -L N an image that
+ * has not stopped after N instructions is cut off and reported as such.
+ */
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./headers/batch.h"
+#include "./headers/loader.h"
+#include "./headers/mem-access.h"
+#include "./headers/interpret.h"
+
+static const char *stat_names[] = { "???", "AOK", "HLT", "ADR", "INS" };
+
+//=======================================================================
+/*
+ * Append a copy of path to list.
+ */
+static bool list_add(batch_list_t *list, const char *path)
+{
+    if (list->count == list->cap)
+    {
+        int cap = list->cap ? list->cap * 2 : 64;
+        char **paths = realloc(list->paths, cap * sizeof(char *));
+        if (paths == NULL)
+        {
+            return false;
+        }
+        list->paths = paths;
+        list->cap = cap;
+    }
+    list->paths[list->count] = strdup(path);
+    if (list->paths[list->count] == NULL)
+    {
+        return false;
+    }
+    list->count++;
+    return true;
+}
+
+//=======================================================================
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+//=======================================================================
+/*
+ * Add every regular file in directory dir to list, sorted by name.
+ */
+static bool list_add_dir(batch_list_t *list, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+    {
+        return false;
+    }
+    int first = list->count;
+    struct dirent *ent;
+    bool ok = true;
+    while (ok && (ent = readdir(d)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+        {
+            continue;
+        }
+        size_t len = strlen(dir) + strlen(ent->d_name) + 2;
+        char *path = malloc(len);
+        if (path == NULL)
+        {
+            ok = false;
+            break;
+        }
+        snprintf(path, len, "%s/%s", dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            ok = list_add(list, path);
+        }
+        free(path);
+    }
+    closedir(d);
+    qsort(&list->paths[first], list->count - first, sizeof(char *), compare_names);
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Add every image named in manifest to list. One path per line, blank
+ * lines and lines starting with '#' are skipped.
+ */
+static bool list_add_manifest(batch_list_t *list, const char *manifest)
+{
+    FILE *file = fopen(manifest, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    char line[4096];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        ok = list_add(list, line);
+    }
+    fclose(file);
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Expand the nargs batch arguments in args into list.
+ * Return false if a directory or manifest cannot be read.
+ */
+bool batch_collect(batch_list_t *list, char **args, int nargs)
+{
+    memset(list, 0, sizeof(*list));
+    for (int i = 0; i < nargs; i++)
+    {
+        struct stat st;
+        bool ok;
+        if (args[i][0] == '@')
+        {
+            ok = list_add_manifest(list, args[i] + 1);
+        }
+        else if (stat(args[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            ok = list_add_dir(list, args[i]);
+        }
+        else
+        {
+            // missing files are reported per image, not here
+            ok = list_add(list, args[i]);
+        }
+        if (!ok)
+        {
+            printf("Failed to read batch list %s\n", args[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+//=======================================================================
+void batch_list_free(batch_list_t *list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+//=======================================================================
+/*
+ * Create the memory of ctx. Return false if it cannot be allocated.
+ */
+bool context_init(y86_context_t *ctx, int vaddrbits)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->mem = mem_create(vaddrbits);
+    return ctx->mem != NULL;
+}
+
+//=======================================================================
+void context_free(y86_context_t *ctx)
+{
+    mem_free(ctx->mem);
+    ctx->mem = NULL;
+}
+
+//=======================================================================
+/*
+ * Load the image at path into ctx and run it to completion, the same
+ * way the -e loop in main.c does, without any output. Stop after limit
+ * instructions unless limit is 0, so one image that never halts cannot
+ * hold up the batch.
+ */
+void run_image(y86_context_t *ctx, const char *path, uint64_t limit,
+               batch_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    mem_clear(ctx->mem);
+    set_mem_trace(ctx->mem, NULL);
+
+    elf_image_t image;
+    if (!map_image(path, &image))
+    {
+        res->error = "Failed to open File";
+        return;
+    }
+    res->error = image_load(&image, ctx->mem);
+    if (res->error != NULL)
+    {
+        unmap_image(&image);
+        return;
+    }
+
+    y86_t *cpu = &ctx->cpu;
+    memset(cpu, 0x00, sizeof(*cpu));
+    cpu->stat = AOK;
+    cpu->pc = image.hdr->e_entry;
+    cpu->memsize = mem_size(ctx->mem);
+    unmap_image(&image);
+
+    uint64_t count = 0;
+    while (cpu->stat == AOK && (limit == 0 || count < limit))
+    {
+        execute_step(cpu, ctx->mem);
+        count++;
+    }
+
+    res->stat = cpu->stat;
+    res->pc = cpu->pc;
+    res->count = count;
+}
+
+//=======================================================================
+/*
+ * Print the result line of one image.
+ */
+void print_result(FILE *out, const char *path, const batch_result_t *res)
+{
+    if (res->error != NULL)
+    {
+        fprintf(out, "%s: %s\n", path, res->error);
+        return;
+    }
+    if (res->stat == AOK)
+    {
+        fprintf(out, "%s: step limit at 0x%04lx after %lu instructions\n", path,
+                res->pc, res->count);
+        return;
+    }
+    fprintf(out, "%s: %s at 0x%04lx after %lu instructions\n", path,
+            stat_names[res->stat <= INS ? res->stat : 0], res->pc, res->count);
+}
+
+//=======================================================================
+/*
+ * The images of one worker, indices first..last-1 of the batch list
+ * still to run. The owner takes from the back, idle workers steal from
+ * the front. Images take microseconds to milliseconds each, so a lock
+ * per deque costs nothing next to running them.
+ */
+typedef struct batch_deque {
+    pthread_mutex_t lock;
+    int             first;
+    int             last;
+} batch_deque_t;
+
+/* Shared state of one parallel batch. */
+typedef struct batch_pool {
+    const batch_list_t *list;
+    batch_result_t     *results;   /* one per image, in list order */
+    batch_deque_t      *deques;    /* one per worker */
+    int                 nworkers;
+    int                 vaddrbits;
+    uint64_t            limit;     /* instructions per image, 0 for none */
+} batch_pool_t;
+
+typedef struct batch_worker {
+    batch_pool_t *pool;
+    int           id;
+} batch_worker_t;
+
+//=======================================================================
+/*
+ * Take the next image for worker id: its own newest one, else the
+ * oldest one of another worker. Return -1 once every deque is empty.
+ */
+static int next_image(batch_pool_t *pool, int id)
+{
+    batch_deque_t *own = &pool->deques[id];
+    pthread_mutex_lock(&own->lock);
+    int index = own->first < own->last ? --own->last : -1;
+    pthread_mutex_unlock(&own->lock);
+
+    for (int i = 1; index < 0 && i < pool->nworkers; i++)
+    {
+        batch_deque_t *victim = &pool->deques[(id + i) % pool->nworkers];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->first < victim->last)
+        {
+            index = victim->first++;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return index;
+}
+
+//=======================================================================
+static void *batch_worker(void *arg)
+{
+    batch_worker_t *worker = arg;
+    batch_pool_t *pool = worker->pool;
+
+    y86_context_t ctx;
+    if (!context_init(&ctx, pool->vaddrbits))
+    {
+        // the others steal this worker's images, run_parallel() runs
+        // whatever is still left when they are done
+        return NULL;
+    }
+
+    int index;
+    while ((index = next_image(pool, worker->id)) >= 0)
+    {
+        run_image(&ctx, pool->list->paths[index], pool->limit,
+                  &pool->results[index]);
+    }
+    context_free(&ctx);
+    return NULL;
+}
+
+//=======================================================================
+/*
+ * Run every image of list on nworkers threads, results in list order.
+ * Return false if the images cannot be run at all.
+ */
+static bool run_parallel(const batch_list_t *list, batch_result_t *results,
+                         int nworkers, int vaddrbits, uint64_t limit)
+{
+    batch_pool_t pool = {list, results, NULL, nworkers, vaddrbits, limit};
+    pool.deques = calloc(nworkers, sizeof(batch_deque_t));
+    batch_worker_t *workers = calloc(nworkers, sizeof(batch_worker_t));
+    pthread_t *threads = calloc(nworkers, sizeof(pthread_t));
+    bool *started = calloc(nworkers, sizeof(bool));
+    if (pool.deques == NULL || workers == NULL || threads == NULL || started == NULL)
+    {
+        free(pool.deques);
+        free(workers);
+        free(threads);
+        free(started);
+        return false;
+    }
+
+    // deal out contiguous runs of images, stealing evens out the rest
+    for (int i = 0; i < nworkers; i++)
+    {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].first = (int)((int64_t)list->count * i / nworkers);
+        pool.deques[i].last = (int)((int64_t)list->count * (i + 1) / nworkers);
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    // images of workers that fail to start are stolen by the others
+    for (int i = 0; i < nworkers; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, batch_worker, &workers[i]) == 0;
+    }
+    for (int i = 0; i < nworkers; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    // if threads or contexts ran out some images may be left, run them here
+    bool ok = true;
+    y86_context_t ctx = {0};
+    for (int i = 0; ok && i < nworkers; i++)
+    {
+        batch_deque_t *deque = &pool.deques[i];
+        for (int index = deque->first; ok && index < deque->last; index++)
+        {
+            if (ctx.mem == NULL)
+            {
+                ok = context_init(&ctx, vaddrbits);
+            }
+            if (ok)
+            {
+                run_image(&ctx, list->paths[index], limit, &results[index]);
+            }
+        }
+    }
+    context_free(&ctx);
+
+    for (int i = 0; i < nworkers; i++)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(workers);
+    free(threads);
+    free(started);
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Run every image named by opts and print one line per image and a
+ * summary, in the order the images were named whatever the number of
+ * workers. Return EXIT_FAILURE if an image could not be loaded.
+ */
+int run_batch(const y86_options_t *opts)
+{
+    batch_list_t list;
+    if (!batch_collect(&list, opts->files, opts->nfiles))
+    {
+        batch_list_free(&list);
+        return EXIT_FAILURE;
+    }
+
+    batch_result_t *results = calloc(list.count ? list.count : 1, sizeof(batch_result_t));
+    if (results == NULL)
+    {
+        printf("Failed to allocate memory\n");
+        batch_list_free(&list);
+        return EXIT_FAILURE;
+    }
+
+    int jobs = opts->jobs;
+    if (jobs <= 0)
+    {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (jobs > list.count)
+    {
+        jobs = list.count;
+    }
+
+    if (jobs > 1)
+    {
+        if (!run_parallel(&list, results, jobs, opts->vaddrbits, opts->step_limit))
+        {
+            printf("Failed to start batch workers\n");
+            free(results);
+            batch_list_free(&list);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        y86_context_t ctx;
+        if (!context_init(&ctx, opts->vaddrbits))
+        {
+            printf("Failed to allocate memory\n");
+            free(results);
+            batch_list_free(&list);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < list.count; i++)
+        {
+            run_image(&ctx, list.paths[i], opts->step_limit, &results[i]);
+        }
+        context_free(&ctx);
+    }
+
+    int halted = 0;
+    int faulted = 0;
+    int limited = 0;
+    int failed = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < list.count; i++)
+    {
+        print_result(stdout, list.paths[i], &results[i]);
+        if (results[i].error != NULL)
+        {
+            failed++;
+        }
+        else if (results[i].stat == HLT)
+        {
+            halted++;
+        }
+        else if (results[i].stat == AOK)
+        {
+            limited++;
+        }
+        else
+        {
+            faulted++;
+        }
+        total += results[i].count;
+    }
+    printf("Batch: %d images, %d halted, %d faulted, %d hit the step limit, "
+           "%d failed to load, %lu instructions\n", list.count, halted, faulted,
+           limited, failed, total);
+
+    free(results);
+    batch_list_free(&list);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
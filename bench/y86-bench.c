@@ -0,0 +1,197 @@
+/*
+ * y86-bench - run Mini-ELF workloads under the simulator and report the
+ * speed of each engine as JSON, one object per line:
+ *
+ *   {"workload": "bench/alu.o", "engine": "-q", "instructions": 25165829,
+ *    "seconds": 0.412, "mips": 61.08, "ns_per_inst": 16.37,
+ *    "peak_rss_kb": 1480}
+ *
+ * Every run is a fresh y86 process, so peak RSS is that of the run alone.
+ * With -r N each workload runs N times per engine and the fastest run is
+ * reported.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ENGINES 8
+
+/* One measured run. */
+typedef struct bench_run {
+    uint64_t count;       /* instructions executed */
+    double   seconds;     /* wall clock time */
+    long     peak_rss;    /* maximum resident set size in KiB */
+} bench_run_t;
+
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_bench()
+{
+    printf("Usage: y86-bench [-y y86] [-r runs] [-x flags]... workload...\n");
+    printf(" Options are:\n");
+    printf("  -y y86    Simulator to measure (default ./build/release/y86)\n");
+    printf("  -r runs   Runs per workload and engine, the fastest is reported\n");
+    printf("  -x flags  Engine flags, may be repeated (default \"-q\" and \"-t -q\")\n");
+}
+
+//=======================================================================
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//=======================================================================
+/*
+ * Run y86 with the space separated flags on workload and fill in run.
+ * Return false if it could not be run or printed no instruction count.
+ */
+static bool run_once(const char *y86, const char *flags, const char *workload,
+                     bench_run_t *run)
+{
+    char *argv[16];
+    int argc = 0;
+    char *words = strdup(flags);
+    argv[argc++] = (char *)y86;
+    for (char *w = strtok(words, " "); w != NULL && argc < 14; w = strtok(NULL, " "))
+    {
+        argv[argc++] = w;
+    }
+    argv[argc++] = (char *)workload;
+    argv[argc] = NULL;
+
+    int out[2];
+    if (pipe(out) != 0)
+    {
+        free(words);
+        return false;
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execv(y86, argv);
+        _exit(127);
+    }
+    close(out[1]);
+    free(words);
+    if (pid < 0)
+    {
+        close(out[0]);
+        return false;
+    }
+
+    // only the "Total execution count" line matters
+    FILE *text = fdopen(out[0], "r");
+    char line[256];
+    bool found = false;
+    while (fgets(line, sizeof(line), text) != NULL)
+    {
+        unsigned long count;
+        if (sscanf(line, "Total execution count: %lu", &count) == 1)
+        {
+            run->count = count;
+            found = true;
+        }
+    }
+    fclose(text);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+    {
+        return false;
+    }
+    run->seconds = now() - start;
+    run->peak_rss = usage.ru_maxrss;
+    return found && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+//=======================================================================
+int main(int argc, char **argv)
+{
+    const char *y86 = "./build/release/y86";
+    const char *engines[MAX_ENGINES];
+    int nengines = 0;
+    int runs = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hy:r:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'y':
+            y86 = optarg;
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'x':
+            if (nengines < MAX_ENGINES)
+            {
+                engines[nengines++] = optarg;
+            }
+            break;
+        default:
+            usage_bench();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || runs < 1)
+    {
+        usage_bench();
+        return EXIT_FAILURE;
+    }
+    if (nengines == 0)
+    {
+        engines[nengines++] = "-q";
+        engines[nengines++] = "-t -q";
+    }
+
+    int failed = 0;
+    for (int i = optind; i < argc; i++)
+    {
+        for (int e = 0; e < nengines; e++)
+        {
+            bench_run_t best = {0, 0, 0};
+            bool ok = true;
+            for (int r = 0; ok && r < runs; r++)
+            {
+                bench_run_t run;
+                ok = run_once(y86, engines[e], argv[i], &run);
+                if (ok && (r == 0 || run.seconds < best.seconds))
+                {
+                    best = run;
+                }
+            }
+            if (!ok)
+            {
+                fprintf(stderr, "y86-bench: %s %s %s failed\n", y86, engines[e], argv[i]);
+                failed++;
+                continue;
+            }
+            printf("{\"workload\": \"%s\", \"engine\": \"%s\", \"instructions\": %lu, "
+                   "\"seconds\": %.6f, \"mips\": %.2f, \"ns_per_inst\": %.3f, "
+                   "\"peak_rss_kb\": %ld}\n",
+                   argv[i], engines[e], best.count, best.seconds,
+                   best.count / best.seconds / 1e6,
+                   best.count ? best.seconds * 1e9 / best.count : 0.0,
+                   best.peak_rss);
+            fflush(stdout);
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/decode-cache.h"
+#include "./headers/disassemble.h"
+#include "./headers/mem-access.h"
+//=======================================================================
+/*
+ * Return the cache entries for the page holding addr, allocating them
+ * (and the cache itself) on first use. NULL if out of memory.
+ */
+static decode_entry_t *cache_page(memory_t memory, address_t addr)
+{
+    decode_cache_t *cache = memory->decode;
+    if (cache == NULL)
+    {
+        cache = calloc(1, sizeof(decode_cache_t));
+        if (cache == NULL)
+        {
+            return NULL;
+        }
+        cache->npages = memory->npages;
+        cache->pages = calloc(cache->npages, sizeof(decode_entry_t *));
+        if (cache->pages == NULL)
+        {
+            free(cache);
+            return NULL;
+        }
+        memory->decode = cache;
+    }
+
+    decode_entry_t **page = &cache->pages[addr >> PAGEBITS];
+    if (*page == NULL)
+    {
+        *page = calloc(PAGESIZE, sizeof(decode_entry_t));
+        if (*page != NULL && !page_list_add(&cache->used, addr >> PAGEBITS))
+        {
+            free(*page);
+            *page = NULL;
+        }
+    }
+    return *page;
+}
+
+//=======================================================================
+/*
+ * Fetch the instruction at the current PC through the decode cache.
+ * The first visit to an address runs fetch() and stores the result,
+ * every later visit is a table lookup. Falls back to fetch() for
+ * anything that cannot be cached (bad PC, CPU not in AOK state).
+ */
+y86_inst_t fetch_cached(y86_t *cpu, memory_t memory)
+{
+    if (!cpu || !memory || cpu->pc >= mem_size(memory) || cpu->stat != AOK)
+    {
+        return fetch(cpu, memory);
+    }
+
+    decode_entry_t *page = cache_page(memory, cpu->pc);
+    if (page == NULL)
+    {
+        return fetch(cpu, memory);
+    }
+
+    decode_entry_t *entry = &page[cpu->pc & PAGEMASK];
+    if (!entry->valid)
+    {
+        entry->inst = fetch(cpu, memory);
+        entry->stat = cpu->stat;
+        entry->valid = true;
+        return entry->inst;
+    }
+
+    cpu->stat = entry->stat;
+    return entry->inst;
+}
+
+//=======================================================================
+/*
+ * Drop every cached instruction whose bytes overlap [addr, addr + len).
+ * Called from the store path so self-modifying code is re-decoded.
+ */
+void decode_cache_invalidate(memory_t memory, address_t addr, uint64_t len)
+{
+    decode_cache_t *cache = memory->decode;
+    if (cache == NULL || len == 0 || addr >= mem_size(memory))
+    {
+        return;
+    }
+
+    // an instruction starting up to MAX_INST_SIZE - 1 bytes before addr
+    // can still reach into the written range
+    address_t start = addr >= MAX_INST_SIZE - 1 ? addr - (MAX_INST_SIZE - 1) : 0;
+    address_t end = addr + len;
+    if (end > mem_size(memory))
+    {
+        end = mem_size(memory);
+    }
+
+    for (address_t i = start; i < end; i++)
+    {
+        decode_entry_t *page = cache->pages[i >> PAGEBITS];
+        if (page != NULL)
+        {
+            page[i & PAGEMASK].valid = false;
+        }
+    }
+}
+
+//=======================================================================
+/*
+ * Forget all decoded instructions of memory, visiting only the pages
+ * that have any. The page table is kept for the next program.
+ */
+void decode_cache_clear(memory_t memory)
+{
+    decode_cache_t *cache = memory->decode;
+    if (cache == NULL)
+    {
+        return;
+    }
+    for (uint64_t i = 0; i < cache->used.count; i++)
+    {
+        free(cache->pages[cache->used.pages[i]]);
+        cache->pages[cache->used.pages[i]] = NULL;
+    }
+    cache->used.count = 0;
+}
+
+//=======================================================================
+/*
+ * Forget all decoded instructions of memory and release the cache.
+ */
+void decode_cache_free(memory_t memory)
+{
+    decode_cache_t *cache = memory->decode;
+    if (cache == NULL)
+    {
+        return;
+    }
+    decode_cache_clear(memory);
+    free(cache->used.pages);
+    free(cache->pages);
+    free(cache);
+    memory->decode = NULL;
+}
@@ -4,8 +4,9 @@
 #include <string.h>
 
 #include "./headers/disassemble.h"
+#include "./headers/mem-access.h"
 bool is_valid_reg(y86_t *cpu, memory_t memory, y86_inst_t *ins);
-bool validate_pc(y86_t *cpu, int offset);
+bool validate_pc(y86_t *cpu, memory_t memory, int offset);
 y86_inst_t set_invalid_ins(y86_t *cpu, y86_inst_t *ins);
 void print_spacing(int printed);
 //============================================================================
@@ -41,14 +42,14 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
     memset(&ins, 0, sizeof(y86_inst_t)); // Clear all fields on instr.
     ins.type = INVALID;                  // Invalid instruction until proven otherwise
 
-    if (!cpu || !memory || cpu->pc < 0 || cpu->pc >= MEMSIZE)
+    if (!cpu || !memory || cpu->pc >= mem_size(memory))
     {
         cpu->stat = cpu && memory ? ADR : INS;
 
         return ins;
     }
     // Fetch the opcode byte
-    uint8_t opcode = memory[cpu->pc];
+    uint8_t opcode = mem_read8(memory, cpu->pc);
 
     // Update the instruction's opcode field
     ins.opcode = opcode;
@@ -67,7 +68,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.opcode = opcode;
         break;
     case 0x20:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -85,7 +86,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x21:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -103,7 +104,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x22:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -122,7 +123,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x23:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -141,7 +142,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x24:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -160,7 +161,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x25:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -179,7 +180,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         }
         break;
     case 0x26:
-        if (!validate_pc(cpu, 1))
+        if (!validate_pc(cpu, memory, 1))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -201,8 +202,8 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.type = IRMOVQ;
         ins.size = 10;
         ins.opcode = opcode;
-        ins.ra = memory[cpu->pc + 1] >> 4;
-        ins.rb = memory[cpu->pc + 1] & 0x0F;
+        ins.ra = mem_read8(memory, cpu->pc + 1) >> 4;
+        ins.rb = mem_read8(memory, cpu->pc + 1) & 0x0F;
         if (ins.ra != 0xF || ins.rb < 0 || ins.rb > 14)
         {
             cpu->stat = INS;
@@ -210,11 +211,10 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
             ins.type = INVALID;
             return ins;
         }
-        ins.value = 0;
-        memcpy(&ins.value, &memory[cpu->pc + 2], 8);
+        ins.value = mem_read64(memory, cpu->pc + 2);
         break;
     case 0x40:
-        if (!validate_pc(cpu, 9))
+        if (!validate_pc(cpu, memory, 9))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -229,7 +229,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
             return ins;
         }
         ins.dest = 0;
-        memcpy(&ins.d, &memory[cpu->pc + 2], 8);
+        ins.d = mem_read64(memory, cpu->pc + 2);
 
         break;
     case 0x50:
@@ -244,7 +244,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
             return ins;
         }
         ins.d = 0;
-        memcpy(&ins.d, &memory[cpu->pc + 2], 8);
+        ins.d = mem_read64(memory, cpu->pc + 2);
         break;
     case 0x60:
         ins.type = OPQ;
@@ -303,59 +303,52 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.jump = JMP;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x71:
         ins.type = JUMP;
         ins.jump = JLE;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x72:
         ins.type = JUMP;
         ins.jump = JL;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x73:
         ins.type = JUMP;
         ins.jump = JE;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x74:
         ins.type = JUMP;
         ins.jump = JNE;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x75:
         ins.type = JUMP;
         ins.jump = JGE;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x76:
         ins.type = JUMP;
         ins.jump = JG;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x80:
-        if (!validate_pc(cpu, 8))
+        if (!validate_pc(cpu, memory, 8))
         {
             cpu->stat = ADR;
             return set_invalid_ins(cpu, &ins);
@@ -363,8 +356,7 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.type = CALL;
         ins.size = 9;
         ins.opcode = opcode;
-        ins.dest = 0;
-        memcpy(&ins.dest, &memory[cpu->pc + 1], 8);
+        ins.dest = mem_read64(memory, cpu->pc + 1);
         break;
     case 0x90:
         ins.type = RET;
@@ -375,8 +367,8 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.type = PUSHQ;
         ins.size = 2;
         ins.opcode = opcode;
-        ins.ra = memory[cpu->pc + 1] >> 4;
-        ins.rb = memory[cpu->pc + 1] & 0x0F;
+        ins.ra = mem_read8(memory, cpu->pc + 1) >> 4;
+        ins.rb = mem_read8(memory, cpu->pc + 1) & 0x0F;
         if (ins.rb != 0xf)
         {
             cpu->stat = INS;
@@ -389,8 +381,8 @@ y86_inst_t fetch(y86_t *cpu, memory_t memory)
         ins.type = POPQ;
         ins.size = 2;
         ins.opcode = opcode;
-        ins.ra = memory[cpu->pc + 1] >> 4;
-        ins.rb = memory[cpu->pc + 1] & 0x0F;
+        ins.ra = mem_read8(memory, cpu->pc + 1) >> 4;
+        ins.rb = mem_read8(memory, cpu->pc + 1) & 0x0F;
         if (ins.rb != 0xf)
         {
             cpu->stat = INS;
@@ -495,9 +487,47 @@ void disassemble(y86_inst_t inst)
 
 //============================================================================
 /*
- * disassemble_code - disassemble a segment of code in memory and print it
+ * disassemble_code - disassemble a segment of code in memory and print it,
+ * labelling the addresses that have symbols in syms (may be NULL)
  */
-void disassemble_code(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr)
+void disassemble_code(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr,
+                      const symbol_index_t *syms)
+{
+    disassemble_code_with(memory, phdr, hdr, syms, NULL, NULL);
+}
+
+//============================================================================
+/*
+ * print_labels - print a label line for every symbol at pc, except a
+ * _start at the entry point, which already has its own
+ */
+static void print_labels(address_t pc, const symbol_index_t *syms, bool entry,
+                         dis_annotate_t annotate, void *arg)
+{
+    int n = 0;
+    const elf_symbol_t *sym = symbol_at(syms, pc, &n);
+    for (int i = 0; i < n; i++)
+    {
+        if (entry && strcmp(sym[i].name, "_start") == 0)
+        {
+            continue;
+        }
+        if (annotate)
+        {
+            annotate(pc, NULL, arg);
+        }
+        printf("  0x%03lx:                      | %s:\n", pc, sym[i].name);
+    }
+}
+
+//============================================================================
+/*
+ * disassemble_code_with - disassemble_code, calling annotate (if not NULL)
+ * before every line it prints
+ */
+void disassemble_code_with(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr,
+                           const symbol_index_t *syms,
+                           dis_annotate_t annotate, void *arg)
 {
     if (!memory || !phdr || !hdr)
     {
@@ -511,6 +541,10 @@ void disassemble_code(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr)
     // start at beginning of the segment
     if (phdr->p_type == CODE)
     {
+        if (annotate)
+        {
+            annotate(cpu.pc, NULL, arg);
+        }
         printf("  0x%03x:                      | .pos 0x%03x code\n", phdr->p_vaddr, phdr->p_vaddr);
         // iterate through the segment one instruction at a time
         while (cpu.pc < (phdr->p_vaddr + phdr->p_filesz))
@@ -519,25 +553,39 @@ void disassemble_code(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr)
             {
                 if (cpu.pc == hdr->e_entry)
                 {
+                    if (annotate)
+                    {
+                        annotate(cpu.pc, NULL, arg);
+                    }
                     printf("  0x%03lx:                      | _start:\n", cpu.pc);
                     started = true;
                 }
             }
+            print_labels(cpu.pc, syms, cpu.pc == hdr->e_entry, annotate, arg);
             ins = fetch(&cpu, memory); // stage 1: fetch instruction
             if (ins.type == INVALID)
             {
+                if (annotate)
+                {
+                    annotate(cpu.pc, NULL, arg);
+                }
                 printf("Invalid opcode: 0x%02x\n", ins.opcode);
                 cpu.pc += 1;
                 break;
             }
 
+            if (annotate)
+            {
+                annotate(cpu.pc, &ins, arg);
+            }
+
             // print the memory address
             printf("  0x%03x: ", (unsigned int)cpu.pc);
 
             // print the raw bytes of the instruction
             for (int i = 0; i < ins.size; i++)
             {
-                printf("%02x", memory[cpu.pc + i]);
+                printf("%02x", mem_read8(memory, cpu.pc + i));
             }
 
             // print padding spaces for alignment
@@ -551,6 +599,10 @@ void disassemble_code(memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr)
 
             if (!started && cpu.pc == hdr->e_entry)
             {
+                if (annotate)
+                {
+                    annotate(cpu.pc, NULL, arg);
+                }
                 printf("  0x%lx:                      | _start:\n", cpu.pc);
                 started = true;
             }
@@ -583,7 +635,7 @@ void disassemble_data(memory_t memory, elf_phdr_t *phdr)
                 printf("  0x%01x: ", phdr->p_vaddr + j);
             }
 
-            printf("%02x", memory[phdr->p_vaddr + j]);
+            printf("%02x", mem_read8(memory, phdr->p_vaddr + j));
 
             if (j % 8 == 7)
             {
@@ -591,10 +643,10 @@ void disassemble_data(memory_t memory, elf_phdr_t *phdr)
                 for (int k = 0; k < 8; k++)
                 {
                     all_zero = true;
-                    if (memory[phdr->p_vaddr + j - k] != 0)
+                    if (mem_read8(memory, phdr->p_vaddr + j - k) != 0)
                     {
                         all_zero = false;
-                        printf("%01x", memory[phdr->p_vaddr + j - k]);
+                        printf("%01x", mem_read8(memory, phdr->p_vaddr + j - k));
                     }
                 }
                 if (all_zero)
@@ -634,8 +686,8 @@ void disassemble_rodata(memory_t memory, elf_phdr_t *phdr)
         // executes until for first ten bytes or null is found
         for (i = cpu.pc; i < cpu.pc + 10; i++)
         {
-            printf("%02x", memory[i]);
-            if (memory[i] == 0x00)
+            printf("%02x", mem_read8(memory, i));
+            if (mem_read8(memory, i) == 0x00)
             {
                 finished = true;
                 print_spacing(i - (cpu.pc - 1));
@@ -645,9 +697,9 @@ void disassemble_rodata(memory_t memory, elf_phdr_t *phdr)
         // print hex in characters
         i = cpu.pc;
         printf(" |   .string \"");
-        while (memory[i] != 0x00)
+        while (mem_read8(memory, i) != 0x00)
         {
-            printf("%c", memory[i++]);
+            printf("%c", mem_read8(memory, i++));
         }
 
         // get number of bytes contained in this data
@@ -665,16 +717,16 @@ void disassemble_rodata(memory_t memory, elf_phdr_t *phdr)
             printf("  0x%03lx: ", (uint64_t)i);
 
             // loop until null character is found
-            while (memory[i] != 0x00)
+            while (mem_read8(memory, i) != 0x00)
             {
-                printf("%02x", memory[i++]);
+                printf("%02x", mem_read8(memory, i++));
                 // if j is multiple of ten print | and newline
                 if (++j % 10 == 0)
                 {
                     printf(" |\n  0x%03lx: ", (uint64_t)i);
                 }
             }
-            printf("%02x", memory[i++]);
+            printf("%02x", mem_read8(memory, i++));
             print_spacing((j % 10) + 1);
             printf(" |");
         }
@@ -693,8 +745,8 @@ bool is_valid_reg(y86_t *cpu, memory_t memory, y86_inst_t *ins)
         return false;
     }
 
-    ins->ra = memory[cpu->pc + 1] >> 4;
-    ins->rb = memory[cpu->pc + 1] & 0x0F;
+    ins->ra = mem_read8(memory, cpu->pc + 1) >> 4;
+    ins->rb = mem_read8(memory, cpu->pc + 1) & 0x0F;
 
     if (ins->type != RMMOVQ && ins->type != MRMOVQ)
     {
@@ -710,9 +762,9 @@ bool is_valid_reg(y86_t *cpu, memory_t memory, y86_inst_t *ins)
 /*
  * This function checks that the program counter does not exceed the memory bounds.
  */
-bool validate_pc(y86_t *cpu, int offset)
+bool validate_pc(y86_t *cpu, memory_t memory, int offset)
 {
-    return (cpu->pc + offset) < MEMSIZE;
+    return (cpu->pc + offset) < mem_size(memory);
 }
 //============================================================================
 /*
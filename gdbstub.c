@@ -0,0 +1,983 @@
+/*
+ * GDB remote stub (-g).
+ *
+ * Serves one program to gdb over the Remote Serial Protocol on a local
+ * TCP port or a Unix socket:
+ *
+ *     y86 -g 1234 prog.o          (gdb) target remote :1234
+ *     y86 -g /tmp/y86.sock prog.o (gdb) target remote /tmp/y86.sock
+ *
+ * Registers are %rax .. %r14 in Y86 order, rip and eflags (ZF, SF and
+ * OF in their x86 bit positions), described to gdb by target.xml.
+ * Memory reads and writes, single step, continue, software breakpoints
+ * (Z0/Z1) and write watchpoints (Z2, see mem_watch()) are supported.
+ * "monitor record" starts recording for reverse-stepi and
+ * reverse-continue (bs, bc), "monitor record stop" ends it. Register
+ * and memory writes made while recording are undone by stepping back
+ * past them.
+ *
+ * Continuing with nothing armed runs the plain execute_step() loop and
+ * only looks for a ^C from gdb every GDB_POLL_INTERVAL instructions.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "./headers/gdbstub.h"
+#include "./headers/decode-cache.h"
+#include "./headers/interpret.h"
+#include "./headers/loader.h"
+#include "./headers/mem-access.h"
+
+#define NUM_GDB_REGS (NUMREGS + 2)   // general registers, rip, eflags
+#define REG_RIP NUMREGS
+#define REG_EFLAGS (NUMREGS + 1)
+
+static const char target_xml[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+    "<target version=\"1.0\">\n"
+    "  <feature name=\"org.y86.core\">\n"
+    "    <reg name=\"rax\" bitsize=\"64\" type=\"int64\" regnum=\"0\"/>\n"
+    "    <reg name=\"rcx\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"rdx\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"rbx\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"rsp\" bitsize=\"64\" type=\"data_ptr\"/>\n"
+    "    <reg name=\"rbp\" bitsize=\"64\" type=\"data_ptr\"/>\n"
+    "    <reg name=\"rsi\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"rdi\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r8\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r9\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r10\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r11\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r12\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r13\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"r14\" bitsize=\"64\" type=\"int64\"/>\n"
+    "    <reg name=\"rip\" bitsize=\"64\" type=\"code_ptr\"/>\n"
+    "    <reg name=\"eflags\" bitsize=\"32\" type=\"int32\"/>\n"
+    "  </feature>\n"
+    "</target>\n";
+
+//=======================================================================
+/*
+ * Value of the hex digit c.
+ */
+static int hexval(int c)
+{
+    return isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+}
+
+//=======================================================================
+/*
+ * Append len bytes of buf as hex digits to out, NUL-terminated.
+ */
+static void to_hex(char *out, const void *buf, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    const uint8_t *in = buf;
+    for (size_t i = 0; i < len; i++)
+    {
+        *out++ = digits[in[i] >> 4];
+        *out++ = digits[in[i] & 0xF];
+    }
+    *out = '\0';
+}
+
+//=======================================================================
+/*
+ * Decode up to len bytes from the hex digits at in into buf. Return
+ * the number decoded.
+ */
+static size_t from_hex(const char *in, void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    size_t n = 0;
+    while (n < len && isxdigit((unsigned char)in[0]) && isxdigit((unsigned char)in[1]))
+    {
+        out[n++] = hexval(in[0]) << 4 | hexval(in[1]);
+        in += 2;
+    }
+    return n;
+}
+
+//=======================================================================
+/*
+ * Parse a hex number at *p and move *p past it.
+ */
+static uint64_t parse_hex(const char **p)
+{
+    uint64_t value = 0;
+    while (isxdigit((unsigned char)**p))
+    {
+        value = value << 4 | hexval(**p);
+        (*p)++;
+    }
+    return value;
+}
+
+//=======================================================================
+/*
+ * Read more bytes from gdb into the input buffer, waiting at most
+ * timeout milliseconds (-1 for ever). A ^C outside a packet only sets
+ * interrupted. Return false once gdb has gone.
+ */
+static bool fill(gdb_stub_t *stub, int timeout)
+{
+    struct pollfd pfd = { stub->fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0)
+    {
+        return errno == EINTR;
+    }
+    if (ready == 0)
+    {
+        return true;
+    }
+    if (stub->inlen == sizeof(stub->in))
+    {
+        // a packet larger than we announced, drop it
+        stub->inlen = 0;
+    }
+    ssize_t n = read(stub->fd, stub->in + stub->inlen, sizeof(stub->in) - stub->inlen);
+    if (n <= 0)
+    {
+        return false;
+    }
+    for (ssize_t i = 0; i < n; i++)
+    {
+        char c = stub->in[stub->inlen + i];
+        if (c == '\x03')
+        {
+            stub->interrupted = true;
+        }
+    }
+    stub->inlen += n;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Send data as a packet.
+ */
+static bool put_packet(gdb_stub_t *stub, const char *data)
+{
+    static char buf[2 * GDB_BUFSIZE + 8];
+    uint8_t sum = 0;
+    size_t len = 0;
+    buf[len++] = '$';
+    for (const char *p = data; *p != '\0' && len < sizeof(buf) - 4; p++)
+    {
+        sum += (uint8_t)*p;
+        buf[len++] = *p;
+    }
+    len += snprintf(buf + len, 4, "#%02x", sum);
+    for (size_t done = 0; done < len;)
+    {
+        ssize_t n = write(stub->fd, buf + done, len - done);
+        if (n <= 0)
+        {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Wait for the next packet from gdb and copy its data, NUL-terminated,
+ * to out. Acks, ^C and noise between packets are skipped. Return false
+ * once gdb has gone.
+ */
+static bool get_packet(gdb_stub_t *stub, char *out, size_t cap)
+{
+    for (;;)
+    {
+        char *start = memchr(stub->in, '$', stub->inlen);
+        if (start == NULL)
+        {
+            stub->inlen = 0;
+        }
+        else
+        {
+            char *end = memchr(start, '#', stub->in + stub->inlen - start);
+            if (end != NULL && end + 2 < stub->in + stub->inlen)
+            {
+                size_t len = end - start - 1;
+                uint8_t sum = 0;
+                for (size_t i = 0; i < len; i++)
+                {
+                    sum += (uint8_t)start[1 + i];
+                }
+                bool ok = len < cap && isxdigit((unsigned char)end[1]) &&
+                          isxdigit((unsigned char)end[2]) &&
+                          (hexval(end[1]) << 4 | hexval(end[2])) == sum;
+                if (ok)
+                {
+                    memcpy(out, start + 1, len);
+                    out[len] = '\0';
+                }
+                size_t used = end + 3 - stub->in;
+                memmove(stub->in, stub->in + used, stub->inlen - used);
+                stub->inlen -= used;
+                if (!stub->noack && write(stub->fd, ok ? "+" : "-", 1) != 1)
+                {
+                    return false;
+                }
+                if (ok)
+                {
+                    return true;
+                }
+                continue;
+            }
+            // keep the partial packet at the front
+            memmove(stub->in, start, stub->in + stub->inlen - start);
+            stub->inlen -= start - stub->in;
+        }
+        if (!fill(stub, -1))
+        {
+            return false;
+        }
+    }
+}
+
+//=======================================================================
+/*
+ * Value of gdb register reg.
+ */
+static uint64_t get_reg(gdb_stub_t *stub, int reg)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    if (reg < NUMREGS)
+    {
+        return cpu->regs[reg];
+    }
+    if (reg == REG_RIP)
+    {
+        return cpu->pc;
+    }
+    return cpu->zf << 6 | cpu->sf << 7 | cpu->of << 11;
+}
+
+//=======================================================================
+static void set_reg(gdb_stub_t *stub, int reg, uint64_t value)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    if (reg < NUMREGS)
+    {
+        cpu->regs[reg] = value;
+    }
+    else if (reg == REG_RIP)
+    {
+        cpu->pc = value;
+    }
+    else
+    {
+        cpu->zf = (value >> 6) & 1;
+        cpu->sf = (value >> 7) & 1;
+        cpu->of = (value >> 11) & 1;
+        cpu->cc_op = CC_NONE;
+    }
+}
+
+//=======================================================================
+/*
+ * Bytes of gdb register reg.
+ */
+static int reg_size(int reg)
+{
+    return reg == REG_EFLAGS ? 4 : 8;
+}
+
+//=======================================================================
+/*
+ * Arm (on) or disarm a breakpoint at addr. Return false if addr is
+ * outside memory or out of memory.
+ */
+static bool set_break(gdb_stub_t *stub, address_t addr, bool on)
+{
+    if (addr >= mem_size(stub->ctx.mem))
+    {
+        return false;
+    }
+    uint8_t bit = 1 << (addr & 7);
+    bool armed = stub->breaks[addr >> 3] & bit;
+    if (on && !armed)
+    {
+        if (stub->nbreaks == stub->bcap)
+        {
+            int cap = stub->bcap ? stub->bcap * 2 : 16;
+            address_t *blist = realloc(stub->blist, cap * sizeof(address_t));
+            if (blist == NULL)
+            {
+                return false;
+            }
+            stub->blist = blist;
+            stub->bcap = cap;
+        }
+        stub->blist[stub->nbreaks++] = addr;
+        stub->breaks[addr >> 3] |= bit;
+    }
+    else if (!on && armed)
+    {
+        for (int i = 0; i < stub->nbreaks; i++)
+        {
+            if (stub->blist[i] == addr)
+            {
+                stub->blist[i] = stub->blist[--stub->nbreaks];
+                break;
+            }
+        }
+        stub->breaks[addr >> 3] &= ~bit;
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Arm (on) or disarm the write watchpoint on [addr, addr + len).
+ */
+static bool set_watch(gdb_stub_t *stub, address_t addr, uint64_t len, bool on)
+{
+    int i = 0;
+    while (i < stub->nwatches &&
+           (stub->watches[i].addr != addr || stub->watches[i].len != len))
+    {
+        i++;
+    }
+    if (on == (i < stub->nwatches))
+    {
+        return true;
+    }
+    if (!on)
+    {
+        stub->watches[i] = stub->watches[--stub->nwatches];
+    }
+    else if (stub->nwatches == GDB_MAXWATCH || len == 0)
+    {
+        return false;
+    }
+    else
+    {
+        stub->watches[stub->nwatches].addr = addr;
+        stub->watches[stub->nwatches].len = len;
+        stub->nwatches++;
+    }
+
+    // the bitmaps cannot take a range out, so build them anew
+    bool ok = true;
+    mem_watch_clear(stub->ctx.mem);
+    for (i = 0; i < stub->nwatches; i++)
+    {
+        if (!mem_watch(stub->ctx.mem, stub->watches[i].addr, stub->watches[i].len))
+        {
+            stub->watches[i--] = stub->watches[--stub->nwatches];
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Execute one instruction, recording it if asked to.
+ */
+static inline bool step_one(gdb_stub_t *stub)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    if (stub->undo != NULL)
+    {
+        if (!undo_step(stub->undo, cpu, stub->ctx.mem))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        execute_step(cpu, stub->ctx.mem);
+    }
+    stub->count++;
+    if (stub->ctx.mem->watch_hit)
+    {
+        stub->ctx.mem->watch_hit = false;
+        stub->watch_hit = true;
+        stub->watch_addr = stub->ctx.mem->watch_addr;
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * The stop reply for the state execution stopped in. sig is the signal
+ * to report while the cpu is still running.
+ */
+static void stop_reply(gdb_stub_t *stub, char *out, int sig)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    settle_flags(cpu);
+    if (cpu->stat == ADR)
+    {
+        sig = 11;   // SIGSEGV
+    }
+    else if (cpu->stat == INS)
+    {
+        sig = 4;    // SIGILL
+    }
+    if (stub->watch_hit)
+    {
+        sprintf(out, "T%02xwatch:%lx;thread:1;", sig, stub->watch_addr);
+        stub->watch_hit = false;
+        return;
+    }
+    sprintf(out, "T%02xthread:1;", sig);
+}
+
+//=======================================================================
+/*
+ * Continue (or single step) from the current pc and put the stop reply
+ * in out. A stopped cpu cannot go on, gdb is told the program ended.
+ */
+static void resume(gdb_stub_t *stub, bool step, char *out)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    memory_t mem = stub->ctx.mem;
+    if (cpu->stat != AOK)
+    {
+        if (cpu->stat == HLT)
+        {
+            strcpy(out, "W00");
+        }
+        else
+        {
+            sprintf(out, "X%02x", cpu->stat == ADR ? 11 : 4);
+        }
+        return;
+    }
+    stub->interrupted = false;
+    stub->watch_hit = false;
+    mem->watch_hit = false;
+    if (step)
+    {
+        step_one(stub);
+        stop_reply(stub, out, 5);
+        return;
+    }
+
+    if (stub->nbreaks == 0 && stub->nwatches == 0 && stub->undo == NULL)
+    {
+        // nothing to look at between instructions
+        while (cpu->stat == AOK && !stub->interrupted)
+        {
+            int i = 0;
+            for (; i < GDB_POLL_INTERVAL && cpu->stat == AOK; i++)
+            {
+                execute_step(cpu, mem);
+            }
+            stub->count += i;
+            if (!fill(stub, 0))
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        uint64_t poll = 0;
+        while (cpu->stat == AOK && !stub->interrupted)
+        {
+            if (!step_one(stub) || stub->watch_hit)
+            {
+                break;
+            }
+            if (cpu->pc < mem_size(mem) && (stub->breaks[cpu->pc >> 3] >> (cpu->pc & 7) & 1))
+            {
+                break;
+            }
+            if (++poll == GDB_POLL_INTERVAL)
+            {
+                poll = 0;
+                if (!fill(stub, 0))
+                {
+                    break;
+                }
+            }
+        }
+    }
+    stop_reply(stub, out, stub->interrupted && cpu->stat == AOK ? 2 : 5);
+}
+
+//=======================================================================
+/*
+ * Step back one instruction (step) or to the previous breakpoint and
+ * put the stop reply in out.
+ */
+static void reverse(gdb_stub_t *stub, bool step, char *out)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    if (stub->undo == NULL)
+    {
+        strcpy(out, "E01");
+        return;
+    }
+    uint64_t done = step ? undo_back(stub->undo, cpu, stub->ctx.mem, 1)
+                         : undo_back_to(stub->undo, cpu, stub->ctx.mem,
+                                        stub->blist, stub->nbreaks);
+    stub->count -= done;
+    bool at_break = cpu->pc < mem_size(stub->ctx.mem) &&
+                    (stub->breaks[cpu->pc >> 3] >> (cpu->pc & 7) & 1);
+    if (done == 0 || (!step && !at_break))
+    {
+        // the start of the recording
+        settle_flags(cpu);
+        strcpy(out, "T05replaylog:begin;thread:1;");
+        return;
+    }
+    stop_reply(stub, out, 5);
+}
+
+//=======================================================================
+/*
+ * Save the machine before gdb changes registers, memory or the pc, so
+ * that stepping back past the change undoes it. Return false if it is
+ * being recorded and cannot be saved; the change is then refused.
+ */
+static bool before_edit(gdb_stub_t *stub)
+{
+    return stub->undo == NULL || undo_edit(stub->undo, &stub->ctx.cpu, stub->ctx.mem);
+}
+
+//=======================================================================
+/*
+ * qXfer:features:read:target.xml:offset,length
+ */
+static void read_target_xml(const char *args, char *out)
+{
+    const char *p = args;
+    uint64_t offset = parse_hex(&p);
+    if (*p++ != ',')
+    {
+        strcpy(out, "E01");
+        return;
+    }
+    uint64_t len = parse_hex(&p);
+    uint64_t total = sizeof(target_xml) - 1;
+    if (offset >= total)
+    {
+        strcpy(out, "l");
+        return;
+    }
+    if (len > GDB_BUFSIZE - 2)
+    {
+        len = GDB_BUFSIZE - 2;
+    }
+    if (len > total - offset)
+    {
+        len = total - offset;
+    }
+    out[0] = offset + len < total ? 'm' : 'l';
+    memcpy(out + 1, target_xml + offset, len);
+    out[1 + len] = '\0';
+}
+
+//=======================================================================
+/*
+ * "monitor" commands.
+ */
+static void monitor(gdb_stub_t *stub, const char *hex, char *out)
+{
+    char cmd[64];
+    size_t n = from_hex(hex, cmd, sizeof(cmd) - 1);
+    cmd[n] = '\0';
+    const char *msg;
+    if (strcmp(cmd, "record") == 0)
+    {
+        if (stub->undo == NULL)
+        {
+            stub->undo = malloc(sizeof(undo_log_t));
+            if (stub->undo == NULL ||
+                !undo_init(stub->undo, &stub->ctx.cpu, stub->ctx.mem, stub->count))
+            {
+                free(stub->undo);
+                stub->undo = NULL;
+                strcpy(out, "E01");
+                return;
+            }
+        }
+        msg = "Recording for reverse execution.\n";
+    }
+    else if (strcmp(cmd, "record stop") == 0)
+    {
+        if (stub->undo != NULL)
+        {
+            undo_free(stub->undo);
+            free(stub->undo);
+            stub->undo = NULL;
+        }
+        msg = "Recording stopped.\n";
+    }
+    else
+    {
+        msg = "Commands are \"record\" and \"record stop\".\n";
+    }
+    char reply[2 * 64 + 2] = "O";
+    to_hex(reply + 1, msg, strlen(msg));
+    put_packet(stub, reply);
+    strcpy(out, "OK");
+}
+
+//=======================================================================
+/*
+ * Handle the packet in and put the reply in out, empty for packets not
+ * supported. Return false when the session ends.
+ */
+static bool handle(gdb_stub_t *stub, const char *in, char *out)
+{
+    y86_t *cpu = &stub->ctx.cpu;
+    memory_t mem = stub->ctx.mem;
+    const char *p = in + 1;
+    out[0] = '\0';
+
+    switch (in[0])
+    {
+    case '?':
+        stop_reply(stub, out, 5);
+        break;
+    case 'g':
+        settle_flags(cpu);
+        for (int i = 0; i < NUM_GDB_REGS; i++)
+        {
+            uint64_t value = get_reg(stub, i);
+            to_hex(out + strlen(out), &value, reg_size(i));
+        }
+        break;
+    case 'G':
+        if (!before_edit(stub))
+        {
+            strcpy(out, "E01");
+            break;
+        }
+        for (int i = 0; i < NUM_GDB_REGS && strlen(p) >= 2 * (size_t)reg_size(i); i++)
+        {
+            uint64_t value = 0;
+            from_hex(p, &value, reg_size(i));
+            set_reg(stub, i, value);
+            p += 2 * reg_size(i);
+        }
+        strcpy(out, "OK");
+        break;
+    case 'p':
+    {
+        uint64_t reg = parse_hex(&p);
+        if (reg >= NUM_GDB_REGS)
+        {
+            strcpy(out, "E01");
+            break;
+        }
+        settle_flags(cpu);
+        uint64_t value = get_reg(stub, reg);
+        to_hex(out, &value, reg_size(reg));
+        break;
+    }
+    case 'P':
+    {
+        uint64_t reg = parse_hex(&p);
+        if (reg >= NUM_GDB_REGS || *p++ != '=' || !before_edit(stub))
+        {
+            strcpy(out, "E01");
+            break;
+        }
+        uint64_t value = 0;
+        from_hex(p, &value, reg_size(reg));
+        settle_flags(cpu);
+        set_reg(stub, reg, value);
+        strcpy(out, "OK");
+        break;
+    }
+    case 'm':
+    {
+        address_t addr = parse_hex(&p);
+        uint64_t len = *p++ == ',' ? parse_hex(&p) : 0;
+        if (addr >= mem_size(mem))
+        {
+            strcpy(out, "E01");
+            break;
+        }
+        if (len > (GDB_BUFSIZE - 1) / 2)
+        {
+            len = (GDB_BUFSIZE - 1) / 2;
+        }
+        if (len > mem_size(mem) - addr)
+        {
+            len = mem_size(mem) - addr;
+        }
+        uint8_t buf[GDB_BUFSIZE / 2];
+        mem_read(mem, addr, buf, len);
+        to_hex(out, buf, len);
+        break;
+    }
+    case 'M':
+    {
+        address_t addr = parse_hex(&p);
+        uint64_t len = *p++ == ',' ? parse_hex(&p) : 0;
+        uint8_t buf[GDB_BUFSIZE / 2];
+        if (*p++ != ':' || len > sizeof(buf) || addr > mem_size(mem) ||
+            len > mem_size(mem) - addr || from_hex(p, buf, len) != len ||
+            !before_edit(stub))
+        {
+            strcpy(out, "E01");
+            break;
+        }
+        mem_write(mem, addr, buf, len);
+        decode_cache_invalidate(mem, addr, len);
+        strcpy(out, "OK");
+        break;
+    }
+    case 'c':
+    case 's':
+        if (*p != '\0')
+        {
+            if (!before_edit(stub))
+            {
+                strcpy(out, "E01");
+                break;
+            }
+            cpu->pc = parse_hex(&p);
+        }
+        resume(stub, in[0] == 's', out);
+        break;
+    case 'b':
+        if (in[1] == 's' || in[1] == 'c')
+        {
+            reverse(stub, in[1] == 's', out);
+        }
+        break;
+    case 'Z':
+    case 'z':
+    {
+        int type = in[1] - '0';
+        p = in + 2;
+        address_t addr = *p++ == ',' ? parse_hex(&p) : 0;
+        uint64_t len = *p++ == ',' ? parse_hex(&p) : 0;
+        bool ok;
+        if (type == 0 || type == 1)
+        {
+            ok = set_break(stub, addr, in[0] == 'Z');
+        }
+        else if (type == 2)
+        {
+            ok = set_watch(stub, addr, len, in[0] == 'Z');
+        }
+        else
+        {
+            // read and access watchpoints: loads are not observed
+            break;
+        }
+        strcpy(out, ok ? "OK" : "E01");
+        break;
+    }
+    case 'H':
+    case 'T':
+        strcpy(out, "OK");
+        break;
+    case 'q':
+        if (strncmp(in, "qSupported", 10) == 0)
+        {
+            sprintf(out, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;"
+                         "ReverseStep+;ReverseContinue+;swbreak+",
+                    GDB_BUFSIZE);
+        }
+        else if (strncmp(in, "qXfer:features:read:target.xml:", 31) == 0)
+        {
+            read_target_xml(in + 31, out);
+        }
+        else if (strcmp(in, "qAttached") == 0)
+        {
+            strcpy(out, "1");
+        }
+        else if (strcmp(in, "qC") == 0)
+        {
+            strcpy(out, "QC1");
+        }
+        else if (strcmp(in, "qfThreadInfo") == 0)
+        {
+            strcpy(out, "m1");
+        }
+        else if (strcmp(in, "qsThreadInfo") == 0)
+        {
+            strcpy(out, "l");
+        }
+        else if (strncmp(in, "qRcmd,", 6) == 0)
+        {
+            monitor(stub, in + 6, out);
+        }
+        break;
+    case 'Q':
+        if (strcmp(in, "QStartNoAckMode") == 0)
+        {
+            // this packet was acked already, the reply is the last one
+            strcpy(out, "OK");
+            stub->noack = true;
+        }
+        break;
+    case 'D':
+        put_packet(stub, "OK");
+        return false;
+    case 'k':
+        return false;
+    default:
+        break;
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Listen on target, a TCP port on the loopback interface if it is a
+ * number and a Unix socket path otherwise, and accept one connection.
+ * Return it, or -1.
+ */
+static int accept_gdb(const char *target)
+{
+    bool tcp = target[0] != '\0' && strspn(target, "0123456789") == strlen(target);
+    int lfd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (lfd < 0)
+    {
+        return -1;
+    }
+    int ok;
+    if (tcp)
+    {
+        int one = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(target));
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ok = bind(lfd, (struct sockaddr *)&sin, sizeof(sin));
+    }
+    else
+    {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(target) >= sizeof(sun.sun_path))
+        {
+            close(lfd);
+            return -1;
+        }
+        strcpy(sun.sun_path, target);
+        // only a stale socket is replaced, never another file
+        struct stat st;
+        if (stat(target, &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            unlink(target);
+        }
+        ok = bind(lfd, (struct sockaddr *)&sun, sizeof(sun));
+    }
+    if (ok != 0 || listen(lfd, 1) != 0)
+    {
+        close(lfd);
+        return -1;
+    }
+    printf("Waiting for gdb on %s\n", target);
+    fflush(stdout);
+    int fd = accept(lfd, NULL, NULL);
+    close(lfd);
+    if (!tcp)
+    {
+        unlink(target);
+    }
+    if (fd >= 0 && tcp)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+//=======================================================================
+/*
+ * Load the program named in opts and serve it to gdb until it detaches
+ * or kills it. Return the exit status for main().
+ */
+int run_gdb(const y86_options_t *opts)
+{
+    static gdb_stub_t stub;
+    static char in[GDB_BUFSIZE], out[2 * GDB_BUFSIZE];
+
+    if (!context_init(&stub.ctx, opts->vaddrbits))
+    {
+        printf("Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    set_mem_trace(stub.ctx.mem, NULL);
+    elf_image_t image;
+    if (!map_image(opts->file, &image))
+    {
+        printf("Failed to open File\n");
+        context_free(&stub.ctx);
+        return EXIT_FAILURE;
+    }
+    const char *error = image_load(&image, stub.ctx.mem);
+    if (error != NULL)
+    {
+        printf("%s\n", error);
+        unmap_image(&image);
+        context_free(&stub.ctx);
+        return EXIT_FAILURE;
+    }
+    y86_t *cpu = &stub.ctx.cpu;
+    cpu->stat = AOK;
+    cpu->pc = image.hdr->e_entry;
+    cpu->memsize = mem_size(stub.ctx.mem);
+    unmap_image(&image);
+
+    stub.breaks = calloc((mem_size(stub.ctx.mem) >> 3) + 1, 1);
+    if (stub.breaks == NULL)
+    {
+        printf("Failed to allocate memory\n");
+        context_free(&stub.ctx);
+        return EXIT_FAILURE;
+    }
+    stub.fd = accept_gdb(opts->gdb);
+    if (stub.fd < 0)
+    {
+        printf("Failed to listen for gdb on %s\n", opts->gdb);
+        free(stub.breaks);
+        context_free(&stub.ctx);
+        return EXIT_FAILURE;
+    }
+
+    while (get_packet(&stub, in, sizeof(in)))
+    {
+        if (!handle(&stub, in, out))
+        {
+            break;
+        }
+        if (!put_packet(&stub, out))
+        {
+            break;
+        }
+    }
+
+    close(stub.fd);
+    if (stub.undo != NULL)
+    {
+        undo_free(stub.undo);
+        free(stub.undo);
+    }
+    free(stub.blist);
+    free(stub.breaks);
+    context_free(&stub.ctx);
+    return EXIT_SUCCESS;
+}
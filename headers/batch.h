@@ -0,0 +1,45 @@
+#ifndef __BATCH__
+#define __BATCH__
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "y86.h"
+#include "options.h"
+
+/* One simulated machine. A batch keeps its contexts and reuses them from
+   image to image: the page table is allocated once and mem_clear() drops
+   the pages of the previous program. */
+typedef struct y86_context {
+    y86_t    cpu;
+    memory_t mem;
+} y86_context_t;
+
+/* Outcome of running one image. */
+typedef struct batch_result {
+    const char *error;    /* why the image did not load, or NULL if it ran */
+    y86_stat_t  stat;     /* final cpu status, AOK if it hit the step limit */
+    address_t   pc;       /* final program counter */
+    uint64_t    count;    /* instructions executed */
+} batch_result_t;
+
+/* The images of a batch, in the order they were named. */
+typedef struct batch_list {
+    char **paths;
+    int    count;
+    int    cap;
+} batch_list_t;
+
+bool batch_collect (batch_list_t *list, char **args, int nargs);
+void batch_list_free (batch_list_t *list);
+
+bool context_init (y86_context_t *ctx, int vaddrbits);
+void context_free (y86_context_t *ctx);
+
+void run_image (y86_context_t *ctx, const char *path, uint64_t limit,
+                batch_result_t *res);
+void print_result (FILE *out, const char *path, const batch_result_t *res);
+
+int run_batch (const y86_options_t *opts);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __DECODE_CACHE__
+#define __DECODE_CACHE__
+
+#include <stdbool.h>
+
+#include "y86.h"
+
+/* One pre-decoded instruction per byte address of the simulated memory.
+   The entry remembers the status fetch() left in the CPU so a cache hit
+   has exactly the same side effects as a real fetch. */
+typedef struct decode_entry {
+    y86_inst_t inst;      /* decoded instruction starting at this address */
+    y86_stat_t stat;      /* cpu->stat after decoding this instruction */
+    bool       valid;     /* false until the address has been decoded */
+} decode_entry_t;
+
+/* Decoded instructions of one memory, kept per memory page and only
+   allocated for pages that are actually executed. */
+typedef struct decode_cache {
+    uint64_t         npages;   /* entries in pages */
+    decode_entry_t **pages;    /* PAGESIZE entries per page, or NULL */
+    page_list_t      used;     /* the pages that are not NULL */
+} decode_cache_t;
+
+y86_inst_t fetch_cached (y86_t *cpu, memory_t memory);
+
+void decode_cache_invalidate (memory_t memory, address_t addr, uint64_t len);
+void decode_cache_clear (memory_t memory);
+void decode_cache_free (memory_t memory);
+
+#endif
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "elf.h"
+#include "loader.h"
 #include "y86.h"
 
 void usage_dis ();
@@ -14,8 +15,17 @@ bool parse_command_line_p3 (int argc, char **argv,
 
 y86_inst_t fetch (y86_t *cpu, memory_t memory);
 
+/* Called before every line disassemble_code_with() prints, with the
+   instruction on that line or NULL for labels and notices, so a caller
+   can put its own columns in front. */
+typedef void (*dis_annotate_t)(address_t pc, const y86_inst_t *ins, void *arg);
+
 void disassemble (y86_inst_t inst);
-void disassemble_code   (memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr);
+void disassemble_code   (memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr,
+                         const symbol_index_t *syms);
+void disassemble_code_with (memory_t memory, elf_phdr_t *phdr, elf_hdr_t *hdr,
+                            const symbol_index_t *syms,
+                            dis_annotate_t annotate, void *arg);
 void disassemble_data   (memory_t memory, elf_phdr_t *phdr);
 void disassemble_rodata (memory_t memory, elf_phdr_t *phdr);
 
@@ -1,5 +1,5 @@
-#ifndef __ELF__
-#define __ELF__
+#ifndef __MINI_ELF__
+#define __MINI_ELF__
 
 #include <stdio.h>
 #include <stdint.h>
@@ -98,4 +98,19 @@ typedef struct __attribute__((__packed__)) elf_phdr {
     uint32_t magic;         /* DEADBEEF */
 } elf_phdr_t;
 
+/*
+   Symbol table entry, 4 bytes:
+   +-------------------------------+
+   |  0   1      |  2   3          |
+   | name        | value           |
+   +-------------------------------+
+
+   name is the offset of the NUL-terminated symbol name from the start of
+   the string table, value is the address the symbol stands for.
+*/
+typedef struct __attribute__((__packed__)) elf_sym {
+    uint16_t st_name;       /* offset of the name in the string table */
+    uint16_t st_value;      /* address of the symbol */
+} elf_sym_t;
+
 #endif
@@ -0,0 +1,51 @@
+#ifndef __GDBSTUB__
+#define __GDBSTUB__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "y86.h"
+#include "batch.h"
+#include "options.h"
+#include "undo.h"
+
+#define GDB_BUFSIZE 4096          /* largest packet exchanged, see qSupported */
+#define GDB_MAXWATCH 16           /* write watchpoints armed at once */
+#define GDB_POLL_INTERVAL (1 << 16)   /* instructions between checks for ^C */
+
+/* A write watchpoint: stop after a store touching [addr, addr + len). */
+typedef struct gdb_watch {
+    address_t addr;
+    uint64_t  len;
+} gdb_watch_t;
+
+/* One debugging session of one program. Breakpoints are a bit per
+   address, so execution only looks at them while one is armed, and a
+   list for stepping back to them. Watchpoints are byte bitmaps the
+   store path checks (mem_watch()). */
+typedef struct gdb_stub {
+    int            fd;              /* connection to gdb */
+    bool           noack;           /* QStartNoAckMode is on */
+    char           in[GDB_BUFSIZE]; /* received bytes not yet parsed */
+    size_t         inlen;
+    bool           interrupted;     /* gdb sent ^C */
+
+    y86_context_t  ctx;
+    uint64_t       count;           /* instructions executed */
+    undo_log_t    *undo;            /* "monitor record", or NULL */
+
+    uint8_t       *breaks;          /* one bit per address */
+    address_t     *blist;           /* the armed breakpoints */
+    int            nbreaks;
+    int            bcap;
+
+    gdb_watch_t    watches[GDB_MAXWATCH];
+    int            nwatches;
+    bool           watch_hit;       /* a watched store since the last check */
+    address_t      watch_addr;      /* its address */
+} gdb_stub_t;
+
+int run_gdb (const y86_options_t *opts);
+
+#endif
@@ -7,15 +7,36 @@
 
 #include "elf.h"
 #include "y86.h"
-
-void usage_interp ();
-bool parse_command_line_p4 (int argc, char **argv,
-        bool *header, bool *segments, bool *membrief, bool *memfull,
-        bool *disas_code, bool *disas_data,
-        bool *exec_normal, bool *exec_debug, char **file );
+#include "mem-access.h"
 
 void dump_cpu( const y86_t *cpu ) ;
 
+/* read_flags() returns the flags as they stand, computing them from a
+   pending OPq; settle_flags() stores them in the CPU. Code that reads
+   zf, sf or of directly must settle them first. */
+void read_flags( const y86_t *cpu , flag_t *zf , flag_t *sf , flag_t *of ) ;
+void settle_flags( y86_t *cpu ) ;
+
+/* Every memory store of an executing program (rmmovq, call and pushq) is
+   reported to memory->trace. print_mem_write() prints the "Memory write
+   to" trace line; a NULL sink makes stores silent. Building with
+   -DY86_NO_MEM_TRACE compiles the trace out of the store path. */
+void print_mem_write( address_t addr , y86_register_t value ) ;
+void set_mem_trace( memory_t memory , mem_trace_t sink ) ;
+
+#ifdef Y86_NO_MEM_TRACE
+#define TRACE_STORE(memory, addr, value) ((void)0)
+#else
+#define TRACE_STORE(memory, addr, value)        \
+    do                                          \
+    {                                           \
+        if ((memory)->trace != NULL)            \
+        {                                       \
+            (memory)->trace((addr), (value));   \
+        }                                       \
+    } while (0)
+#endif
+
 y86_register_t decode_execute(  y86_t *cpu , bool *cond , const y86_inst_t *inst ,
                                 y86_register_t *valA 
                              ) ;
@@ -25,4 +46,14 @@ void memory_wb_pc(  y86_t *cpu , memory_t memory , bool cond ,
                     y86_register_t  valA 
                  ) ;
 
+/* One instruction of the -e loop: fetch, execute, write back and the
+   check that the pc stayed inside memory. Prints nothing. */
+void execute_step( y86_t *cpu , memory_t memory ) ;
+
+/* The same step for the threaded and JIT engines to fall back on: it
+   also prints the corrupt instruction notice and settles the flags they
+   read directly. ins and valE (may be NULL) receive what it executed. */
+void step_portable( y86_t *cpu , memory_t memory , y86_inst_t *ins ,
+                    y86_register_t *valE ) ;
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef __JIT__
+#define __JIT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/* State of the basic-block JIT. Native code reaches the fields through a
+   pointer held in a host register, see jit.c for the register map. */
+typedef struct jit {
+    y86_t      *cpu;
+    memory_t    memory;
+    address_t   size;        /* mem_size(memory) */
+    uint8_t   **pages;       /* memory->pages, for inline loads and stores */
+    uint8_t    *codeline;    /* per 64-byte line of memory, non-zero if translated */
+    uint8_t  ***blocks;      /* per page, native entry of the block at each address */
+    uint64_t    count;       /* instructions executed */
+    uint8_t    *patch;       /* rel32 of the chained exit taken last */
+
+    uint8_t    *code;        /* code buffer, writable or executable */
+    uint8_t    *cur;         /* next free byte of code */
+    uint8_t    *start;       /* first byte after the entry and exit stubs */
+    uint8_t    *epilogue;    /* exit stub, returns to run_jit() */
+    int       (*enter)(struct jit *jit, uint8_t *block);
+
+    uint64_t    generation;  /* bumped whenever all translations are dropped */
+    uint64_t    line_lo;     /* codeline entries in use */
+    uint64_t    line_hi;
+    bool        traced;      /* stores must reach memory->trace */
+    bool        writable;    /* code is mapped read-write, else read-execute */
+} jit_t;
+
+uint64_t run_jit (y86_t *cpu, memory_t memory,
+                  elf_hdr_t *hdr, elf_phdr_t phdr[]);
+
+#endif
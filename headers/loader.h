@@ -0,0 +1,49 @@
+#ifndef __LOADER__
+#define __LOADER__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/* A Mini-ELF file mapped into the address space of the simulator. The
+   header and program headers are used in place, no copies are made.
+   The mapping is read-only. */
+typedef struct elf_image {
+    uint8_t    *data;     /* first byte of the file */
+    size_t      len;      /* length of the file in bytes */
+    bool        mapped;   /* data is an mmap()ed region to unmap */
+    elf_hdr_t  *hdr;      /* validated header, NULL until image_header() */
+    elf_phdr_t *phdr;     /* program header table inside data */
+} elf_image_t;
+
+/* A symbol table entry of an image. */
+typedef struct elf_symbol {
+    address_t   addr;     /* st_value */
+    const char *name;     /* inside the image, NUL-terminated */
+} elf_symbol_t;
+
+/* The symbols of an image sorted by address, then name, for binary
+   search. Names point into the image, which must outlive the index. */
+typedef struct symbol_index {
+    elf_symbol_t *syms;
+    int           count;
+} symbol_index_t;
+
+bool map_image (const char *path, elf_image_t *img);
+void image_from_buffer (const void *buf, size_t len, elf_image_t *img);
+void unmap_image (elf_image_t *img);
+
+bool image_header (elf_image_t *img);
+elf_phdr_t *image_phdr (elf_image_t *img, int i);
+bool image_load_segment (const elf_image_t *img, memory_t memory,
+                         const elf_phdr_t *phdr);
+const char *image_load (elf_image_t *img, memory_t memory);
+
+bool image_symbols (const elf_image_t *img, symbol_index_t *index);
+void free_symbols (symbol_index_t *index);
+const elf_symbol_t *symbol_at (const symbol_index_t *index, address_t addr,
+                               int *n);
+
+#endif
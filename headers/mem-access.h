@@ -2,6 +2,8 @@
 #define __MEM_ACC__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "elf.h"
 #include "y86.h"
@@ -11,9 +13,79 @@ bool parse_command_line_p2 (int argc, char **argv,
         bool *header, bool *segments, bool *membrief, bool *memfull,
         char **file);
 
-bool read_phdr (FILE *file, uint16_t offset, elf_phdr_t *phdr);
 void dump_phdrs (uint16_t numphdrs, elf_phdr_t phdr[]);
-bool load_segment (FILE *file, memory_t memory, elf_phdr_t phdr);
-void dump_memory (memory_t memory, uint16_t start, uint16_t end);
+void dump_memory (memory_t memory, address_t start, address_t end);
+
+bool     page_list_add (page_list_t *list, uint64_t page);
+
+memory_t mem_create (int vaddrbits);
+void     mem_clear (memory_t memory);
+void     mem_free (memory_t memory);
+uint8_t *mem_alloc_page (memory_t memory, address_t addr);
+void     mem_read (memory_t memory, address_t addr, void *buf, size_t len);
+void     mem_write (memory_t memory, address_t addr, const void *buf, size_t len);
+bool     mem_watch (memory_t memory, address_t addr, uint64_t len);
+void     mem_watch_clear (memory_t memory);
+void     mem_watch_check (memory_t memory, address_t addr, size_t len);
+void     mem_store_hooks (memory_t memory, address_t addr, size_t len);
+bool     mem_track_dirty (memory_t memory);
+void     mem_mark_dirty (memory_t memory, address_t addr, size_t len);
+void     mem_dirty_reset (memory_t memory);
+void     dump_dirty (memory_t memory);
+
+/* Pass a store of len bytes at addr to the watchpoints and the dirty
+   lines. With neither on, one test of store_hooks is all a store pays. */
+static inline void mem_note_store(memory_t memory, address_t addr, size_t len)
+{
+    if (__builtin_expect(memory->store_hooks, 0))
+    {
+        mem_store_hooks(memory, addr, len);
+    }
+}
+
+/* Size of the simulated address space in bytes. */
+static inline address_t mem_size(memory_t memory)
+{
+    return memory->size;
+}
+
+/* Page holding addr, or NULL if it was never written (or is out of range). */
+static inline uint8_t *mem_page(memory_t memory, address_t addr)
+{
+    return addr < memory->limit ? memory->pages[addr >> PAGEBITS] : NULL;
+}
+
+/* Byte at addr; untouched and out-of-range memory reads as zero. */
+static inline uint8_t mem_read8(memory_t memory, address_t addr)
+{
+    uint8_t *page = mem_page(memory, addr);
+    return page != NULL ? page[addr & PAGEMASK] : 0;
+}
+
+/* Little-endian quad at addr. */
+static inline uint64_t mem_read64(memory_t memory, address_t addr)
+{
+    uint64_t value = 0;
+    uint8_t *page = mem_page(memory, addr);
+    if (page != NULL && (addr & PAGEMASK) <= PAGESIZE - sizeof(value))
+    {
+        memcpy(&value, page + (addr & PAGEMASK), sizeof(value));
+        return value;
+    }
+    mem_read(memory, addr, &value, sizeof(value));
+    return value;
+}
+
+/* Store a little-endian quad at addr, allocating its page if needed. */
+static inline void mem_write64(memory_t memory, address_t addr, uint64_t value)
+{
+    uint8_t *page = mem_page(memory, addr);
+    if (page != NULL && (addr & PAGEMASK) <= PAGESIZE - sizeof(value))
+    {
+        memcpy(page + (addr & PAGEMASK), &value, sizeof(value));
+        return;
+    }
+    mem_write(memory, addr, &value, sizeof(value));
+}
 
 #endif
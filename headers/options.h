@@ -0,0 +1,45 @@
+#ifndef __OPTIONS__
+#define __OPTIONS__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* All command-line switches understood by the simulator. */
+typedef struct y86_options {
+    bool header;        /* -H  show the Mini-ELF header */
+    bool segments;      /* -s  show the program headers */
+    bool membrief;      /* -m  show the memory contents (brief) */
+    bool memfull;       /* -M  show the memory contents (full) */
+    bool memdiff;       /* -i  memory dumps show only the lines changed */
+    bool disas_code;    /* -d  disassemble code contents */
+    bool disas_data;    /* -D  disassemble data contents */
+    bool exec_normal;   /* -e  execute program */
+    bool exec_debug;    /* -E  execute program (debug trace mode) */
+    bool threaded;      /* -t  execute program with the threaded-code engine */
+    bool jit;           /* -J  execute program with the x86-64 JIT */
+    bool profile;       /* -p  execute program and print a profile */
+    bool pipeline;      /* -P  execute program and print PIPE cycle counts */
+    int predictor;      /* -B  branch predictor (pred_kind_t), -1 for none */
+    bool quiet;         /* -q  execute without the memory write trace */
+    int vaddrbits;      /* -A  size of the address space in bits */
+    char *trace_file;   /* -T  write the -E trace as binary records here */
+    char *snapshot_file;    /* -S  write a checkpoint here on SIGUSR1 */
+    uint64_t snapshot_at;   /* -C  and after this many instructions, 0 for never */
+    char *restore_file;     /* -R  start from this checkpoint */
+    char *gdb;          /* -g  serve gdb on this TCP port or socket path */
+    bool watch;         /* -w  report stores to watch_len bytes at watch_addr */
+    bool watch_stop;    /* -W  the same, stopping at the first */
+    uint64_t watch_addr;
+    uint64_t watch_len;
+    bool batch;         /* -b  execute every file named, one result line each */
+    int jobs;           /* -j  batch worker threads, 0 for one per cpu */
+    uint64_t step_limit;    /* -L  batch instructions per image, 0 for no limit */
+    char *file;         /* mini-elf-file to load */
+    char **files;       /* with -b, all files, directories and @manifests */
+    int nfiles;         /* entries in files */
+} y86_options_t;
+
+void usage_options ();
+bool parse_command_line (int argc, char **argv, y86_options_t *opts);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __PIPE__
+#define __PIPE__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "predict.h"
+#include "y86.h"
+
+/* Operand sources of the PIPE forwarding logic, in priority order. */
+typedef enum {
+    FWD_E_VALE = 0,   /* ALU result of the instruction in execute */
+    FWD_M_VALM,       /* value the instruction in memory loads */
+    FWD_M_VALE,       /* ALU result of the instruction in memory */
+    FWD_W_VALM,       /* loaded value in write-back */
+    FWD_W_VALE,       /* ALU result in write-back */
+    FWD_REGFILE,      /* no hazard, read from the register file */
+    FWD_SOURCES
+} pipe_fwd_t;
+
+/* A pipeline register: what an instruction, or a bubble, carries into
+   the stage after it. Only the fields the hazard logic looks at. */
+typedef struct pipe_reg {
+    uint8_t type;     /* y86_inst_class_t, NOP for a bubble */
+    uint8_t dstE;     /* register written from valE, BADREG for none */
+    uint8_t dstM;     /* register written from valM, BADREG for none */
+} pipe_reg_t;
+
+/* Timing of the five-stage PIPE processor (CS:APP 4.5) for the
+   instructions the -e loop executes. Each one is timed as it reaches
+   decode, with the E, M and W registers holding the instructions ahead
+   of it. Branches are predicted taken, ret stalls fetch until it
+   reaches write-back; everything else is forwarded except a load
+   followed by a use of the loaded register. With a predictor attached,
+   jumps and rets it gets right cost nothing and the others cost what
+   a wrong jump or a ret does in PIPE. */
+typedef struct pipe {
+    pipe_reg_t e, m, w;          /* inputs of execute, memory, write-back */
+    predictor_t *pred;           /* replaces PIPE's own prediction, or NULL */
+    uint64_t   cycles;           /* cycles until the last instruction left decode */
+    uint64_t   instructions;
+    uint64_t   load_use;         /* cycles stalled on load/use hazards */
+    uint64_t   branches;         /* conditional jumps */
+    uint64_t   mispredicts;      /* of those, not taken */
+    uint64_t   rets;
+    uint64_t   ret_misses;       /* of those, stalled for */
+    uint64_t   fwd[FWD_SOURCES]; /* operands read, by source */
+} pipe_t;
+
+#define PIPE_MISPREDICT_BUBBLES 2   /* jXX found wrong in execute */
+#define PIPE_RET_BUBBLES 3          /* fetch waits for ret's valM */
+#define PIPE_FILL_DRAIN 4           /* cycles before the first decode and
+                                       after the last one */
+
+void pipe_init (pipe_t *pipe, predictor_t *pred);
+void pipe_step (pipe_t *pipe, address_t pc, const y86_inst_t *ins,
+                bool cond, const y86_t *cpu);
+uint64_t pipe_cycles (const pipe_t *pipe);
+void pipe_report (const pipe_t *pipe);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __PREDICT__
+#define __PREDICT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "y86.h"
+
+#define PRED_TABLE_BITS 12      /* 2-bit counters in the bimodal and gshare tables */
+#define PRED_RAS_DEPTH 16       /* return address stack entries, a power of two */
+
+/* Direction predictors for conditional jumps. */
+typedef enum {
+    PRED_TAKEN = 0,             /* always taken, as PIPE does */
+    PRED_BTFN,                  /* backward taken, forward not taken */
+    PRED_BIMODAL,               /* 2-bit counter per jump address */
+    PRED_GSHARE,                /* 2-bit counters indexed by address ^ history */
+    PRED_KINDS
+} pred_kind_t;
+
+/* Outcomes of one conditional jump. */
+typedef struct pred_branch {
+    address_t pc;
+    uint64_t  count;            /* executions, 0 for an empty slot */
+    uint64_t  taken;
+    uint64_t  mispredicts;
+} pred_branch_t;
+
+/* A branch predictor with a return address stack for call and ret.
+   jmp and call always go where their instruction says, so only
+   conditional jumps and rets can be mispredicted. */
+typedef struct predictor {
+    pred_kind_t    kind;
+    uint8_t        counters[1 << PRED_TABLE_BITS];
+    uint32_t       history;     /* last outcomes, newest in bit 0 */
+    address_t      ras[PRED_RAS_DEPTH];
+    int            ras_top;     /* pushes minus pops, the stack wraps */
+    int            ras_count;   /* valid entries, at most PRED_RAS_DEPTH */
+
+    pred_branch_t *table;       /* per jump statistics, open addressing */
+    int            table_cap;   /* a power of two */
+    int            nbranches;
+
+    uint64_t       branches;
+    uint64_t       mispredicts;
+    uint64_t       rets;
+    uint64_t       ret_misses;
+} predictor_t;
+
+int  predictor_kind (const char *name);
+bool predictor_init (predictor_t *pred, pred_kind_t kind);
+bool predictor_step (predictor_t *pred, address_t pc, const y86_inst_t *ins,
+                     bool cond, const y86_t *cpu);
+void predictor_report (const predictor_t *pred);
+void predictor_free (predictor_t *pred);
+
+#endif
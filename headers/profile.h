@@ -0,0 +1,58 @@
+#ifndef __PROFILE__
+#define __PROFILE__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "elf.h"
+#include "loader.h"
+#include "y86.h"
+
+/* Counters for one page of memory. */
+typedef struct profile_page {
+    uint64_t count[PAGESIZE];   /* executions of the instruction at each address */
+    uint64_t taken[PAGESIZE];   /* of those, conditional jumps taken */
+} profile_page_t;
+
+/* A function, identified by the address calls go to. */
+typedef struct profile_func {
+    address_t   addr;        /* entry address */
+    uint64_t    calls;       /* times called */
+    uint64_t    inclusive;   /* instructions executed inside, callees included */
+    int         active;      /* activations on the call stack */
+} profile_func_t;
+
+/* An activation on the shadow call stack. */
+typedef struct profile_frame {
+    int      func;           /* index into funcs */
+    uint64_t start;          /* total when it was entered */
+} profile_frame_t;
+
+/* Execution profile of one run. */
+typedef struct profile {
+    uint64_t         npages;     /* entries in pages */
+    profile_page_t **pages;      /* per page counters, NULL if never executed */
+    uint64_t         classes[INVALID + 1];   /* executions by instruction class */
+    uint64_t         total;      /* instructions executed */
+
+    profile_func_t  *funcs;
+    int              nfuncs;
+    int              funcs_cap;
+    int             *slots;      /* funcs by entry hash, index + 1, 0 if free */
+    int              slots_cap;  /* a power of two */
+    profile_frame_t *stack;      /* shadow call stack, stack[0] is the entry */
+    int              depth;
+    int              stack_cap;
+
+    const symbol_index_t *syms;  /* names for the report, or NULL */
+} profile_t;
+
+bool profile_init (profile_t *prof, memory_t memory, address_t entry,
+                   const symbol_index_t *syms);
+void profile_step (profile_t *prof, address_t pc, const y86_inst_t *ins,
+                   bool cond, const y86_t *cpu);
+void profile_report (profile_t *prof, memory_t memory,
+                     elf_hdr_t *hdr, elf_phdr_t phdr[]);
+void profile_free (profile_t *prof);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __SNAPSHOT__
+#define __SNAPSHOT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "y86.h"
+
+/* Checkpoint file layout:
+   +-------------------------------------------------------+
+   | snapshot_hdr_t - CPU state and instruction count      |
+   +-------------------------------------------------------+
+   | npages uint64_t page numbers, ascending               |
+   +-------------------------------------------------------+
+   | zero padding up to the next multiple of PAGESIZE      |
+   +-------------------------------------------------------+
+   | npages pages of PAGESIZE bytes, in the same order     |
+   +-------------------------------------------------------+
+   Pages that were never written or hold only zeroes are left out. */
+#define SNAPSHOT_MAGIC   0x53363859   /* "Y86S" */
+#define SNAPSHOT_VERSION 1
+
+typedef struct __attribute__((__packed__)) snapshot_hdr {
+    uint32_t magic;                 /* SNAPSHOT_MAGIC */
+    uint32_t version;               /* SNAPSHOT_VERSION */
+    uint8_t  vaddrbits;             /* address space the pages belong to */
+    uint8_t  stat;                  /* y86_stat_t */
+    uint8_t  zf, sf, of;            /* settled flags */
+    uint64_t regs[NUMREGS];         /* %rax .. %r14 */
+    uint64_t pc;
+    uint64_t count;                 /* instructions executed so far */
+    uint64_t npages;                /* pages stored */
+} snapshot_hdr_t;
+
+bool snapshot_write (const char *path, y86_t *cpu, memory_t memory,
+                     uint64_t count);
+const char *snapshot_restore (const char *path, y86_t *cpu, memory_t memory,
+                              uint64_t *count);
+bool snapshot_on_signal (int signo);
+bool snapshot_pending ();
+
+#endif
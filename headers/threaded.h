@@ -0,0 +1,24 @@
+#ifndef __THREADED__
+#define __THREADED__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "elf.h"
+#include "y86.h"
+
+/* One translated instruction. Operands are resolved to pointers into the
+   CPU at translation time so a handler never decodes register numbers. */
+typedef struct threaded_slot {
+    void           *handler;  /* address of the handler for this opcode */
+    y86_register_t *ra;       /* source/destination register A */
+    y86_register_t *rb;       /* source/destination register B */
+    int64_t         imm;      /* immediate value, displacement or destination */
+    uint8_t         size;     /* size of the instruction in bytes */
+    uint8_t         opcode;   /* first byte of the instruction */
+} threaded_slot_t;
+
+uint64_t run_threaded (y86_t *cpu, memory_t memory,
+                       elf_hdr_t *hdr, elf_phdr_t phdr[]);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "loader.h"
+#include "y86.h"
+
+#define TRACE_BUFSIZE (1 << 20)   /* text bytes buffered before a write() */
+#define TRACE_MAXSTORES 4         /* stores a single instruction can make */
+
+/* Binary trace file layout:
+   +-------------------------------------------------------+
+   | trace_file_hdr_t - initial CPU state                  |
+   +-------------------------------------------------------+
+   | trace_rec_t, then nregs trace_reg_t,                  |
+   |              then nstores trace_store_t  (repeated)   |
+   +-------------------------------------------------------+
+   A record describes one executed instruction and only the state it
+   changed, so a renderer replaying the file reproduces the -E text. */
+#define TRACE_MAGIC   0x54363859   /* "Y86T" */
+#define TRACE_VERSION 1
+
+typedef struct __attribute__((__packed__)) trace_file_hdr {
+    uint32_t magic;                 /* TRACE_MAGIC */
+    uint32_t version;               /* TRACE_VERSION */
+    uint64_t regs[NUMREGS];         /* %rax .. %r14 */
+    uint64_t pc;                    /* entry point */
+    uint8_t  state;                 /* flags and status, see TRACE_STATE */
+} trace_file_hdr_t;
+
+typedef struct __attribute__((__packed__)) trace_rec {
+    uint8_t  type;                  /* y86_inst_class_t */
+    uint8_t  sub;                   /* y86_cmov_t, y86_op_t or y86_jump_t */
+    uint8_t  regs;                  /* ra << 4 | rb */
+    uint8_t  opcode;                /* first byte of the instruction */
+    uint8_t  state;                 /* flags and status after execution */
+    uint8_t  nregs;                 /* trace_reg_t entries that follow */
+    uint8_t  nstores;               /* trace_store_t entries that follow */
+    uint64_t operand;               /* immediate, displacement or destination */
+    uint64_t pc;                    /* PC after execution */
+} trace_rec_t;
+
+typedef struct __attribute__((__packed__)) trace_reg {
+    uint8_t  reg;                   /* register number */
+    uint64_t value;                 /* new value */
+} trace_reg_t;
+
+typedef struct __attribute__((__packed__)) trace_store {
+    uint64_t addr;                  /* address written */
+    uint64_t value;                 /* quad stored there */
+} trace_store_t;
+
+/* zf, sf, of, "corrupt instruction" and the status packed into a byte */
+#define TRACE_STATE(cpu, corrupt) \
+    ((cpu)->zf | (cpu)->sf << 1 | (cpu)->of << 2 | (corrupt) << 3 | (cpu)->stat << 4)
+
+/* Buffered writer for the -E debug trace. Text goes to fd through a
+   large buffer; when bin is set, binary records are written there
+   instead of text. Instructions at an address with a symbol in syms
+   are preceded by a label line. */
+typedef struct trace {
+    int            fd;              /* text destination */
+    char          *buf;             /* TRACE_BUFSIZE bytes of pending text */
+    size_t         len;             /* bytes used in buf */
+    FILE          *bin;             /* binary trace file, or NULL */
+    trace_store_t  stores[TRACE_MAXSTORES];
+    uint8_t        nstores;         /* stores seen for the current instruction */
+    const symbol_index_t *syms;     /* labels for the text, or NULL */
+} trace_t;
+
+bool trace_open (trace_t *t, int fd, FILE *bin);
+void trace_flush (trace_t *t);
+void trace_close (trace_t *t);
+
+void trace_str (trace_t *t, const char *s);
+void trace_hex (trace_t *t, uint64_t value, int width);
+void trace_inst (trace_t *t, const y86_inst_t *inst);
+void trace_cpu (trace_t *t, const y86_t *cpu);
+
+void trace_mem_write (address_t addr, y86_register_t value);
+void trace_begin (trace_t *t, const y86_t *cpu);
+void trace_step (trace_t *t, const y86_t *before, const y86_inst_t *inst,
+                 const y86_t *after, bool corrupt);
+void trace_emit_step (trace_t *t, address_t pc, const y86_inst_t *inst,
+                      bool corrupt, const trace_store_t *stores,
+                      int nstores, const y86_t *after);
+
+#endif
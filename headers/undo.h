@@ -0,0 +1,50 @@
+#ifndef __UNDO__
+#define __UNDO__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "y86.h"
+
+#define UNDO_KEYFRAME_INTERVAL (1 << 20)   /* instructions between keyframes */
+#define UNDO_BUDGET (256 << 20)            /* bytes of log and keyframes kept */
+
+/* Execution from one keyframe on: the machine as it was at the
+   keyframe, and an undo record for every instruction executed since.
+   The log of an old segment is dropped first when the budget runs out;
+   stepping back into it then restores the keyframe and executes
+   forward again to rebuild it. A segment marked edit holds the machine
+   as it was before a change made from outside, and has no log; stepping
+   back past it restores that change too. */
+typedef struct undo_segment {
+    uint64_t  start;       /* instructions executed at the keyframe */
+    y86_t     cpu;         /* settled cpu at the keyframe */
+    uint64_t *index;       /* page numbers of the pages kept */
+    uint8_t  *pages;       /* npages pages of PAGESIZE bytes */
+    uint64_t  npages;
+    uint8_t  *log;         /* undo records, oldest first */
+    size_t    len;         /* bytes used in log */
+    size_t    cap;
+    bool      dropped;     /* log was freed for the budget */
+    bool      edit;        /* keyframe taken before an outside change */
+} undo_segment_t;
+
+/* Record of a run that can be stepped backwards. */
+typedef struct undo_log {
+    undo_segment_t *segs;  /* oldest first, execution is in the last */
+    int             nsegs;
+    int             cap;
+    uint64_t        count; /* instructions executed */
+    size_t          bytes; /* logs and keyframes held */
+} undo_log_t;
+
+bool undo_init (undo_log_t *log, y86_t *cpu, memory_t memory, uint64_t count);
+bool undo_step (undo_log_t *log, y86_t *cpu, memory_t memory);
+bool undo_edit (undo_log_t *log, y86_t *cpu, memory_t memory);
+uint64_t undo_back (undo_log_t *log, y86_t *cpu, memory_t memory, uint64_t n);
+uint64_t undo_back_to (undo_log_t *log, y86_t *cpu, memory_t memory,
+                       const address_t *breaks, int nbreaks);
+void undo_free (undo_log_t *log);
+
+#endif
@@ -8,7 +8,6 @@
 void usage_val ();
 bool parse_command_line_p1 ( int argc, char **argv, bool *header, char **file );
 
-bool read_header ( FILE *file, elf_hdr_t *hdr );
 void dump_header ( elf_hdr_t hdr );
 
 #endif
@@ -4,48 +4,114 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define VADDRBITS 12
+#define VADDRBITS 12                /* default address space size */
 #define MEMSIZE (1 << VADDRBITS)
+#define MINVADDRBITS 12
+#define MAXVADDRBITS 32
+#define PAGEBITS 12                 /* memory is allocated in 4 KiB pages */
+#define PAGESIZE (1 << PAGEBITS)
+#define DIRTYLINEBITS 4             /* stores are tracked in 16-byte lines, as dumped */
+#define PAGEMASK (PAGESIZE - 1)
 #define NUMREGS 15
+#define MAX_INST_SIZE 10            /* longest instruction (irmovq, rmmovq, mrmovq) */
 
 /* type declarations */
-typedef uint8_t  *memory_t;        /* memory array */
+typedef struct memory *memory_t;   /* simulated memory, see below */
 typedef uint64_t  y86_register_t;  /* registers */
 typedef uint8_t   y86_rnum_t;      /* register number */
 typedef uint64_t  address_t;       /* addresses */
 typedef bool      flag_t;          /* CPU flag */
 
+/* Receives every store an executing program makes to memory */
+typedef void (*mem_trace_t)(address_t addr, y86_register_t value);
+
+/* Page numbers in the order they were added, so clearing a sparse table
+   only visits the pages it actually has. */
+typedef struct page_list {
+    uint64_t *pages;
+    uint64_t  count;
+    uint64_t  cap;
+} page_list_t;
+
+/* Simulated memory: an address space of 1 << vaddrbits bytes backed by a
+   page table of PAGESIZE pages. A page is only allocated when something
+   is written to it, untouched pages read as zero. The table reaches one
+   page past the end of the address space so an 8-byte access at the last
+   valid address does not need to be split. The allocated pages are also
+   listed in used, so clearing costs the pages touched, not the size of
+   the address space. */
+struct memory {
+    address_t    size;             /* bytes in the address space */
+    address_t    limit;            /* bytes covered by the page table */
+    uint64_t     npages;           /* entries in pages */
+    uint8_t    **pages;            /* page table, NULL for untouched pages */
+    page_list_t  used;             /* the pages that are not NULL */
+    uint8_t      vaddrbits;        /* log2 of size */
+    mem_trace_t  trace;            /* store trace sink, NULL for none */
+    struct decode_cache *decode;   /* decoded instructions, see decode-cache.h */
+    uint64_t   **watch;            /* per page bitmaps of watched bytes, NULL
+                                      while nothing is watched, see mem_watch() */
+    page_list_t  watched;          /* the pages with a watch bitmap */
+    uint64_t   **dirty;            /* per page bitmaps of lines written, NULL
+                                      while not tracked, see mem_track_dirty() */
+    bool         store_hooks;      /* watch or dirty set, see mem_note_store() */
+    bool         watch_hit;        /* a store touched a watched byte */
+    address_t    watch_addr;       /* the first one it touched */
+};
+
 /* possible CPU statuses */
 typedef enum { AOK = 1, HLT, ADR, INS } y86_stat_t;
 
+/* operation whose condition codes are still to be computed */
+typedef enum { CC_NONE = 0, CC_ADD, CC_SUB, CC_LOGIC } y86_cc_t;
+
 /* Y86 CPU data storage structure
-   There are 15 general-purpose registers, 3 flags, the PC, and the status */
+   There are 15 general-purpose registers, 3 flags, the PC, and the status.
+   The registers are an array indexed by register number; the named fields
+   alias the same storage. Slot 15 (BADREG) is not a real register, it
+   always holds zero so reads of the "no register" encoding need no check. */
 typedef struct y86 {
 
     /* 64-bit general-purpose registers */
-    y86_register_t rax;   /* register 0 */
-    y86_register_t rcx;   /* register 1 */
-    y86_register_t rdx;   /* register 2 */
-    y86_register_t rbx;   /* register 3 */
-    y86_register_t rsp;   /* register 4 - stack pointer */
-    y86_register_t rbp;   /* register 5 - base pointer */
-    y86_register_t rsi;   /* register 6 */
-    y86_register_t rdi;   /* register 7 */
-    y86_register_t r8;    /* register 8 */
-    y86_register_t r9;    /* register 9 */
-    y86_register_t r10;   /* register 10 */
-    y86_register_t r11;   /* register 11 */
-    y86_register_t r12;   /* register 12 */
-    y86_register_t r13;   /* register 13 */
-    y86_register_t r14;   /* register 14 */
+    union {
+        y86_register_t regs[NUMREGS + 1];
+        struct {
+            y86_register_t rax;   /* register 0 */
+            y86_register_t rcx;   /* register 1 */
+            y86_register_t rdx;   /* register 2 */
+            y86_register_t rbx;   /* register 3 */
+            y86_register_t rsp;   /* register 4 - stack pointer */
+            y86_register_t rbp;   /* register 5 - base pointer */
+            y86_register_t rsi;   /* register 6 */
+            y86_register_t rdi;   /* register 7 */
+            y86_register_t r8;    /* register 8 */
+            y86_register_t r9;    /* register 9 */
+            y86_register_t r10;   /* register 10 */
+            y86_register_t r11;   /* register 11 */
+            y86_register_t r12;   /* register 12 */
+            y86_register_t r13;   /* register 13 */
+            y86_register_t r14;   /* register 14 */
+            y86_register_t none;  /* BADREG sink - always zero */
+        };
+    };
 
     flag_t zf;            /* zero flag */
     flag_t sf;            /* negative flag */
     flag_t of;            /* overflow flag */
 
+    /* Lazy condition codes: an OPq only records its operands and result
+       here. Until settle_flags() runs, zf, sf and of are stale whenever
+       cc_op is not CC_NONE. */
+    uint8_t cc_op;        /* y86_cc_t of the last OPq, or CC_NONE */
+    y86_register_t cc_a;  /* valA of that OPq */
+    y86_register_t cc_b;  /* valB of that OPq */
+    y86_register_t cc_e;  /* its result */
+
     y86_register_t pc;    /* program counter */
 
     y86_stat_t stat;      /* program status */
+
+    address_t memsize;    /* size of the address space the CPU runs in */
 } y86_t;
 
 /* Y86 instruction encoding:
@@ -0,0 +1,61 @@
+#ifndef __Y86SIM__
+#define __Y86SIM__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "y86.h"
+
+/*
+ * Embeddable simulator: everything the -e mode of the command line does,
+ * without printing. Results are queried instead of parsed from text.
+ *
+ *     y86sim_t *sim = y86sim_create(VADDRBITS);
+ *     if (y86sim_load(sim, image, len))
+ *     {
+ *         y86sim_run(sim);
+ *         ... y86sim_stat(sim), y86sim_reg(sim, 0) ...
+ *     }
+ *     y86sim_destroy(sim);
+ *
+ * One y86sim_t must not be used by two threads at once; separate ones
+ * are independent.
+ *
+ * While recording (y86sim_record()), every instruction executed can be
+ * undone again with y86sim_reverse_step() and y86sim_reverse_continue().
+ * Stepping back past a change made through y86sim_set_reg() or
+ * y86sim_write() undoes the change too; if there is no memory to save
+ * the state before it, recording stops. Loading an image stops
+ * recording.
+ */
+typedef struct y86sim y86sim_t;
+
+y86sim_t *y86sim_create (int vaddrbits);
+void y86sim_destroy (y86sim_t *sim);
+
+bool y86sim_load (y86sim_t *sim, const void *image, size_t len);
+bool y86sim_load_file (y86sim_t *sim, const char *path);
+const char *y86sim_error (const y86sim_t *sim);
+
+uint64_t y86sim_step (y86sim_t *sim, uint64_t n);
+uint64_t y86sim_run (y86sim_t *sim);
+uint64_t y86sim_count (const y86sim_t *sim);
+
+bool y86sim_record (y86sim_t *sim, bool on);
+uint64_t y86sim_reverse_step (y86sim_t *sim, uint64_t n);
+uint64_t y86sim_reverse_continue (y86sim_t *sim, const address_t *breaks,
+                                  int nbreaks);
+
+y86_stat_t y86sim_stat (const y86sim_t *sim);
+address_t y86sim_pc (const y86sim_t *sim);
+y86_register_t y86sim_reg (const y86sim_t *sim, int reg);
+void y86sim_set_reg (y86sim_t *sim, int reg, y86_register_t value);
+void y86sim_flags (const y86sim_t *sim, bool *zf, bool *sf, bool *of);
+const y86_t *y86sim_cpu (const y86sim_t *sim);
+
+address_t y86sim_mem_size (const y86sim_t *sim);
+bool y86sim_read (const y86sim_t *sim, address_t addr, void *buf, size_t len);
+bool y86sim_write (y86sim_t *sim, address_t addr, const void *buf, size_t len);
+
+#endif
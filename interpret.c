@@ -1,174 +1,27 @@
-#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "./headers/interpret.h"
+#include "./headers/decode-cache.h"
 
 y86_register_t opHandler(y86_register_t valB, y86_register_t *valA, y86_inst_t inst, y86_t *cpu);
 y86_register_t checkForRegister(y86_rnum_t reg, y86_t *cpu);
 bool jumpChecker(y86_jump_t jmp, y86_t *cpu);
 bool checkCondition(y86_cmov_t mov, y86_t *cpu);
 void writeBack(y86_rnum_t reg, y86_t *cpu, y86_register_t valE);
-//=======================================================================
-/*
- * usage_p4() - print usage information for this program
- */
-void usage_interp()
-{
-    printf("Usage: y86 <option(s)> mini-elf-file\n");
-    printf(" Options are:\n");
-    printf("  -h      Display usage\n");
-    printf("  -H      Show the Mini-ELF header\n");
-    printf("  -a      Show all with brief memory\n");
-    printf("  -f      Show all with full memory\n");
-    printf("  -s      Show the program headers\n");
-    printf("  -m      Show the memory contents (brief)\n");
-    printf("  -M      Show the memory contents (full)\n");
-    printf("  -d      Disassemble code contents\n");
-    printf("  -D      Disassemble data contents\n");
-    printf("  -e      Execute program\n");
-    printf("  -E      Execute program (debug trace mode)\n");
-    printf("Options must not be repeated neither explicitly nor implicitly.\n");
-}
-
-//=======================================================================
-/*
- * parse_command_line_p4() - parse command line arguments
- *
- * This function parses the command line arguments and sets the
- * appropriate flags in the arguments.  It returns true if the
- * arguments are valid, false otherwise.
- *
- * argc: number of command line arguments
- * argv: array of command line arguments
- * header: pointer to header flag
- * segments: pointer to segments flag
- * membrief: pointer to membrief flag
- * memfull: pointer to memfull flag
- * disas_code: pointer to disas_code flag
- * disas_data: pointer to disas_data flag
- * exec_normal: pointer to exec_normal flag
- * exec_debug: pointer to exec_debug flag
- * file: pointer to file name
- *
- * Returns true if the arguments are valid, false otherwise.
- */
-bool parse_command_line_p4(int argc, char **argv,
-                           bool *header, bool *segments, bool *membrief,
-                           bool *memfull, bool *disas_code, bool *disas_data,
-                           bool *exec_normal, bool *exec_debug, char **file)
-{
-    // check for passed in null values
-    if (argc <= 1 || argv == NULL || header == NULL ||
-        membrief == NULL || segments == NULL || memfull == NULL || disas_code == NULL || disas_data == NULL || exec_debug == NULL || exec_normal == NULL)
-    {
-        usage_p4();
-        return false;
-    }
-
-    *header = false;
-    *segments = false;
-    *membrief = false;
-    *memfull = false;
-    *disas_code = false;
-    *disas_data = false;
-    *exec_normal = false;
-    *exec_debug = false;
-    char *optionStr = "+hHafsmMDdeE";
-    int opt;
-    opterr = 0;
-    bool printHelp = false;
-
-    // loop through commmand line arguements
-    while ((opt = getopt(argc, argv, optionStr)) != -1)
-    {
-        switch (opt)
-        {
-        case 'h':
-            printHelp = true;
-            break;
-        case 'H':
-            *header = true;
-            break;
-        case 'm':
-            *membrief = true;
-            break;
-        case 'M':
-            *memfull = true;
-            break;
-        case 's':
-            *segments = true;
-            break;
-        case 'a':
-            *header = true;
-            *membrief = true;
-            *segments = true;
-            break;
-        case 'f':
-            *header = true;
-            *memfull = true;
-            *segments = true;
-            break;
-        case 'd':
-            *disas_code = true;
-            break;
-        case 'D':
-            *disas_data = true;
-            break;
-        case 'E':
-            *exec_debug = true;
-            break;
-        case 'e':
-            *exec_normal = true;
-            break;
-        default:
-            usage_p4();
-            return false;
-        }
-    }
-    if (*exec_normal && *exec_debug)
-    {
-        *exec_normal = false;
-    }
-    // checks if the help command was found and returns true
-    if (printHelp)
-    {
-        *header = false;
-        usage_p4();
-        return true;
-    }
-    else if (*membrief && *memfull)
-    {
-        // checks if both the memory full and memory brief
-        // commands were found and returns false as this is invalid
-        usage_p4();
-        return false;
-    }
-    else
-    {
-        // sets the last command arg to the file char array
-        *file = argv[optind];
-        if (*file == NULL || argc > optind + 1)
-        {
-            // prints usage and returns false if no file name was given
-            usage_p4();
-            return false;
-        }
-
-        return true;
-    }
-}
-
 //=======================================================================
 /*
  * This function dumps the registers of the Y86 CPU.
  */
 void dump_cpu(const y86_t *cpu)
 {
+    flag_t zf, sf, of;
+    read_flags(cpu, &zf, &sf, &of);
+
     // print the cpu specifications
     printf("dump of Y86 CPU:\n");
-    printf("  %%rip: %016lx   flags: SF%d ZF%d OF%d  ", cpu->pc, cpu->sf, cpu->zf, cpu->of);
+    printf("  %%rip: %016lx   flags: SF%d ZF%d OF%d  ", cpu->pc, sf, zf, of);
 
     // switch for cpu status
     switch (cpu->stat)
@@ -196,6 +49,24 @@ void dump_cpu(const y86_t *cpu)
     printf("  %%r14: %016lx\n\n", cpu->r14);
 }
 
+//=======================================================================
+/*
+ * Default memory trace sink: one line per store.
+ */
+void print_mem_write(address_t addr, y86_register_t value)
+{
+    printf("Memory write to 0x%04lx: 0x%lx\n", addr, value);
+}
+
+//=======================================================================
+/*
+ * Route the memory write trace of memory to sink. NULL silences it.
+ */
+void set_mem_trace(memory_t memory, mem_trace_t sink)
+{
+    memory->trace = sink;
+}
+
 //=======================================================================
 /*
  * This function decodes and executes the instruction at the current PC.
@@ -211,7 +82,7 @@ y86_register_t decode_execute(y86_t *cpu, bool *cond, const y86_inst_t *inst,
     }
 
     // check for pc exceeding memsize
-    if (cpu->pc > MEMSIZE || cpu->pc < 0)
+    if (cpu->pc > cpu->memsize)
     {
 
         cpu->stat = ADR;
@@ -306,10 +177,9 @@ y86_register_t decode_execute(y86_t *cpu, bool *cond, const y86_inst_t *inst,
                       y86_register_t valA)
 {
     y86_register_t valM;
-    uint64_t *p;
 
     // check for pc exceeding memsize
-    if (cpu->pc > MEMSIZE || memory == NULL)
+    if (memory == NULL || cpu->pc > mem_size(memory))
     {
         cpu->stat = ADR;
         cpu->pc = 0xffffffffffffffff;
@@ -324,6 +194,7 @@ y86_register_t decode_execute(y86_t *cpu, bool *cond, const y86_inst_t *inst,
         cpu->zf = false;
         cpu->sf = false;
         cpu->of = false;
+        cpu->cc_op = CC_NONE;
         break;
 
     case (NOP):
@@ -344,28 +215,28 @@ y86_register_t decode_execute(y86_t *cpu, bool *cond, const y86_inst_t *inst,
         break;
 
     case (RMMOVQ):
-        if (valE > MEMSIZE)
+        if (valE > mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc = 0xffffffffffffffff;
             break;
         }
-        p = (uint64_t *)&memory[valE];
-        *p = valA;
+        mem_write64(memory, valE, valA);
+        decode_cache_invalidate(memory, valE, sizeof(valA));
         cpu->pc += inst->size;
-        printf("Memory write to 0x%04lx: 0x%lx\n", valE, valA);
+        TRACE_STORE(memory, valE, valA);
+        mem_note_store(memory, valE, sizeof(valA));
         break;
 
     case (MRMOVQ):
         // Check if starting and ending addresses are within the valid range
-        if (valE < 0 || valE >= MEMSIZE)
+        if (valE >= mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc += inst->size;
             break;
         }
-        p = (uint64_t *)&memory[valE];
-        valM = *p;
+        valM = mem_read64(memory, valE);
         writeBack(inst->ra, cpu, valM);
         cpu->pc += inst->size;
         break;
@@ -385,55 +256,56 @@ y86_register_t decode_execute(y86_t *cpu, bool *cond, const y86_inst_t *inst,
         break;
 
     case (CALL):
-        if (valE >= MEMSIZE)
+        if (valE >= mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc = inst->dest;
             break;
         }
-        p = (uint64_t *)&memory[valE];
-        *p = cpu->pc += inst->size;
+        valA = cpu->pc += inst->size;
+        mem_write64(memory, valE, valA);
+        decode_cache_invalidate(memory, valE, sizeof(valA));
         cpu->rsp = valE;
         cpu->pc = inst->dest;
-        printf("Memory write to 0x%04lx: 0x%lx\n", valE, *p);
+        TRACE_STORE(memory, valE, valA);
+        mem_note_store(memory, valE, sizeof(valA));
         break;
 
     case (RET):
-        if (valA >= MEMSIZE)
+        if (valA >= mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc = 0xffffffffffffffff;
             break;
         }
-        p = (uint64_t *)&memory[valA];
-        valM = *p;
+        valM = mem_read64(memory, valA);
         cpu->rsp = valE;
         cpu->pc = valM;
         break;
 
     case (PUSHQ):
-        if (valE >= MEMSIZE)
+        if (valE >= mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc = 0xffffffffffffffff;
             break;
         }
-        p = (uint64_t *)&memory[valE];
-        *p = valA;
+        mem_write64(memory, valE, valA);
+        decode_cache_invalidate(memory, valE, sizeof(valA));
         cpu->rsp = valE;
         cpu->pc += inst->size;
-        printf("Memory write to 0x%04lx: 0x%lx\n", valE, valA);
+        TRACE_STORE(memory, valE, valA);
+        mem_note_store(memory, valE, sizeof(valA));
         break;
 
     case (POPQ):
-        if (valA >= MEMSIZE)
+        if (valA >= mem_size(memory))
         {
             cpu->stat = ADR;
             cpu->pc = 0xffffffffffffffff;
             break;
         }
-        p = (uint64_t *)&memory[valA];
-        valM = *p;
+        valM = mem_read64(memory, valA);
         cpu->rsp = valE;
         writeBack(inst->ra, cpu, valM);
         cpu->pc += inst->size;
@@ -453,42 +325,35 @@ bool booleanXOR(bool first, bool second)
 
 //=======================================================================
 /*
- * This function handles the ALU operations for the CPU.
+ * This function handles the ALU operations for the CPU. The flags are
+ * only recorded, read_flags() computes them when they are needed.
  */
 y86_register_t opHandler(y86_register_t valB, y86_register_t *valA, y86_inst_t inst, y86_t *cpu)
 {
-    int64_t signedValE = 0;
     y86_register_t valE = 0;
-    int64_t signedValB = valB;
-    int64_t signedValA = *valA;
+    y86_cc_t cc;
 
-    // Check flags for opq instruction
     switch (inst.op)
     {
     case ADD:
-        signedValE = signedValB + signedValA;
-        // Set overflow of addition
-        cpu->of = ((signedValB < 0) && (signedValA < 0) && (signedValE > 0)) ||
-                  ((signedValB > 0) && (signedValA > 0) && (signedValE < 0));
-        valE = signedValE;
+        // wrap in unsigned arithmetic, signed overflow is undefined in C
+        valE = valB + *valA;
+        cc = CC_ADD;
         break;
 
     case SUB:
-        signedValE = signedValB - signedValA;
-        // Set overflow of subtraction
-        cpu->of = ((signedValB < 0) && (signedValA > 0) && (signedValE > 0)) ||
-                  ((signedValB > 0) && (signedValA < 0) && (signedValE < 0));
-        valE = signedValE;
+        valE = valB - *valA;
+        cc = CC_SUB;
         break;
 
     case AND:
         valE = valB & *valA;
-        cpu->of = 0;
+        cc = CC_LOGIC;
         break;
 
     case XOR:
         valE = *valA ^ valB;
-        cpu->of = 0;
+        cc = CC_LOGIC;
         break;
 
     case BADOP:
@@ -500,60 +365,76 @@ y86_register_t opHandler(y86_register_t valB, y86_register_t *valA, y86_inst_t i
         return valE;
     }
 
-    // Set sign or zero flag for all cases
-    cpu->sf = (valE >> 63) == 1;
-    cpu->zf = valE == 0;
+    cpu->cc_op = cc;
+    cpu->cc_a = *valA;
+    cpu->cc_b = valB;
+    cpu->cc_e = valE;
 
     return valE;
 }
 
 //=======================================================================
 /*
- * This function checks if the register is valid and returns the value of the register.
+ * This function returns the flags of the CPU, computing them from the
+ * last OPq if they are still pending.
  */
-y86_register_t checkForRegister(y86_rnum_t reg, y86_t *cpu)
+void read_flags(const y86_t *cpu, flag_t *zf, flag_t *sf, flag_t *of)
 {
-    // helper mehtod switch statment to retrieve register
-    switch (reg)
+    if (cpu->cc_op == CC_NONE)
     {
-    case (0):
-        return cpu->rax;
-    case (1):
-        return cpu->rcx;
-    case (2):
-        return cpu->rdx;
-    case (3):
-        return cpu->rbx;
-    case (4):
-        return cpu->rsp;
-    case (5):
-        return cpu->rbp;
-    case (6):
-        return cpu->rsi;
-    case (7):
-        return cpu->rdi;
-    case (8):
-        return cpu->r8;
-    case (9):
-        return cpu->r9;
-    case (10):
-        return cpu->r10;
-    case (11):
-        return cpu->r11;
-    case (12):
-        return cpu->r12;
-    case (13):
-        return cpu->r13;
-    case (14):
-        return cpu->r14;
-    case (BADREG):
-        return 0;
+        *zf = cpu->zf;
+        *sf = cpu->sf;
+        *of = cpu->of;
+        return;
+    }
+
+    int64_t signedValA = cpu->cc_a;
+    int64_t signedValB = cpu->cc_b;
+    int64_t signedValE = cpu->cc_e;
+    switch (cpu->cc_op)
+    {
+    case CC_ADD:
+        // Set overflow of addition
+        *of = ((signedValB < 0) && (signedValA < 0) && (signedValE > 0)) ||
+              ((signedValB > 0) && (signedValA > 0) && (signedValE < 0));
+        break;
+    case CC_SUB:
+        // Set overflow of subtraction
+        *of = ((signedValB < 0) && (signedValA > 0) && (signedValE > 0)) ||
+              ((signedValB > 0) && (signedValA < 0) && (signedValE < 0));
+        break;
     default:
-        cpu->stat = INS;
-        return 0;
+        *of = false;
+        break;
+    }
+
+    // Set sign or zero flag for all cases
+    *sf = (cpu->cc_e >> 63) == 1;
+    *zf = cpu->cc_e == 0;
+}
+
+//=======================================================================
+/*
+ * This function computes pending flags into zf, sf and of.
+ */
+void settle_flags(y86_t *cpu)
+{
+    if (cpu->cc_op != CC_NONE)
+    {
+        read_flags(cpu, &cpu->zf, &cpu->sf, &cpu->of);
+        cpu->cc_op = CC_NONE;
     }
 }
 
+//=======================================================================
+/*
+ * This function returns the value of the register. BADREG reads as zero.
+ */
+y86_register_t checkForRegister(y86_rnum_t reg, y86_t *cpu)
+{
+    return cpu->regs[reg & 0xF];
+}
+
 //=======================================================================
 /*
  * This function checks if a condition is met for a cmov instruction.
@@ -562,6 +443,10 @@ bool checkCondition(y86_cmov_t mov, y86_t *cpu)
 {
     // switch statement helper method to check cmov condition
     bool cond = false;
+    if (mov != RRMOVQ)
+    {
+        settle_flags(cpu);
+    }
     switch (mov)
     {
     case (RRMOVQ):
@@ -618,6 +503,10 @@ bool jumpChecker(y86_jump_t jmp, y86_t *cpu)
 {
     // switch statement helper method to check jump condition
     bool cond = false;
+    if (jmp != JMP)
+    {
+        settle_flags(cpu);
+    }
     switch (jmp)
     {
     case (JMP):
@@ -668,61 +557,67 @@ bool jumpChecker(y86_jump_t jmp, y86_t *cpu)
 
 //=======================================================================
 /*
- * This function writes back the value to the register.
+ * This function writes back the value to the register. Writing BADREG
+ * lands in the sink slot, which is cleared again, and flags the CPU.
  */
 void writeBack(y86_rnum_t reg, y86_t *cpu, y86_register_t value)
 {
-    // helper method to write back value to register
-    switch (reg)
+    cpu->regs[reg & 0xF] = value;
+    cpu->regs[BADREG] = 0;
+    cpu->stat = reg == BADREG ? INS : cpu->stat;
+}
+
+//=======================================================================
+/*
+ * Execute the instruction at cpu->pc the way the -e loop in main.c does,
+ * without printing anything.
+ */
+void execute_step(y86_t *cpu, memory_t memory)
+{
+    y86_register_t valA = 0;
+    bool cond = false;
+    y86_inst_t ins = fetch_cached(cpu, memory);
+    y86_register_t valE = decode_execute(cpu, &cond, &ins, &valA);
+    memory_wb_pc(cpu, memory, cond, &ins, valE, valA);
+
+    // check to that pc didnt exceed memsize
+    if (cpu->pc >= mem_size(memory))
     {
-    case (0):
-        cpu->rax = value;
-        break;
-    case (1):
-        cpu->rcx = value;
-        break;
-    case (2):
-        cpu->rdx = value;
-        break;
-    case (3):
-        cpu->rbx = value;
-        break;
-    case (4):
-        cpu->rsp = value;
-        break;
-    case (5):
-        cpu->rbp = value;
-        break;
-    case (6):
-        cpu->rsi = value;
-        break;
-    case (7):
-        cpu->rdi = value;
-        break;
-    case (8):
-        cpu->r8 = value;
-        break;
-    case (9):
-        cpu->r9 = value;
-        break;
-    case (10):
-        cpu->r10 = value;
-        break;
-    case (11):
-        cpu->r11 = value;
-        break;
-    case (12):
-        cpu->r12 = value;
-        break;
-    case (13):
-        cpu->r13 = value;
-        break;
-    case (14):
-        cpu->r14 = value;
-        break;
-    case (BADREG):
-        cpu->stat = INS;
-    default:
-        break;
+        cpu->stat = ADR;
+        cpu->pc = 0xffffffffffffffff;
     }
-}
\ No newline at end of file
+}
+
+//=======================================================================
+/*
+ * Execute a single instruction with the portable switch engine, as the
+ * -e loop in main.c does, for the threaded and JIT engines.
+ */
+void step_portable(y86_t *cpu, memory_t memory, y86_inst_t *ins,
+                   y86_register_t *valE)
+{
+    y86_register_t valA = 0;
+    bool cond = false;
+    y86_inst_t inst = fetch_cached(cpu, memory);
+    y86_register_t result = decode_execute(cpu, &cond, &inst, &valA);
+    if (cpu->stat == INS)
+    {
+        printf("Corrupt Instruction (opcode 0x%02x) at address 0x%04lx\n", inst.opcode, cpu->pc);
+    }
+    memory_wb_pc(cpu, memory, cond, &inst, result, valA);
+    if (cpu->pc >= mem_size(memory))
+    {
+        cpu->stat = ADR;
+        cpu->pc = 0xffffffffffffffff;
+    }
+    // the engines use the flags directly
+    settle_flags(cpu);
+    if (ins != NULL)
+    {
+        *ins = inst;
+    }
+    if (valE != NULL)
+    {
+        *valE = result;
+    }
+}
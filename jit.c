@@ -0,0 +1,1090 @@
+/*
+ * Basic-block JIT to x86-64.
+ *
+ * Starting at the entry point, every basic block is decoded with fetch()
+ * and translated to native code the first time it runs. Blocks end at
+ * jumps, calls, returns and anything the JIT leaves to the interpreter
+ * (halt, invalid opcodes, writes to the 0xF register). An exit to a known
+ * address is patched into a direct jump to the target block once that
+ * block exists, so hot loops never leave native code. A ret looks its
+ * target up inline.
+ *
+ * Host register map inside translated code:
+ *
+ *   rbx  y86_t *cpu, registers and flags are memory operands off it
+ *   rbp  instructions executed, written back to jit->count on exit
+ *   r12  jit_t *jit
+ *   r13  size of the address space
+ *   r14  jit->codeline
+ *   r15  memory->pages
+ *
+ * Any fault (an address outside memory) leaves native code before the
+ * instruction changes anything and the interpreter runs it, so errors,
+ * messages and the final state are exactly those of -e. Stores that
+ * land in a 64-byte line holding translated code drop every translation
+ * (self-modifying code).
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/jit.h"
+#include "./headers/interpret.h"
+#include "./headers/decode-cache.h"
+#include "./headers/disassemble.h"
+#include "./headers/mem-access.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <sys/mman.h>
+
+// Size of the code buffer; when it fills up every block is dropped.
+#define JIT_CODE_SIZE (16 << 20)
+// Longest block in instructions, and room kept free for one block.
+#define MAX_BLOCK_INSTS 32
+#define BLOCK_RESERVE (16 << 10)
+// Translated code is tracked per line of this many bytes.
+#define LINEBITS 6
+
+// Reasons for leaving native code.
+#define EXIT_SLOW   1   /* run the instruction at cpu->pc in the interpreter */
+#define EXIT_CHAIN  2   /* continue at cpu->pc, link jit->patch to its block */
+#define EXIT_LOOKUP 3   /* continue at cpu->pc */
+#define EXIT_FLUSH  4   /* code was overwritten, drop all translations */
+
+// Host registers.
+enum {
+    X_RAX, X_RCX, X_RDX, X_RBX, X_RSP, X_RBP, X_RSI, X_RDI,
+    X_R8, X_R9, X_R10, X_R11, X_R12, X_R13, X_R14, X_R15
+};
+
+// Host condition codes.
+#define CC_O  0x0
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+
+#define REG_OFF(r) ((int32_t)(offsetof(y86_t, regs) + 8 * (r)))
+#define ZF_OFF ((int32_t)offsetof(y86_t, zf))
+#define SF_OFF ((int32_t)offsetof(y86_t, sf))
+#define OF_OFF ((int32_t)offsetof(y86_t, of))
+#define PC_OFF ((int32_t)offsetof(y86_t, pc))
+#define JIT_OFF(field) ((int32_t)offsetof(jit_t, field))
+
+/* An out-of-line exit of the block being compiled. */
+typedef struct jit_exit {
+    uint8_t   *from;      /* rel32 jumping to the exit */
+    int        kind;      /* EXIT_CHAIN, EXIT_SLOW or EXIT_FLUSH */
+    address_t  pc;        /* where execution continues */
+    int        count;     /* instructions done when taking it */
+} jit_exit_t;
+
+/* The block being compiled. */
+typedef struct jit_block {
+    jit_exit_t exits[4 * MAX_BLOCK_INSTS];
+    int        nexits;
+    bool       host_zf;   /* host ZF holds the Y86 zero flag */
+} jit_block_t;
+
+//=======================================================================
+// x86-64 encoder
+
+static void emit8(jit_t *jit, uint8_t b)
+{
+    *jit->cur++ = b;
+}
+
+static void emit32(jit_t *jit, uint32_t v)
+{
+    memcpy(jit->cur, &v, sizeof(v));
+    jit->cur += sizeof(v);
+}
+
+static void emit64(jit_t *jit, uint64_t v)
+{
+    memcpy(jit->cur, &v, sizeof(v));
+    jit->cur += sizeof(v);
+}
+
+/* REX prefix, left out when it carries nothing. */
+static void emit_rex(jit_t *jit, int w, int reg, int index, int base)
+{
+    uint8_t rex = 0x40 | w << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | (base >> 3);
+    if (rex != 0x40)
+    {
+        emit8(jit, rex);
+    }
+}
+
+/* ModRM (and SIB) for [base + disp]. */
+static void emit_mem(jit_t *jit, int reg, int base, int32_t disp)
+{
+    int mod = (disp == 0 && (base & 7) != X_RBP) ? 0 : (disp >= -128 && disp <= 127) ? 1 : 2;
+    emit8(jit, mod << 6 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == X_RSP)
+    {
+        emit8(jit, 0x24);
+    }
+    if (mod == 1)
+    {
+        emit8(jit, (uint8_t)disp);
+    }
+    else if (mod == 2)
+    {
+        emit32(jit, disp);
+    }
+}
+
+/* 64-bit op between reg and [base + disp]. */
+static void emit_op_mem(jit_t *jit, uint8_t op, int reg, int base, int32_t disp)
+{
+    emit_rex(jit, 1, reg, 0, base);
+    emit8(jit, op);
+    emit_mem(jit, reg, base, disp);
+}
+
+/* 8-bit op between a low byte register and [base + disp]. */
+static void emit_op_mem8(jit_t *jit, uint8_t op, int reg, int base, int32_t disp)
+{
+    emit_rex(jit, 0, reg, 0, base);
+    emit8(jit, op);
+    emit_mem(jit, reg, base, disp);
+}
+
+/* op between reg and [base + index << scale]; base is not rbp/r13. */
+static void emit_op_index(jit_t *jit, int w, uint8_t op, int reg, int base,
+                          int index, int scale)
+{
+    emit_rex(jit, w, reg, index, base);
+    emit8(jit, op);
+    emit8(jit, 0x04 | (reg & 7) << 3);
+    emit8(jit, scale << 6 | (index & 7) << 3 | (base & 7));
+}
+
+/* 64-bit "op dst, src" in the r/m, reg form (add 0x01, mov 0x89, ...). */
+static void emit_op_reg(jit_t *jit, uint8_t op, int src, int dst)
+{
+    emit_rex(jit, 1, src, 0, dst);
+    emit8(jit, op);
+    emit8(jit, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+/* 64-bit group 1 op with an immediate: add /0, and /4, sub /5, cmp /7. */
+static void emit_op_imm(jit_t *jit, int ext, int reg, int32_t imm)
+{
+    emit_rex(jit, 1, 0, 0, reg);
+    if (imm >= -128 && imm <= 127)
+    {
+        emit8(jit, 0x83);
+        emit8(jit, 0xC0 | ext << 3 | (reg & 7));
+        emit8(jit, (uint8_t)imm);
+    }
+    else
+    {
+        emit8(jit, 0x81);
+        emit8(jit, 0xC0 | ext << 3 | (reg & 7));
+        emit32(jit, imm);
+    }
+}
+
+/* reg = imm */
+static void emit_mov_imm(jit_t *jit, int reg, uint64_t imm)
+{
+    if (imm <= UINT32_MAX)
+    {
+        emit_rex(jit, 0, 0, 0, reg);
+        emit8(jit, 0xB8 + (reg & 7));
+        emit32(jit, (uint32_t)imm);
+    }
+    else
+    {
+        emit_rex(jit, 1, 0, 0, reg);
+        emit8(jit, 0xB8 + (reg & 7));
+        emit64(jit, imm);
+    }
+}
+
+/* shr reg, n */
+static void emit_shr(jit_t *jit, int reg, int n)
+{
+    emit_rex(jit, 1, 0, 0, reg);
+    emit8(jit, 0xC1);
+    emit8(jit, 0xE8 | (reg & 7));
+    emit8(jit, n);
+}
+
+/* setcc on a low byte register */
+static void emit_setcc(jit_t *jit, int cc, int reg)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0x90 | cc);
+    emit8(jit, 0xC0 | (reg & 7));
+}
+
+/* setcc on the byte at [rbx + disp] */
+static void emit_setcc_mem(jit_t *jit, int cc, int32_t disp)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0x90 | cc);
+    emit_mem(jit, 0, X_RBX, disp);
+}
+
+/* jcc rel32, returns the rel32 to patch */
+static uint8_t *emit_jcc(jit_t *jit, int cc)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0x80 | cc);
+    uint8_t *at = jit->cur;
+    emit32(jit, 0);
+    return at;
+}
+
+/* jmp rel32, returns the rel32 to patch */
+static uint8_t *emit_jmp(jit_t *jit)
+{
+    emit8(jit, 0xE9);
+    uint8_t *at = jit->cur;
+    emit32(jit, 0);
+    return at;
+}
+
+static void patch_rel32(uint8_t *at, const uint8_t *target)
+{
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(at, &rel, sizeof(rel));
+}
+
+/* call fn, clobbering rax */
+static void emit_call(jit_t *jit, void *fn)
+{
+    emit_mov_imm(jit, X_RAX, (uint64_t)(uintptr_t)fn);
+    emit8(jit, 0xFF);
+    emit8(jit, 0xD0);
+}
+
+//=======================================================================
+// helpers called from native code
+
+/* Load that the inline fast path does not cover. */
+static y86_register_t jit_load(jit_t *jit, address_t addr)
+{
+    return mem_read64(jit->memory, addr);
+}
+
+/* Return true if [addr, addr + len) touches translated code. */
+static bool touches_code(jit_t *jit, address_t addr, uint64_t len)
+{
+    for (address_t line = addr >> LINEBITS; line <= (addr + len - 1) >> LINEBITS; line++)
+    {
+        if (line < jit->line_lo || line > jit->line_hi)
+        {
+            continue;
+        }
+        if (jit->codeline[line])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Store that the inline fast path does not cover. Returns non-zero if
+   it overwrote translated code. The inline path skips the store hooks,
+   which is why parse_command_line() refuses -J with -w, -W and -i. */
+static int jit_store(jit_t *jit, y86_register_t value, address_t addr)
+{
+    mem_write64(jit->memory, addr, value);
+    mem_note_store(jit->memory, addr, 8);
+    decode_cache_invalidate(jit->memory, addr, 8);
+    TRACE_STORE(jit->memory, addr, value);
+    return touches_code(jit, addr, 8);
+}
+
+//=======================================================================
+// code generation
+
+/* Add an out-of-line exit taken through the rel32 at from. */
+static void add_exit(jit_block_t *block, uint8_t *from, int kind,
+                     address_t pc, int count)
+{
+    jit_exit_t *exit = &block->exits[block->nexits++];
+    exit->from = from;
+    exit->kind = kind;
+    exit->pc = pc;
+    exit->count = count;
+}
+
+/* rax = the memory operand D(rB) */
+static void emit_address(jit_t *jit, int rb, uint64_t d)
+{
+    emit_op_mem(jit, 0x8B, X_RAX, X_RBX, REG_OFF(rb));
+    if ((int64_t)d >= INT32_MIN && (int64_t)d <= INT32_MAX)
+    {
+        if (d != 0)
+        {
+            emit_op_imm(jit, 0, X_RAX, (int32_t)d);
+        }
+    }
+    else
+    {
+        emit_mov_imm(jit, X_RCX, d);
+        emit_op_reg(jit, 0x01, X_RCX, X_RAX);
+    }
+}
+
+/* Leave for the interpreter at pc, unless rax is inside memory (below
+   size, or up to size when equal is allowed). */
+static void emit_check(jit_t *jit, jit_block_t *block, bool allow_size,
+                       address_t pc, int count)
+{
+    emit_op_reg(jit, 0x39, X_R13, X_RAX);
+    add_exit(block, emit_jcc(jit, allow_size ? CC_A : CC_AE), EXIT_SLOW, pc, count);
+}
+
+/* rax = the quad at address rax, known to be inside memory. */
+static void emit_load(jit_t *jit)
+{
+    // mov rcx, rax; shr rcx, PAGEBITS; mov rdx, [r15 + rcx * 8]
+    emit_op_reg(jit, 0x89, X_RAX, X_RCX);
+    emit_shr(jit, X_RCX, PAGEBITS);
+    emit_op_index(jit, 1, 0x8B, X_RDX, X_R15, X_RCX, 3);
+    // test rdx, rdx; jz slow
+    emit_op_reg(jit, 0x85, X_RDX, X_RDX);
+    uint8_t *no_page = emit_jcc(jit, CC_E);
+    // mov ecx, eax; and ecx, PAGEMASK; cmp ecx, PAGESIZE - 8; ja slow
+    emit8(jit, 0x89);
+    emit8(jit, 0xC1);
+    emit8(jit, 0x81);
+    emit8(jit, 0xE1);
+    emit32(jit, PAGEMASK);
+    emit8(jit, 0x81);
+    emit8(jit, 0xF9);
+    emit32(jit, PAGESIZE - 8);
+    uint8_t *crosses = emit_jcc(jit, CC_A);
+    // mov rax, [rdx + rcx]
+    emit_op_index(jit, 1, 0x8B, X_RAX, X_RDX, X_RCX, 0);
+    uint8_t *done = emit_jmp(jit);
+
+    patch_rel32(no_page, jit->cur);
+    patch_rel32(crosses, jit->cur);
+    emit_op_reg(jit, 0x89, X_RAX, X_RSI);
+    emit_op_reg(jit, 0x89, X_R12, X_RDI);
+    emit_call(jit, (void *)jit_load);
+    patch_rel32(done, jit->cur);
+}
+
+/* Store rsi at address rax, known to be inside memory. If the store
+   overwrites translated code leave with count instructions done and
+   continue at next. */
+static void emit_store(jit_t *jit, jit_block_t *block, address_t next, int count)
+{
+    uint8_t *slow[3];
+    int nslow = 0;
+    uint8_t *done = NULL;
+    if (!jit->traced)
+    {
+        // mov rcx, rax; shr rcx, LINEBITS; cmp word [r14 + rcx], 0; jne slow
+        emit_op_reg(jit, 0x89, X_RAX, X_RCX);
+        emit_shr(jit, X_RCX, LINEBITS);
+        emit8(jit, 0x66);
+        emit8(jit, 0x41);
+        emit8(jit, 0x83);
+        emit8(jit, 0x3C);
+        emit8(jit, 0x0E);
+        emit8(jit, 0x00);
+        slow[nslow++] = emit_jcc(jit, CC_NE);
+        // page present and the quad inside it, as in emit_load()
+        emit_op_reg(jit, 0x89, X_RAX, X_RCX);
+        emit_shr(jit, X_RCX, PAGEBITS);
+        emit_op_index(jit, 1, 0x8B, X_RDX, X_R15, X_RCX, 3);
+        emit_op_reg(jit, 0x85, X_RDX, X_RDX);
+        slow[nslow++] = emit_jcc(jit, CC_E);
+        emit8(jit, 0x89);
+        emit8(jit, 0xC1);
+        emit8(jit, 0x81);
+        emit8(jit, 0xE1);
+        emit32(jit, PAGEMASK);
+        emit8(jit, 0x81);
+        emit8(jit, 0xF9);
+        emit32(jit, PAGESIZE - 8);
+        slow[nslow++] = emit_jcc(jit, CC_A);
+        // mov [rdx + rcx], rsi
+        emit_op_index(jit, 1, 0x89, X_RSI, X_RDX, X_RCX, 0);
+        done = emit_jmp(jit);
+    }
+
+    for (int i = 0; i < nslow; i++)
+    {
+        patch_rel32(slow[i], jit->cur);
+    }
+    // jit_store(jit, value, addr)
+    emit_op_reg(jit, 0x89, X_RAX, X_RDX);
+    emit_op_reg(jit, 0x89, X_R12, X_RDI);
+    emit_call(jit, (void *)jit_store);
+    emit8(jit, 0x85);
+    emit8(jit, 0xC0);
+    add_exit(block, emit_jcc(jit, CC_NE), EXIT_FLUSH, next, count);
+    if (done != NULL)
+    {
+        patch_rel32(done, jit->cur);
+    }
+}
+
+/* Evaluate the Y86 condition ifun. Returns the host condition code that
+   holds when the Y86 condition does. */
+static int emit_cond(jit_t *jit, jit_block_t *block, int ifun)
+{
+    bool zero_only = ifun == JE || ifun == JNE;
+    if (zero_only && block->host_zf)
+    {
+        return ifun == JE ? CC_E : CC_NE;
+    }
+    if (zero_only)
+    {
+        // movzx eax, byte [zf]
+        emit8(jit, 0x0F);
+        emit8(jit, 0xB6);
+        emit_mem(jit, X_RAX, X_RBX, ZF_OFF);
+    }
+    else
+    {
+        // movzx eax, byte [sf]; xor al, [of]; (or al, [zf])
+        emit8(jit, 0x0F);
+        emit8(jit, 0xB6);
+        emit_mem(jit, X_RAX, X_RBX, SF_OFF);
+        emit_op_mem8(jit, 0x32, X_RAX, X_RBX, OF_OFF);
+        if (ifun == JLE || ifun == JG)
+        {
+            emit_op_mem8(jit, 0x0A, X_RAX, X_RBX, ZF_OFF);
+        }
+    }
+    // test al, al
+    emit8(jit, 0x84);
+    emit8(jit, 0xC0);
+    block->host_zf = false;
+    return (ifun == JNE || ifun == JGE || ifun == JG) ? CC_E : CC_NE;
+}
+
+/* OPq rA, rB. flags is false when the next instruction overwrites them. */
+static void emit_opq(jit_t *jit, jit_block_t *block, const y86_inst_t *ins, bool flags)
+{
+    static const uint8_t ops[] = { 0x01, 0x29, 0x21, 0x31 };   // add sub and xor
+    emit_op_mem(jit, 0x8B, X_RAX, X_RBX, REG_OFF(ins->rb));
+    emit_op_mem(jit, 0x8B, X_RCX, X_RBX, REG_OFF(ins->ra));
+    if (flags && ins->op == SUB)
+    {
+        emit_op_reg(jit, 0x89, X_RAX, X_RDX);
+    }
+    emit_op_reg(jit, ops[ins->op], X_RCX, X_RAX);
+    emit_op_mem(jit, 0x89, X_RAX, X_RBX, REG_OFF(ins->rb));
+    block->host_zf = true;
+    if (!flags)
+    {
+        return;
+    }
+
+    emit_setcc_mem(jit, CC_E, ZF_OFF);
+    emit_setcc_mem(jit, 0x8, SF_OFF);
+    if (ins->op == ADD || ins->op == SUB)
+    {
+        // opHandler() only reports overflow with a non-zero result (add)
+        // or a non-zero left operand (sub); the host sets it also then
+        emit_setcc(jit, CC_O, X_RCX);
+        if (ins->op == ADD)
+        {
+            emit_setcc(jit, CC_NE, X_RDX);
+        }
+        else
+        {
+            emit_op_reg(jit, 0x85, X_RDX, X_RDX);
+            emit_setcc(jit, CC_NE, X_RDX);
+        }
+        // and cl, dl; mov [of], cl; test rax, rax
+        emit8(jit, 0x20);
+        emit8(jit, 0xD1);
+        emit_op_mem8(jit, 0x88, X_RCX, X_RBX, OF_OFF);
+        emit_op_reg(jit, 0x85, X_RAX, X_RAX);
+    }
+    else
+    {
+        // mov byte [of], 0
+        emit8(jit, 0xC6);
+        emit_mem(jit, 0, X_RBX, OF_OFF);
+        emit8(jit, 0);
+    }
+}
+
+/* Leave for the interpreter with count instructions done. */
+static void emit_exit(jit_t *jit, jit_block_t *block, int kind,
+                      address_t pc, int count)
+{
+    add_exit(block, emit_jmp(jit), kind, pc, count);
+}
+
+/* Return true if the JIT translates ins. */
+static bool supported(const y86_inst_t *ins)
+{
+    switch (ins->type)
+    {
+    case (NOP):
+    case (JUMP):
+    case (CALL):
+    case (RET):
+    case (RMMOVQ):
+    case (PUSHQ):
+        return true;
+    case (CMOV):
+    case (IRMOVQ):
+    case (OPQ):
+        return ins->rb != BADREG;
+    case (MRMOVQ):
+    case (POPQ):
+        return ins->ra != BADREG;
+    default:
+        return false;
+    }
+}
+
+/* Decode the instruction at pc. Returns false if the JIT leaves it to
+   the interpreter. */
+static bool decode(jit_t *jit, address_t pc, y86_inst_t *ins)
+{
+    y86_t scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    scratch.stat = AOK;
+    scratch.memsize = jit->size;
+    scratch.pc = pc;
+    *ins = fetch(&scratch, jit->memory);
+    return ins->type != INVALID && scratch.stat == AOK && supported(ins);
+}
+
+/* Record that [start, end) is translated. */
+static void mark_code(jit_t *jit, address_t start, address_t end)
+{
+    for (address_t line = start >> LINEBITS; line <= (end - 1) >> LINEBITS; line++)
+    {
+        jit->codeline[line] = 1;
+        jit->line_lo = line < jit->line_lo ? line : jit->line_lo;
+        jit->line_hi = line > jit->line_hi ? line : jit->line_hi;
+    }
+}
+
+/* Native entry of the block at pc, or NULL. */
+static uint8_t *lookup(jit_t *jit, address_t pc)
+{
+    uint8_t **page = jit->blocks[pc >> PAGEBITS];
+    return page != NULL ? page[pc & PAGEMASK] : NULL;
+}
+
+//=======================================================================
+/*
+ * Map the code buffer read-write so it can be emitted into or patched,
+ * or read-execute so it can run. It is never both. Return false if the
+ * protection cannot be changed.
+ */
+static bool set_writable(jit_t *jit, bool writable)
+{
+    if (jit->writable == writable)
+    {
+        return true;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    if (mprotect(jit->code, JIT_CODE_SIZE, prot) != 0)
+    {
+        return false;
+    }
+    jit->writable = writable;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Translate the block starting at pc. Return its native entry, or NULL
+ * if its first instruction is left to the interpreter or the buffer or
+ * memory ran out.
+ */
+static uint8_t *compile(jit_t *jit, address_t start)
+{
+    if (jit->code + JIT_CODE_SIZE - jit->cur < BLOCK_RESERVE || !set_writable(jit, true))
+    {
+        return NULL;
+    }
+    uint8_t ***page = &jit->blocks[start >> PAGEBITS];
+    if (*page == NULL)
+    {
+        *page = calloc(PAGESIZE, sizeof(uint8_t *));
+        if (*page == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    y86_inst_t ins;
+    if (!decode(jit, start, &ins))
+    {
+        return NULL;
+    }
+
+    jit_block_t block;
+    block.nexits = 0;
+    block.host_zf = false;
+    uint8_t *entry = jit->cur;
+    address_t pc = start;
+    int n = 0;
+    bool ended = false;
+
+    while (!ended)
+    {
+        address_t next = pc + ins.size;
+        y86_inst_t after;
+        bool have_after = next < jit->size && n + 1 < MAX_BLOCK_INSTS && decode(jit, next, &after);
+        bool flags = !(have_after && after.type == OPQ);
+
+        switch (ins.type)
+        {
+        case (NOP):
+            break;
+        case (IRMOVQ):
+            if ((int64_t)ins.value >= INT32_MIN && (int64_t)ins.value <= INT32_MAX)
+            {
+                // mov qword [rb], imm32
+                emit_rex(jit, 1, 0, 0, X_RBX);
+                emit8(jit, 0xC7);
+                emit_mem(jit, 0, X_RBX, REG_OFF(ins.rb));
+                emit32(jit, (uint32_t)ins.value);
+            }
+            else
+            {
+                emit_mov_imm(jit, X_RAX, ins.value);
+                emit_op_mem(jit, 0x89, X_RAX, X_RBX, REG_OFF(ins.rb));
+            }
+            break;
+        case (CMOV):
+        {
+            uint8_t *skip = NULL;
+            if (ins.cmov != RRMOVQ)
+            {
+                skip = emit_jcc(jit, emit_cond(jit, &block, ins.cmov) ^ 1);
+            }
+            emit_op_mem(jit, 0x8B, X_RCX, X_RBX, REG_OFF(ins.ra));
+            emit_op_mem(jit, 0x89, X_RCX, X_RBX, REG_OFF(ins.rb));
+            if (skip != NULL)
+            {
+                patch_rel32(skip, jit->cur);
+            }
+            break;
+        }
+        case (OPQ):
+            emit_opq(jit, &block, &ins, flags);
+            break;
+        case (MRMOVQ):
+            emit_address(jit, ins.rb, ins.d);
+            emit_check(jit, &block, false, pc, n);
+            emit_load(jit);
+            emit_op_mem(jit, 0x89, X_RAX, X_RBX, REG_OFF(ins.ra));
+            block.host_zf = false;
+            break;
+        case (RMMOVQ):
+            emit_address(jit, ins.rb, ins.d);
+            emit_check(jit, &block, true, pc, n);
+            emit_op_mem(jit, 0x8B, X_RSI, X_RBX, REG_OFF(ins.ra));
+            emit_store(jit, &block, next, n + 1);
+            block.host_zf = false;
+            break;
+        case (PUSHQ):
+        case (CALL):
+            // rax = rsp - 8, then the new rsp before the store so a
+            // flush exit leaves a finished instruction behind
+            emit_op_mem(jit, 0x8B, X_RAX, X_RBX, REG_OFF(RSP));
+            emit_op_imm(jit, 5, X_RAX, 8);
+            emit_check(jit, &block, false, pc, n);
+            if (ins.type == PUSHQ)
+            {
+                emit_op_mem(jit, 0x8B, X_RSI, X_RBX, REG_OFF(ins.ra));
+            }
+            else
+            {
+                emit_mov_imm(jit, X_RSI, next);
+            }
+            emit_op_mem(jit, 0x89, X_RAX, X_RBX, REG_OFF(RSP));
+            emit_store(jit, &block, ins.type == CALL ? ins.dest : next, n + 1);
+            block.host_zf = false;
+            if (ins.type == CALL)
+            {
+                emit_exit(jit, &block, EXIT_CHAIN, ins.dest, n + 1);
+                ended = true;
+            }
+            break;
+        case (POPQ):
+        case (RET):
+            emit_op_mem(jit, 0x8B, X_RAX, X_RBX, REG_OFF(RSP));
+            emit_check(jit, &block, false, pc, n);
+            emit_load(jit);
+            // rsp += 8, then the destination, so popq %rsp gets the value
+            emit_op_mem(jit, 0x8B, X_RCX, X_RBX, REG_OFF(RSP));
+            emit_op_imm(jit, 0, X_RCX, 8);
+            emit_op_mem(jit, 0x89, X_RCX, X_RBX, REG_OFF(RSP));
+            block.host_zf = false;
+            if (ins.type == POPQ)
+            {
+                emit_op_mem(jit, 0x89, X_RAX, X_RBX, REG_OFF(ins.ra));
+                break;
+            }
+            {
+                // add rbp, n + 1; pc = rax; look the block up inline
+                emit_op_imm(jit, 0, X_RBP, n + 1);
+                emit_op_mem(jit, 0x89, X_RAX, X_RBX, PC_OFF);
+                emit_op_reg(jit, 0x39, X_R13, X_RAX);
+                uint8_t *miss[3];
+                miss[0] = emit_jcc(jit, CC_AE);
+                emit_op_reg(jit, 0x89, X_RAX, X_RCX);
+                emit_shr(jit, X_RCX, PAGEBITS);
+                emit_op_mem(jit, 0x8B, X_RDX, X_R12, JIT_OFF(blocks));
+                emit_op_index(jit, 1, 0x8B, X_RDX, X_RDX, X_RCX, 3);
+                emit_op_reg(jit, 0x85, X_RDX, X_RDX);
+                miss[1] = emit_jcc(jit, CC_E);
+                // and eax, PAGEMASK; mov rdx, [rdx + rax * 8]
+                emit8(jit, 0x25);
+                emit32(jit, PAGEMASK);
+                emit_op_index(jit, 1, 0x8B, X_RDX, X_RDX, X_RAX, 3);
+                emit_op_reg(jit, 0x85, X_RDX, X_RDX);
+                miss[2] = emit_jcc(jit, CC_E);
+                // jmp rdx
+                emit8(jit, 0xFF);
+                emit8(jit, 0xE2);
+                for (int i = 0; i < 3; i++)
+                {
+                    patch_rel32(miss[i], jit->cur);
+                }
+                emit_mov_imm(jit, X_RAX, EXIT_LOOKUP);
+                patch_rel32(emit_jmp(jit), jit->epilogue);
+                ended = true;
+            }
+            break;
+        case (JUMP):
+            if (ins.jump == JMP)
+            {
+                emit_exit(jit, &block, EXIT_CHAIN, ins.dest, n + 1);
+            }
+            else
+            {
+                add_exit(&block, emit_jcc(jit, emit_cond(jit, &block, ins.jump)),
+                         EXIT_CHAIN, ins.dest, n + 1);
+                emit_exit(jit, &block, EXIT_CHAIN, next, n + 1);
+            }
+            ended = true;
+            break;
+        default:
+            break;
+        }
+        n++;
+        pc = next;
+
+        if (!ended && !have_after)
+        {
+            // the block ends at the next instruction: out of memory, too
+            // long or left to the interpreter
+            bool slow = next < jit->size && n < MAX_BLOCK_INSTS;
+            emit_exit(jit, &block, slow ? EXIT_SLOW : EXIT_CHAIN, next, n);
+            ended = true;
+        }
+        ins = after;
+    }
+
+    // out-of-line exits
+    for (int i = 0; i < block.nexits; i++)
+    {
+        jit_exit_t *exit = &block.exits[i];
+        patch_rel32(exit->from, jit->cur);
+        if (exit->count > 0)
+        {
+            emit_op_imm(jit, 0, X_RBP, exit->count);
+        }
+        if (exit->kind == EXIT_CHAIN)
+        {
+            // jmp rel32 that run_jit() points at the target block
+            uint8_t *link = emit_jmp(jit);
+            patch_rel32(link, jit->cur);
+            emit_mov_imm(jit, X_RAX, (uint64_t)(uintptr_t)link);
+            emit_op_mem(jit, 0x89, X_RAX, X_R12, JIT_OFF(patch));
+        }
+        emit_mov_imm(jit, X_RAX, exit->pc);
+        emit_op_mem(jit, 0x89, X_RAX, X_RBX, PC_OFF);
+        emit_mov_imm(jit, X_RAX, exit->kind);
+        patch_rel32(emit_jmp(jit), jit->epilogue);
+    }
+
+    mark_code(jit, start, pc);
+    (*page)[start & PAGEMASK] = entry;
+    return entry;
+}
+
+//=======================================================================
+/*
+ * Drop every translation.
+ */
+static void flush(jit_t *jit)
+{
+    for (uint64_t i = 0; i < jit->memory->npages; i++)
+    {
+        free(jit->blocks[i]);
+        jit->blocks[i] = NULL;
+    }
+    if (jit->line_lo <= jit->line_hi)
+    {
+        memset(jit->codeline + jit->line_lo, 0, jit->line_hi - jit->line_lo + 1);
+    }
+    jit->line_lo = UINT64_MAX;
+    jit->line_hi = 0;
+    jit->cur = jit->start;
+    jit->generation++;
+    // fast-path stores skip the decode cache; start it over as well
+    decode_cache_clear(jit->memory);
+}
+
+//=======================================================================
+/*
+ * Emit the entry stub, called from C as jit->enter(jit, block), and the
+ * exit stub every block leaves through with the exit reason in eax.
+ */
+static void emit_stubs(jit_t *jit)
+{
+    jit->enter = (int (*)(jit_t *, uint8_t *))(void *)jit->cur;
+    emit8(jit, 0x53);                       // push rbx
+    emit8(jit, 0x55);                       // push rbp
+    emit8(jit, 0x41);                       // push r12 .. r15
+    emit8(jit, 0x54);
+    emit8(jit, 0x41);
+    emit8(jit, 0x55);
+    emit8(jit, 0x41);
+    emit8(jit, 0x56);
+    emit8(jit, 0x41);
+    emit8(jit, 0x57);
+    emit_op_imm(jit, 5, X_RSP, 8);          // keep rsp 16-byte aligned
+    emit_op_reg(jit, 0x89, X_RDI, X_R12);
+    emit_op_mem(jit, 0x8B, X_RBX, X_R12, JIT_OFF(cpu));
+    emit_op_mem(jit, 0x8B, X_R13, X_R12, JIT_OFF(size));
+    emit_op_mem(jit, 0x8B, X_R14, X_R12, JIT_OFF(codeline));
+    emit_op_mem(jit, 0x8B, X_R15, X_R12, JIT_OFF(pages));
+    emit_op_mem(jit, 0x8B, X_RBP, X_R12, JIT_OFF(count));
+    emit8(jit, 0xFF);                       // jmp rsi
+    emit8(jit, 0xE6);
+
+    jit->epilogue = jit->cur;
+    emit_op_mem(jit, 0x89, X_RBP, X_R12, JIT_OFF(count));
+    emit_op_imm(jit, 0, X_RSP, 8);
+    emit8(jit, 0x41);                       // pop r15 .. r12
+    emit8(jit, 0x5F);
+    emit8(jit, 0x41);
+    emit8(jit, 0x5E);
+    emit8(jit, 0x41);
+    emit8(jit, 0x5D);
+    emit8(jit, 0x41);
+    emit8(jit, 0x5C);
+    emit8(jit, 0x5D);                       // pop rbp
+    emit8(jit, 0x5B);                       // pop rbx
+    emit8(jit, 0xC3);                       // ret
+    jit->start = jit->cur;
+}
+
+//=======================================================================
+/*
+ * Set up jit for cpu and memory. Return false if the code buffer
+ * or the tables cannot be allocated.
+ */
+static bool jit_init(jit_t *jit, y86_t *cpu, memory_t memory)
+{
+    memset(jit, 0, sizeof(*jit));
+    jit->cpu = cpu;
+    jit->memory = memory;
+    jit->size = mem_size(memory);
+    jit->pages = memory->pages;
+    jit->traced = memory->trace != NULL;
+    jit->line_lo = UINT64_MAX;
+    jit->blocks = calloc(memory->npages, sizeof(uint8_t **));
+    // one spare line so the two-line check at the end stays inside
+    jit->codeline = calloc((memory->npages << (PAGEBITS - LINEBITS)) + 1, 1);
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->blocks == NULL || jit->codeline == NULL || code == MAP_FAILED)
+    {
+        free(jit->blocks);
+        free(jit->codeline);
+        if (code != MAP_FAILED)
+        {
+            munmap(code, JIT_CODE_SIZE);
+        }
+        return false;
+    }
+    jit->code = code;
+    jit->cur = code;
+    jit->writable = true;
+    emit_stubs(jit);
+    return true;
+}
+
+//=======================================================================
+static void jit_free(jit_t *jit)
+{
+    for (uint64_t i = 0; i < jit->memory->npages; i++)
+    {
+        free(jit->blocks[i]);
+    }
+    free(jit->blocks);
+    free(jit->codeline);
+    munmap(jit->code, JIT_CODE_SIZE);
+}
+
+//=======================================================================
+/*
+ * Run the instruction at cpu->pc in the interpreter. The bytes it ran
+ * are tracked like translated code: the decode cache holds them, and
+ * native stores only keep the decode cache coherent through jit_store().
+ */
+static void jit_step(jit_t *jit)
+{
+    y86_t *cpu = jit->cpu;
+    address_t pc = cpu->pc;
+    y86_inst_t ins;
+    y86_register_t valE;
+    step_portable(cpu, jit->memory, &ins, &valE);
+    jit->count++;
+
+    if (pc < jit->size && ins.size > 0)
+    {
+        address_t end = pc + ins.size < jit->size ? pc + ins.size : jit->size;
+        mark_code(jit, pc, end);
+    }
+    // a store from the interpreter may have hit translated code
+    bool stored = ins.type == RMMOVQ || ins.type == CALL || ins.type == PUSHQ;
+    if (stored && valE < jit->size && touches_code(jit, valE, 8))
+    {
+        flush(jit);
+    }
+}
+
+//=======================================================================
+/*
+ * Native entry of the block at pc, translating it if needed. NULL if the
+ * interpreter has to run the instruction at pc.
+ */
+static uint8_t *block_at(jit_t *jit, address_t pc)
+{
+    if (pc >= jit->size)
+    {
+        return NULL;
+    }
+    uint8_t *code = lookup(jit, pc);
+    if (code == NULL)
+    {
+        code = compile(jit, pc);
+        if (code == NULL && jit->code + JIT_CODE_SIZE - jit->cur < BLOCK_RESERVE)
+        {
+            // buffer full, start over
+            flush(jit);
+            code = compile(jit, pc);
+        }
+    }
+    return code;
+}
+
+//=======================================================================
+/*
+ * Run cpu until it leaves the AOK state and return the number of
+ * instructions executed. Output matches the -e loop in main.c.
+ */
+uint64_t run_jit(y86_t *cpu, memory_t memory, elf_hdr_t *hdr, elf_phdr_t phdr[])
+{
+    if (cpu == NULL || memory == NULL)
+    {
+        return 0;
+    }
+    settle_flags(cpu);
+
+    jit_t jit;
+    if (!jit_init(&jit, cpu, memory))
+    {
+        // no room for native code, use the portable engine
+        uint64_t count = 0;
+        y86_inst_t ins;
+        y86_register_t valE;
+        while (cpu->stat == AOK)
+        {
+            step_portable(cpu, memory, &ins, &valE);
+            count++;
+        }
+        return count;
+    }
+
+    while (cpu->stat == AOK)
+    {
+        uint8_t *code = block_at(&jit, cpu->pc);
+        if (code == NULL)
+        {
+            jit_step(&jit);
+            continue;
+        }
+
+        if (!set_writable(&jit, false))
+        {
+            jit_step(&jit);
+            continue;
+        }
+        int exit = jit.enter(&jit, code);
+        if (exit == EXIT_SLOW)
+        {
+            jit_step(&jit);
+            continue;
+        }
+        if (exit == EXIT_FLUSH)
+        {
+            flush(&jit);
+        }
+        if (cpu->pc >= jit.size)
+        {
+            // same check as the -e loop after every instruction
+            cpu->stat = ADR;
+            cpu->pc = 0xffffffffffffffff;
+            break;
+        }
+        if (exit == EXIT_CHAIN)
+        {
+            // link the exit straight to its target from now on, unless
+            // translating the target dropped the block holding the exit
+            uint64_t generation = jit.generation;
+            uint8_t *target = block_at(&jit, cpu->pc);
+            if (target != NULL && generation == jit.generation &&
+                set_writable(&jit, true))
+            {
+                patch_rel32(jit.patch, target);
+            }
+        }
+    }
+
+    uint64_t count = jit.count;
+    jit_free(&jit);
+    return count;
+}
+
+#else
+
+//=======================================================================
+/*
+ * Not on x86-64: fall back to the portable switch engine.
+ */
+uint64_t run_jit(y86_t *cpu, memory_t memory, elf_hdr_t *hdr, elf_phdr_t phdr[])
+{
+    uint64_t count = 0;
+    y86_inst_t ins;
+    y86_register_t valE;
+    while (cpu != NULL && memory != NULL && cpu->stat == AOK)
+    {
+        step_portable(cpu, memory, &ins, &valE);
+        count++;
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Memory-mapped Mini-ELF loader.
+ *
+ * The whole file is mapped once and the header, the program headers and
+ * the segments are read straight out of the mapping, with every offset
+ * checked against its length.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./headers/loader.h"
+#include "./headers/mem-access.h"
+
+// "ELF\0" read as a little-endian number
+#define ELF_MAGIC 0x00464c45
+#define PHDR_MAGIC 0xDEADBEEF
+//=======================================================================
+/*
+ * Map the file at path into img.
+ * Return false if it cannot be opened or mapped.
+ */
+bool map_image(const char *path, elf_image_t *img)
+{
+    if (path == NULL || img == NULL)
+    {
+        return false;
+    }
+    memset(img, 0, sizeof(*img));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    // an empty file is valid to open, it just has no header to read
+    if (st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        img->data = data;
+        img->len = st.st_size;
+        img->mapped = true;
+    }
+    close(fd);
+    return true;
+}
+
+//=======================================================================
+/*
+ * Use the len bytes at buf, owned by the caller, as the file of img.
+ */
+void image_from_buffer(const void *buf, size_t len, elf_image_t *img)
+{
+    memset(img, 0, sizeof(*img));
+    img->data = (uint8_t *)buf;
+    img->len = len;
+}
+
+//=======================================================================
+/*
+ * Release the mapping of img.
+ */
+void unmap_image(elf_image_t *img)
+{
+    if (img == NULL)
+    {
+        return;
+    }
+    if (img->mapped)
+    {
+        munmap(img->data, img->len);
+    }
+    memset(img, 0, sizeof(*img));
+}
+
+//=======================================================================
+/*
+ * Validate the header of img and point img->hdr at it.
+ * Return true if the header is valid, false otherwise.
+ */
+bool image_header(elf_image_t *img)
+{
+    if (img == NULL || img->len < sizeof(elf_hdr_t))
+    {
+        return false;
+    }
+    elf_hdr_t *hdr = (elf_hdr_t *)img->data;
+    if (hdr->magic != ELF_MAGIC)
+    {
+        return false;
+    }
+    img->hdr = hdr;
+    // the table itself is checked entry by entry in image_phdr()
+    img->phdr = hdr->e_phdr_start <= img->len ?
+                (elf_phdr_t *)(img->data + hdr->e_phdr_start) : NULL;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Return program header i of img, or NULL if it lies outside the file
+ * or its magic number is wrong.
+ */
+elf_phdr_t *image_phdr(elf_image_t *img, int i)
+{
+    if (img == NULL || img->hdr == NULL || i < 0 || i >= img->hdr->e_num_phdr)
+    {
+        return NULL;
+    }
+    size_t offset = img->hdr->e_phdr_start + (size_t)i * sizeof(elf_phdr_t);
+    if (offset + sizeof(elf_phdr_t) > img->len)
+    {
+        return NULL;
+    }
+    elf_phdr_t *phdr = (elf_phdr_t *)(img->data + offset);
+    if (phdr->magic != PHDR_MAGIC)
+    {
+        return NULL;
+    }
+    return phdr;
+}
+
+//=======================================================================
+/*
+ * Copy the segment described by phdr from img into memory. Bytes past
+ * the end of the file load as zero. Return false if the segment does
+ * not fit in memory.
+ */
+bool image_load_segment(const elf_image_t *img, memory_t memory,
+                        const elf_phdr_t *phdr)
+{
+    if (img == NULL || memory == NULL || phdr == NULL)
+    {
+        return false;
+    }
+    if (phdr->p_vaddr > mem_size(memory))
+    {
+        return false;
+    }
+    if ((address_t)phdr->p_vaddr + phdr->p_filesz > mem_size(memory))
+    {
+        return false;
+    }
+
+    size_t avail = phdr->p_offset < img->len ? img->len - phdr->p_offset : 0;
+    size_t len = phdr->p_filesz < avail ? phdr->p_filesz : avail;
+    if (len > 0)
+    {
+        mem_write(memory, phdr->p_vaddr, img->data + phdr->p_offset, len);
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Validate img and load all of its segments into memory.
+ * Return NULL on success, else the message main() prints for the step
+ * that failed.
+ */
+const char *image_load(elf_image_t *img, memory_t memory)
+{
+    if (!image_header(img))
+    {
+        return "Failed to Read ELF Header";
+    }
+    for (int i = 0; i < img->hdr->e_num_phdr; i++)
+    {
+        elf_phdr_t *phdr = image_phdr(img, i);
+        if (phdr == NULL)
+        {
+            return "Failed to Read Program Header";
+        }
+        if (!image_load_segment(img, memory, phdr))
+        {
+            return "Failed to Load Segment";
+        }
+    }
+    return NULL;
+}
+
+//=======================================================================
+static int compare_symbols(const void *a, const void *b)
+{
+    const elf_symbol_t *sa = a, *sb = b;
+    if (sa->addr != sb->addr)
+    {
+        return sa->addr < sb->addr ? -1 : 1;
+    }
+    return strcmp(sa->name, sb->name);
+}
+
+//=======================================================================
+/*
+ * Build the symbol index of img from its symbol and string tables.
+ * Entries whose name lies outside the file are dropped; an image
+ * without tables gives an empty index. img must have a validated
+ * header. Return false if out of memory.
+ */
+bool image_symbols(const elf_image_t *img, symbol_index_t *index)
+{
+    index->syms = NULL;
+    index->count = 0;
+
+    const elf_hdr_t *hdr = img->hdr;
+    if (hdr == NULL || hdr->e_symtab == 0 || hdr->e_strtab <= hdr->e_symtab ||
+        hdr->e_strtab > img->len)
+    {
+        return true;
+    }
+    int n = (hdr->e_strtab - hdr->e_symtab) / sizeof(elf_sym_t);
+    if (n == 0)
+    {
+        return true;
+    }
+    index->syms = malloc(n * sizeof(elf_symbol_t));
+    if (index->syms == NULL)
+    {
+        return false;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        elf_sym_t sym;
+        memcpy(&sym, img->data + hdr->e_symtab + i * sizeof(elf_sym_t), sizeof(sym));
+        size_t name = (size_t)hdr->e_strtab + sym.st_name;
+        if (name >= img->len || memchr(img->data + name, '\0', img->len - name) == NULL)
+        {
+            continue;
+        }
+        index->syms[index->count].addr = sym.st_value;
+        index->syms[index->count].name = (const char *)img->data + name;
+        index->count++;
+    }
+    qsort(index->syms, index->count, sizeof(elf_symbol_t), compare_symbols);
+    return true;
+}
+
+//=======================================================================
+void free_symbols(symbol_index_t *index)
+{
+    free(index->syms);
+    index->syms = NULL;
+    index->count = 0;
+}
+
+//=======================================================================
+/*
+ * The first of the symbols at addr, with their number in *n (if not
+ * NULL); they follow each other in the index. NULL if there are none.
+ */
+const elf_symbol_t *symbol_at(const symbol_index_t *index, address_t addr,
+                              int *n)
+{
+    if (index == NULL)
+    {
+        return NULL;
+    }
+    // lower bound: the first entry not below addr
+    int lo = 0, hi = index->count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (index->syms[mid].addr < addr)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    int end = lo;
+    while (end < index->count && index->syms[end].addr == addr)
+    {
+        end++;
+    }
+    if (end == lo)
+    {
+        return NULL;
+    }
+    if (n != NULL)
+    {
+        *n = end - lo;
+    }
+    return &index->syms[lo];
+}
@@ -2,62 +2,84 @@
  * A Y-86 simulator constructed in C-99
  */
 
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "./headers/validate-header.h"
+#include "./headers/loader.h"
 #include "./headers/mem-access.h"
 #include "./headers/disassemble.h"
 #include "./headers/interpret.h"
+#include "./headers/decode-cache.h"
+#include "./headers/threaded.h"
+#include "./headers/jit.h"
+#include "./headers/options.h"
+#include "./headers/trace.h"
+#include "./headers/batch.h"
+#include "./headers/gdbstub.h"
+#include "./headers/pipe.h"
+#include "./headers/profile.h"
+#include "./headers/snapshot.h"
 
 int main(int argc, char **argv)
 {
-    // boolean variables used to identify flags:
-    bool header = false;
-    bool segments = false;
-    bool membrief = false;
-    bool memfull = false;
-    bool disas_code = false;
-    bool disas_data = false;
-    bool exec_normal = false;
-    bool exec_debug = false;
+    // command-line switches, see options.h
+    y86_options_t opts;
 
     char *file = NULL;
-    FILE *fileOpen;
-    // header struct... free at end.
-    elf_hdr_t *hdr = malloc(sizeof(elf_hdr_t));
+    // the mapped Mini-ELF file, the header and program headers point into it
+    elf_image_t image;
+    elf_hdr_t *hdr;
 
     // command-line parser
-    if (parse_command_line_p4(argc, argv, &header, &segments, &membrief, &memfull, &disas_code, &disas_data, &exec_normal, &exec_debug, &file) == false)
+    if (parse_command_line(argc, argv, &opts) == false)
     {
 
         exit(EXIT_FAILURE);
     }
 
-    // if header is false, exit the program.
-    if (!header && file == NULL)
+    // batch mode (-b) runs every image given and handles its own output
+    if (opts.batch)
     {
-        exit(EXIT_SUCCESS);
+        exit(run_batch(&opts));
+    }
+
+    // gdb stub (-g) runs the program under the debugger's control
+    if (opts.gdb != NULL)
+    {
+        exit(run_gdb(&opts));
     }
 
-    // open File... Close at end.
-    fileOpen = fopen(file, "r");
+    bool header = opts.header;
+    bool segments = opts.segments;
+    bool membrief = opts.membrief;
+    bool memfull = opts.memfull;
+    bool disas_code = opts.disas_code;
+    bool disas_data = opts.disas_data;
+    bool exec_normal = opts.exec_normal;
+    bool exec_debug = opts.exec_debug;
+    file = opts.file;
 
-    // Check that file is readable.
-    if (fileOpen)
+    // if header is false, exit the program.
+    if (!header && file == NULL)
     {
+        exit(EXIT_SUCCESS);
     }
-    else
+
+    // map the file... unmap at end.
+    if (!map_image(file, &image))
     {
         printf("Failed to open File\n");
         exit(EXIT_FAILURE);
     }
 
     // Read in the header.
-    if (read_header(fileOpen, hdr))
+    if (image_header(&image))
     {
+        hdr = image.hdr;
         // if the header option is selected, print the mini_elf metadata.
         if (header)
         {
@@ -87,44 +109,59 @@ int main(int argc, char **argv)
     else
     {
         printf("Failed to Read ELF Header\n");
+        unmap_image(&image);
         exit(EXIT_FAILURE);
     }
 
-    // create an array of program headers
-    elf_phdr_t *phdr = malloc(sizeof(elf_phdr_t) * hdr->e_num_phdr);
+    // the program headers, valid once every entry has been checked below
+    elf_phdr_t *phdr = image.phdr;
 
-    // create a virtual memory to allocate information to. The size is MEMSIZE.
-    memory_t mem = calloc(MEMSIZE, sizeof(memory_t));
+    // create a virtual memory to allocate information to. Pages are only
+    // allocated once written, the address space is 1 << vaddrbits bytes.
+    memory_t mem = mem_create(opts.vaddrbits);
+    if (mem == NULL)
+    {
+        printf("Failed to allocate memory\n");
+        unmap_image(&image);
+        exit(EXIT_FAILURE);
+    }
+    set_mem_trace(mem, opts.quiet ? NULL : print_mem_write);
 
     // read in each program header, if an invalid header is encountered, exit the program with a status error.
     for (int i = 0; i < hdr->e_num_phdr; i++)
     {
-        if (read_phdr(fileOpen, hdr->e_phdr_start + (i * sizeof(elf_phdr_t)), &phdr[i]))
+        if (image_phdr(&image, i) != NULL)
         {
-            if (load_segment(fileOpen, mem, phdr[i]))
+            if (image_load_segment(&image, mem, &phdr[i]))
             {
             }
             else
             {
                 printf("Failed to Load Segment");
-                fclose(fileOpen);
-                free(hdr);
-                free(mem);
-                free(phdr);
+                unmap_image(&image);
+                mem_free(mem);
                 exit(EXIT_FAILURE);
             }
         }
         else
         {
             printf("Failed to Read Program Header\n");
-            fclose(fileOpen);
-            free(hdr);
-            free(mem);
-            free(phdr);
+            unmap_image(&image);
+            mem_free(mem);
             exit(EXIT_FAILURE);
         }
     }
 
+    // the symbol table, parsed once for every output that shows names
+    symbol_index_t syms;
+    if (!image_symbols(&image, &syms))
+    {
+        printf("Failed to allocate symbol index\n");
+        unmap_image(&image);
+        mem_free(mem);
+        exit(EXIT_FAILURE);
+    }
+
     // segments flag (-s) This flag dumps the program headers.
     if (segments)
     {
@@ -154,9 +191,29 @@ int main(int argc, char **argv)
     }
 
     // memfull (-M) This flag dumps the full virtual memory.
-    if (memfull)
+    if (memfull && !opts.memdiff)
     {
-        dump_memory(mem, 0, MEMSIZE);
+        dump_memory(mem, 0, mem_size(mem));
+    }
+
+    // with -i the dumps only show lines written, by the loader for -M and
+    // by the program since it started (or the last checkpoint) after -e, -E
+    if (opts.memdiff)
+    {
+        if (!mem_track_dirty(mem))
+        {
+            printf("Failed to allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        if (memfull)
+        {
+            for (int i = 0; i < hdr->e_num_phdr; i++)
+            {
+                mem_mark_dirty(mem, phdr[i].p_vaddr, phdr[i].p_filesz);
+            }
+            dump_dirty(mem);
+            mem_dirty_reset(mem);
+        }
     }
 
     // disassemble code (-d) This flag will diassemble all the code sections stored in virutal memory.
@@ -167,7 +224,7 @@ int main(int argc, char **argv)
         {
             if (phdr[i].p_type == CODE)
             {
-                disassemble_code(mem, &phdr[i], hdr);
+                disassemble_code(mem, &phdr[i], hdr, &syms);
                 printf("\n");
             }
         }
@@ -202,24 +259,100 @@ int main(int argc, char **argv)
     y86_t cpu;
     memset(&cpu, 0x00, sizeof(cpu));
     cpu.stat = AOK;
-    int count = 0;
+    uint64_t count = 0;
     y86_register_t valA = 0;
     y86_register_t valE = 0;
     bool cond = false;
     cpu.pc = hdr->e_entry;
+    cpu.memsize = mem_size(mem);
+
+    // restore (-R) replaces the loaded memory and the CPU with a checkpoint
+    if (opts.restore_file != NULL)
+    {
+        const char *error = snapshot_restore(opts.restore_file, &cpu, mem, &count);
+        if (error != NULL)
+        {
+            printf("%s\n", error);
+            free_symbols(&syms);
+            unmap_image(&image);
+            mem_free(mem);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // normal Execution (-e) This flag will execute all instructions in "normal" mode.
     if (exec_normal)
     {
-        printf("Entry execution point at 0x%04x\n", hdr->e_entry);
+        printf("Entry execution point at 0x%04lx\n", cpu.pc);
         printf("Initial ");
         dump_cpu(&cpu);
 
+        // profiling (-p) counts in the loop below, whatever the engine
+        profile_t profile;
+        profile_t *prof = NULL;
+        if (opts.profile)
+        {
+            if (!profile_init(&profile, mem, hdr->e_entry, &syms))
+            {
+                printf("Failed to allocate profile\n");
+                exit(EXIT_FAILURE);
+            }
+            prof = &profile;
+        }
+
+        // branch prediction (-B), on its own or inside the PIPE model
+        predictor_t predictor;
+        predictor_t *pred = NULL;
+        if (opts.predictor >= 0)
+        {
+            if (!predictor_init(&predictor, opts.predictor))
+            {
+                printf("Failed to allocate branch predictor\n");
+                exit(EXIT_FAILURE);
+            }
+            pred = &predictor;
+        }
+
+        // the PIPE cycle model (-P) times the same instructions
+        pipe_t pipeline;
+        pipe_t *pipe = NULL;
+        if (opts.pipeline)
+        {
+            pipe_init(&pipeline, pred);
+            pipe = &pipeline;
+        }
+
+        // watchpoint (-w, -W) on the stores of the loop below
+        if (opts.watch && !mem_watch(mem, opts.watch_addr, opts.watch_len))
+        {
+            printf("Invalid watch range\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // checkpoints (-S) on SIGUSR1 and after -C instructions
+        if (opts.snapshot_file != NULL && !snapshot_on_signal(SIGUSR1))
+        {
+            printf("Failed to install the checkpoint signal handler\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (opts.threaded)
+        {
+            // threaded-code engine, same results as the loop below
+            count += run_threaded(&cpu, mem, hdr, phdr);
+        }
+        else if (opts.jit)
+        {
+            // basic blocks compiled to native code, same results again
+            count += run_jit(&cpu, mem, hdr, phdr);
+        }
+
         // loop executes while cpu status is ok
         while (cpu.stat == AOK)
         {
-            // fetch the instruction
-            y86_inst_t ins = fetch(&cpu, mem);
+            address_t pc = cpu.pc;
+            // fetch the instruction (decoded once per address, then cached)
+            y86_inst_t ins = fetch_cached(&cpu, mem);
             cond = false;
             // debug and execute the instruction
             valE = decode_execute(&cpu, &cond, &ins, &valA);
@@ -236,11 +369,51 @@ int main(int argc, char **argv)
             count++;
 
             // check to that pc didnt exceed memsize
-            if (cpu.pc >= MEMSIZE)
+            if (cpu.pc >= mem_size(mem))
             {
                 cpu.stat = ADR;
                 cpu.pc = 0xffffffffffffffff;
             }
+
+            if (prof != NULL)
+            {
+                profile_step(prof, pc, &ins, cond, &cpu);
+            }
+            if (pipe != NULL)
+            {
+                pipe_step(pipe, pc, &ins, cond, &cpu);
+            }
+            else if (pred != NULL)
+            {
+                predictor_step(pred, pc, &ins, cond, &cpu);
+            }
+
+            if (mem->watch_hit)
+            {
+                mem->watch_hit = false;
+                printf("Watchpoint: write to 0x%04lx by the instruction at 0x%04lx\n",
+                       mem->watch_addr, pc);
+                if (opts.watch_stop)
+                {
+                    break;
+                }
+            }
+
+            // reported on stderr so the output stays that of a plain run
+            if (opts.snapshot_file != NULL &&
+                (count == opts.snapshot_at || snapshot_pending()))
+            {
+                if (snapshot_write(opts.snapshot_file, &cpu, mem, count))
+                {
+                    fprintf(stderr, "Checkpoint after %lu instructions written to %s\n",
+                            count, opts.snapshot_file);
+                    mem_dirty_reset(mem);
+                }
+                else
+                {
+                    fprintf(stderr, "Failed to write checkpoint %s\n", opts.snapshot_file);
+                }
+            }
         }
 
         if (cpu.stat == INS)
@@ -254,67 +427,111 @@ int main(int argc, char **argv)
         dump_cpu(&cpu);
 
         // print cpu state
-        printf("Total execution count: %d instructions\n\n", count);
+        printf("Total execution count: %lu instructions\n\n", count);
+
+        if (pipe != NULL)
+        {
+            pipe_report(pipe);
+        }
+        if (pred != NULL)
+        {
+            predictor_report(pred);
+            predictor_free(pred);
+        }
+        if (prof != NULL)
+        {
+            profile_report(prof, mem, hdr, phdr);
+            profile_free(prof);
+        }
+        if (opts.memdiff)
+        {
+            dump_dirty(mem);
+        }
     }
 
     // Debug execution (-E) This flag will execute all instructions in "debug" mode, it will additionally
     // print the entire memory contents at the end of execution.
     if (exec_debug)
     {
-        printf("Entry execution point at 0x%04x\n", hdr->e_entry);
+        printf("Entry execution point at 0x%04lx\n", cpu.pc);
+
+        // the per-instruction trace goes through a buffered writer, either
+        // as text on stdout or as binary records for y86-trace
+        FILE *binTrace = NULL;
+        if (opts.trace_file != NULL)
+        {
+            binTrace = fopen(opts.trace_file, "wb");
+            if (binTrace == NULL)
+            {
+                printf("Failed to open trace file\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        trace_t trace;
+        if (!trace_open(&trace, STDOUT_FILENO, binTrace))
+        {
+            printf("Failed to allocate trace buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        trace.syms = &syms;
+        fflush(stdout);
+        if (!opts.quiet)
+        {
+            set_mem_trace(mem, trace_mem_write);
+        }
 
         for (int i = 0; i < hdr->e_num_phdr; i++)
         {
             if (i == 0)
             {
-                printf("Initial ");
-                dump_cpu(&cpu);
+                trace_begin(&trace, &cpu);
             }
             // execute while cpu status is ok
             while (cpu.stat == AOK)
             {
-                // fetch intsruction
-                y86_inst_t ins = fetch(&cpu, mem);
+                y86_t before = cpu;
 
-                // print instruction
-                printf("Executing: ");
-                disassemble(ins);
+                // fetch intsruction
+                y86_inst_t ins = fetch_cached(&cpu, mem);
 
                 // decode and execute
                 valE = decode_execute(&cpu, &cond, &ins, &valA);
-
-                // If invalid opcode, print the relevant message
-                if (cpu.stat == INS)
-                {
-                    printf("Corrupt Instruction (opcode 0x%02x) at address 0x%04lx\n", ins.opcode, cpu.pc);
-                }
+                bool corrupt = cpu.stat == INS;
 
                 // write value to memory and registers
                 // update program counter
                 memory_wb_pc(&cpu, mem, cond, &ins, valE, valA);
                 count++;
 
-                if (cpu.stat == INS)
-                {
-                    printf("Post-Fetch ");
-                }
-                else
-                {
-                    printf("Post-Exec ");
-                }
-                dump_cpu(&cpu);
+                // the trace shows the flags after every instruction
+                settle_flags(&cpu);
+
+                // instruction, corrupt opcode notice, stores and new state
+                trace_step(&trace, &before, &ins, &cpu, corrupt);
             }
         }
+        trace_close(&trace);
+        if (binTrace != NULL)
+        {
+            fclose(binTrace);
+        }
+
         // print cpu status
-        printf("Total execution count: %d instructions\n\n", count);
-        dump_memory(mem, 0, MEMSIZE);
+        printf("Total execution count: %lu instructions\n\n", count);
+        if (opts.memdiff)
+        {
+            dump_dirty(mem);
+        }
+        else
+        {
+            dump_memory(mem, 0, mem_size(mem));
+        }
     }
 
     // close and free memory.
-    fclose(fileOpen);
-    free(hdr);
-    free(mem);
-    free(phdr);
+    free_symbols(&syms);
+    unmap_image(&image);
+    mem_free(mem);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "./headers/mem-access.h"
+#include "./headers/decode-cache.h"
 
 /*
  * Print the usage message for this program.
@@ -21,45 +22,6 @@ void usage_mem()
     printf("Options must not be repeated neither explicitly nor implicitly.\n");
 }
 //=======================================================================
-/*
- * Read the header from the file and store it in the struct.
- * Return true if the header is valid, false otherwise.
- */
-bool read_phdr(FILE *file, uint16_t offset, elf_phdr_t *phdr)
-{
-    if (phdr == NULL)
-    {
-        return false;
-    }
-    if (file == NULL)
-    {
-        return false;
-    }
-    fseek(file, offset, SEEK_SET);
-
-    phdr->magic = (long)NULL;
-
-    // read in the segment offset
-    fread(&phdr->p_offset, sizeof(uint32_t), 1, file);
-    // read in the segment file size
-    fread(&phdr->p_filesz, sizeof(uint32_t), 1, file);
-    // read in the segment virtual address
-    fread(&phdr->p_vaddr, sizeof(uint32_t), 1, file);
-    // read in the segment type
-    fread(&phdr->p_type, sizeof(uint16_t), 1, file);
-    // read in the segment flags
-    fread(&phdr->p_flag, sizeof(uint16_t), 1, file);
-    // read in the segment magic number
-    fread(&phdr->magic, sizeof(uint32_t), 1, file);
-
-    // check if the magic number is correct
-    if (&phdr->magic == NULL || phdr->magic != 0XDEADBEEF)
-    {
-        return false;
-    }
-    return true;
-}
-//=======================================================================
 /*
  * Read the program headers from the file and store them in the array.
  * Return true if the headers are valid, false otherwise.
@@ -142,70 +104,379 @@ bool read_phdr(FILE *file, uint16_t offset, elf_phdr_t *phdr)
 }
 //=======================================================================
 /*
- * Load the segments from the file into memory.
- * Return true if successful, false otherwise.
+ * Dump the contents of memory from start to end.
+ * If start is 0x0, then the first line should be "Contents of memory from 0000 to end:"
+ * If end is the size of memory, then the last line should be "Contents of memory from start to ffff:"
+ * If both start and end are 0x0, then the first line should be "Contents of memory:"
  */
-bool load_segment(FILE *file, memory_t memory, elf_phdr_t phdr)
+void dump_memory(memory_t memory, address_t start, address_t end)
 {
-    if (file == NULL)
+    printf("Contents of memory from %04lx to %04lx:\n", start, end);
+    for (address_t i = start; i < end; i++)
     {
-        return false;
+        if ((i - start) % 16 == 0)
+        {
+            printf("  %04lx ", i);
+        }
+        if ((i - start) % 8 == 0)
+        {
+            printf(" ");
+        }
+        printf("%02x", mem_read8(memory, i));
+        if ((i - start) % 16 != 15)
+        {
+            printf(" ");
+        }
+        if ((i - start) % 16 == 15)
+        {
+            printf("\n");
+        }
+    }
+    if (end != mem_size(memory) || start == 0x0)
+    {
+        printf("\n");
+    }
+}
+//=======================================================================
+/*
+ * Create an empty memory with an address space of 1 << vaddrbits bytes.
+ * Return NULL if vaddrbits is out of range or allocation fails.
+ */
+memory_t mem_create(int vaddrbits)
+{
+    if (vaddrbits < MINVADDRBITS || vaddrbits > MAXVADDRBITS)
+    {
+        return NULL;
     }
+    memory_t memory = calloc(1, sizeof(struct memory));
     if (memory == NULL)
     {
-        return false;
+        return NULL;
     }
-    if (phdr.p_vaddr > MEMSIZE || phdr.p_vaddr < 0)
+    memory->vaddrbits = vaddrbits;
+    memory->size = (address_t)1 << vaddrbits;
+    // one spare page for accesses straddling the end of the space
+    memory->npages = (memory->size >> PAGEBITS) + 1;
+    memory->limit = memory->npages << PAGEBITS;
+    memory->pages = calloc(memory->npages, sizeof(uint8_t *));
+    if (memory->pages == NULL)
     {
-        return false;
+        free(memory);
+        return NULL;
     }
-    if (phdr.p_vaddr + phdr.p_filesz > MEMSIZE)
+    return memory;
+}
+//=======================================================================
+/*
+ * Append page to list. Return false if out of memory.
+ */
+bool page_list_add(page_list_t *list, uint64_t page)
+{
+    if (list->count == list->cap)
     {
-        return false;
+        uint64_t cap = list->cap ? list->cap * 2 : 16;
+        uint64_t *pages = realloc(list->pages, cap * sizeof(uint64_t));
+        if (pages == NULL)
+        {
+            return false;
+        }
+        list->pages = pages;
+        list->cap = cap;
     }
-
-    if (fseek(file, phdr.p_offset, SEEK_SET) == 0)
+    list->pages[list->count++] = page;
+    return true;
+}
+//=======================================================================
+/*
+ * Release every page so memory reads as all zeroes again. Only the
+ * pages in use are visited. Watchpoints stay armed.
+ */
+void mem_clear(memory_t memory)
+{
+    if (memory == NULL)
     {
-        fread(memory + phdr.p_vaddr, phdr.p_filesz, 1, file);
-        return true;
+        return;
     }
-    else
+    mem_dirty_reset(memory);
+    for (uint64_t i = 0; i < memory->used.count; i++)
+    {
+        free(memory->pages[memory->used.pages[i]]);
+        memory->pages[memory->used.pages[i]] = NULL;
+    }
+    memory->used.count = 0;
+    decode_cache_clear(memory);
+}
+//=======================================================================
+/*
+ * Release memory and everything attached to it.
+ */
+void mem_free(memory_t memory)
+{
+    if (memory == NULL)
+    {
+        return;
+    }
+    mem_clear(memory);
+    decode_cache_free(memory);
+    mem_watch_clear(memory);
+    free(memory->dirty);
+    free(memory->used.pages);
+    free(memory->watched.pages);
+    free(memory->pages);
+    free(memory);
+}
+//=======================================================================
+/*
+ * Return the page holding addr, allocating a zeroed one if needed.
+ * Return NULL if addr is outside the page table or allocation fails.
+ */
+uint8_t *mem_alloc_page(memory_t memory, address_t addr)
+{
+    if (addr >= memory->limit)
+    {
+        return NULL;
+    }
+    uint8_t **page = &memory->pages[addr >> PAGEBITS];
+    if (*page == NULL)
+    {
+        *page = calloc(PAGESIZE, 1);
+        if (*page != NULL && !page_list_add(&memory->used, addr >> PAGEBITS))
+        {
+            free(*page);
+            *page = NULL;
+        }
+    }
+    return *page;
+}
+//=======================================================================
+/*
+ * Copy len bytes starting at addr into buf.
+ */
+void mem_read(memory_t memory, address_t addr, void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    for (size_t i = 0; i < len; i++)
+    {
+        out[i] = mem_read8(memory, addr + i);
+    }
+}
+//=======================================================================
+/*
+ * Copy len bytes from buf to memory starting at addr. Bytes beyond the
+ * page table are dropped.
+ */
+void mem_write(memory_t memory, address_t addr, const void *buf, size_t len)
+{
+    const uint8_t *in = buf;
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t *page = mem_alloc_page(memory, addr + i);
+        if (page != NULL)
+        {
+            page[(addr + i) & PAGEMASK] = in[i];
+        }
+    }
+}
+//=======================================================================
+/*
+ * Watch the len bytes at addr: stores touching them set watch_hit.
+ * Return false if the range is outside the address space or out of
+ * memory.
+ */
+bool mem_watch(memory_t memory, address_t addr, uint64_t len)
+{
+    if (addr > memory->size || len > memory->size - addr)
     {
         return false;
     }
+    if (memory->watch == NULL)
+    {
+        memory->watch = calloc(memory->npages, sizeof(uint64_t *));
+        if (memory->watch == NULL)
+        {
+            return false;
+        }
+        memory->store_hooks = true;
+    }
+    for (address_t a = addr; a < addr + len; a++)
+    {
+        uint64_t **page = &memory->watch[a >> PAGEBITS];
+        if (*page == NULL)
+        {
+            *page = calloc(PAGESIZE / 64, sizeof(uint64_t));
+            if (*page == NULL || !page_list_add(&memory->watched, a >> PAGEBITS))
+            {
+                free(*page);
+                *page = NULL;
+                return false;
+            }
+        }
+        (*page)[(a & PAGEMASK) >> 6] |= (uint64_t)1 << (a & 63);
+    }
+    return true;
 }
 //=======================================================================
 /*
- * Dump the contents of memory from start to end.
- * If start is 0x0, then the first line should be "Contents of memory from 0000 to end:"
- * If end is MEMSIZE, then the last line should be "Contents of memory from start to ffff:"
- * If both start and end are 0x0, then the first line should be "Contents of memory:"
+ * Stop watching anything.
  */
-void dump_memory(memory_t memory, uint16_t start, uint16_t end)
+void mem_watch_clear(memory_t memory)
 {
-    printf("Contents of memory from %04x to %04x:\n", start, end);
-    for (int i = start; i < end; i++)
+    if (memory->watch == NULL)
     {
-        if ((i - start) % 16 == 0)
+        return;
+    }
+    for (uint64_t i = 0; i < memory->watched.count; i++)
+    {
+        free(memory->watch[memory->watched.pages[i]]);
+    }
+    memory->watched.count = 0;
+    free(memory->watch);
+    memory->watch = NULL;
+    memory->store_hooks = memory->dirty != NULL;
+    memory->watch_hit = false;
+}
+//=======================================================================
+/*
+ * Look up the bytes of a store in the watch bitmaps of their pages,
+ * skipping pages without any.
+ */
+void mem_watch_check(memory_t memory, address_t addr, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        address_t a = addr + i;
+        uint64_t *page = a < memory->limit ? memory->watch[a >> PAGEBITS] : NULL;
+        if (page != NULL && (page[(a & PAGEMASK) >> 6] >> (a & 63) & 1))
         {
-            printf("  %04x ", i);
+            if (!memory->watch_hit)
+            {
+                memory->watch_hit = true;
+                memory->watch_addr = a;
+            }
+            return;
         }
-        if ((i - start) % 8 == 0)
+    }
+}
+//=======================================================================
+/*
+ * Start recording which lines stores write, see mem_note_store().
+ * Return false if out of memory.
+ */
+bool mem_track_dirty(memory_t memory)
+{
+    if (memory->dirty == NULL)
+    {
+        memory->dirty = calloc(memory->npages, sizeof(uint64_t *));
+    }
+    memory->store_hooks = memory->store_hooks || memory->dirty != NULL;
+    return memory->dirty != NULL;
+}
+//=======================================================================
+/*
+ * The slow half of mem_note_store(), for a store while watchpoints or
+ * dirty tracking are on.
+ */
+void mem_store_hooks(memory_t memory, address_t addr, size_t len)
+{
+    if (memory->dirty != NULL)
+    {
+        mem_mark_dirty(memory, addr, len);
+    }
+    if (memory->watch != NULL)
+    {
+        mem_watch_check(memory, addr, len);
+    }
+}
+//=======================================================================
+/*
+ * Mark the lines holding the len bytes at addr as written. A page gets
+ * its bitmap with the first store to it; pages never allocated have
+ * nothing written, which keeps the bitmaps within the used pages.
+ */
+void mem_mark_dirty(memory_t memory, address_t addr, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    address_t last = (addr + len - 1) >> DIRTYLINEBITS;
+    for (address_t line = addr >> DIRTYLINEBITS; line <= last; line++)
+    {
+        address_t a = line << DIRTYLINEBITS;
+        if (a >= memory->limit)
         {
-            printf(" ");
+            break;
         }
-        printf("%02x", memory[i]);
-        if ((i - start) % 16 != 15)
+        uint64_t **page = &memory->dirty[a >> PAGEBITS];
+        if (*page == NULL && memory->pages[a >> PAGEBITS] != NULL)
         {
-            printf(" ");
+            *page = calloc(PAGESIZE >> DIRTYLINEBITS >> 6, sizeof(uint64_t));
         }
-        if ((i - start) % 16 == 15)
+        if (*page == NULL)
         {
-            printf("\n");
+            continue;
         }
+        (*page)[(a & PAGEMASK) >> DIRTYLINEBITS >> 6] |= (uint64_t)1 << (line & 63);
     }
-    if (end != MEMSIZE || start == 0x0)
+}
+//=======================================================================
+/*
+ * Forget the lines written so far, tracking goes on. Bitmaps only exist
+ * for used pages, so only those are visited.
+ */
+void mem_dirty_reset(memory_t memory)
+{
+    if (memory->dirty == NULL)
     {
-        printf("\n");
+        return;
+    }
+    for (uint64_t i = 0; i < memory->used.count; i++)
+    {
+        free(memory->dirty[memory->used.pages[i]]);
+        memory->dirty[memory->used.pages[i]] = NULL;
+    }
+}
+//=======================================================================
+/*
+ * Dump only the lines written since tracking started or was last reset,
+ * each run of adjacent lines as dump_memory() shows it, and count them.
+ * Pages without a written line are skipped whole.
+ */
+void dump_dirty(memory_t memory)
+{
+    address_t size = mem_size(memory);
+    uint64_t lines = 0;
+    uint64_t pages = 0;
+    address_t run = size;   // start of the run being collected, size if none
+    for (uint64_t p = 0; (p << PAGEBITS) < size; p++)
+    {
+        uint64_t *bits = memory->dirty != NULL ? memory->dirty[p] : NULL;
+        bool any = false;
+        for (int i = 0; i < PAGESIZE >> DIRTYLINEBITS; i++)
+        {
+            address_t a = (p << PAGEBITS) + ((address_t)i << DIRTYLINEBITS);
+            if (bits != NULL && (bits[i >> 6] >> (i & 63) & 1))
+            {
+                lines++;
+                any = true;
+                run = run == size ? a : run;
+            }
+            else if (run != size)
+            {
+                dump_memory(memory, run, a);
+                run = size;
+            }
+            else if (bits == NULL)
+            {
+                break;
+            }
+        }
+        pages += any;
+    }
+    if (run != size)
+    {
+        dump_memory(memory, run, size);
     }
+    printf("Changed: %lu lines of %d bytes in %lu pages\n\n", lines,
+           1 << DIRTYLINEBITS, pages);
 }
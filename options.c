@@ -0,0 +1,304 @@
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/options.h"
+#include "./headers/predict.h"
+#include "./headers/y86.h"
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_options()
+{
+    printf("Usage: y86 <option(s)> mini-elf-file\n");
+    printf(" Options are:\n");
+    printf("  -h      Display usage\n");
+    printf("  -H      Show the Mini-ELF header\n");
+    printf("  -a      Show all with brief memory\n");
+    printf("  -f      Show all with full memory\n");
+    printf("  -s      Show the program headers\n");
+    printf("  -m      Show the memory contents (brief)\n");
+    printf("  -M      Show the memory contents (full)\n");
+    printf("  -i      Memory dumps (-M, -e, -E) show only the 16-byte lines changed\n");
+    printf("          since load or the last checkpoint\n");
+    printf("  -d      Disassemble code contents\n");
+    printf("  -D      Disassemble data contents\n");
+    printf("  -e      Execute program\n");
+    printf("  -E      Execute program (debug trace mode)\n");
+    printf("  -t      Execute program (threaded-code engine), not with -EpPBSwWi\n");
+    printf("  -J      Execute program (x86-64 JIT), not with -EpPBSwWi\n");
+    printf("  -p      Execute program and print an execution profile\n");
+    printf("  -P      Execute program and print cycles on the PIPE pipeline\n");
+    printf("  -B pred Execute program and print branch prediction statistics,\n");
+    printf("          pred is taken, btfn, 2bit or gshare (with -P, time with it)\n");
+    printf("  -q      Execute program quietly (no memory write trace)\n");
+    printf("  -T file Execute program (debug trace mode), binary trace to file\n");
+    printf("  -S file Execute program, write a checkpoint to file on SIGUSR1\n");
+    printf("  -C n    With -S, also write the checkpoint after n instructions\n");
+    printf("  -R file Start execution from the checkpoint in file\n");
+    printf("  -g port Debug with gdb: serve it on a TCP port or Unix socket path\n");
+    printf("  -w a,n  Execute program, report every store to the n bytes at a (not with -E)\n");
+    printf("  -W a,n  Execute program, stop at the first store to the n bytes at a (not with -E)\n");
+    printf("  -A bits Address space size in bits (%d-%d, default %d)\n",
+           MINVADDRBITS, MAXVADDRBITS, VADDRBITS);
+    printf("  -b      Batch: execute every file, directory or @manifest given\n");
+    printf("  -j n    Batch with n worker threads (0 for one per cpu)\n");
+    printf("  -L n    Batch, stopping each image after n instructions\n");
+    printf("Options must not be repeated neither explicitly nor implicitly.\n");
+}
+
+//=======================================================================
+/*
+ * parse_command_line() - parse command line arguments into opts
+ *
+ * Accepts the original -hHafsmMdDeE switches plus the ones added
+ * since. Returns true if the arguments are valid, false otherwise.
+ */
+bool parse_command_line(int argc, char **argv, y86_options_t *opts)
+{
+    // check for passed in null values
+    if (argc <= 1 || argv == NULL || opts == NULL)
+    {
+        usage_options();
+        return false;
+    }
+
+    memset(opts, 0, sizeof(*opts));
+    opts->vaddrbits = VADDRBITS;
+    opts->jobs = 1;
+    opts->predictor = -1;
+    char *optionStr = "+hHafsmMiDdeEtJpPqbj:L:T:A:B:S:C:R:g:w:W:";
+    int opt;
+    opterr = 0;
+    bool printHelp = false;
+
+    // loop through commmand line arguements
+    while ((opt = getopt(argc, argv, optionStr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            printHelp = true;
+            break;
+        case 'H':
+            opts->header = true;
+            break;
+        case 'm':
+            opts->membrief = true;
+            break;
+        case 'M':
+            opts->memfull = true;
+            break;
+        case 'i':
+            opts->memdiff = true;
+            break;
+        case 's':
+            opts->segments = true;
+            break;
+        case 'a':
+            opts->header = true;
+            opts->membrief = true;
+            opts->segments = true;
+            break;
+        case 'f':
+            opts->header = true;
+            opts->memfull = true;
+            opts->segments = true;
+            break;
+        case 'd':
+            opts->disas_code = true;
+            break;
+        case 'D':
+            opts->disas_data = true;
+            break;
+        case 'E':
+            opts->exec_debug = true;
+            break;
+        case 'e':
+            opts->exec_normal = true;
+            break;
+        case 't':
+            // same output as -e, different engine
+            opts->exec_normal = true;
+            opts->threaded = true;
+            break;
+        case 'J':
+            // same output as -e, native code where possible
+            opts->exec_normal = true;
+            opts->jit = true;
+            break;
+        case 'p':
+            // the profiler sees each instruction, so -e's own loop runs
+            opts->exec_normal = true;
+            opts->profile = true;
+            break;
+        case 'P':
+            // timed per instruction as well
+            opts->exec_normal = true;
+            opts->pipeline = true;
+            break;
+        case 'B':
+            opts->exec_normal = true;
+            opts->predictor = predictor_kind(optarg);
+            if (opts->predictor < 0)
+            {
+                usage_options();
+                return false;
+            }
+            break;
+        case 'q':
+            // benchmark mode: execute, but skip the per-store output
+            opts->exec_normal = true;
+            opts->quiet = true;
+            break;
+        case 'b':
+            // many images per process, see batch.h
+            opts->batch = true;
+            break;
+        case 'j':
+        {
+            char *end;
+            opts->batch = true;
+            long jobs = strtol(optarg, &end, 0);
+            if (*end != '\0' || end == optarg || jobs < 0 || jobs > INT_MAX)
+            {
+                usage_options();
+                return false;
+            }
+            opts->jobs = jobs;
+            break;
+        }
+        case 'L':
+        {
+            char *end;
+            opts->batch = true;
+            opts->step_limit = strtoull(optarg, &end, 0);
+            if (*end != '\0' || opts->step_limit == 0 || optarg[0] == '-')
+            {
+                usage_options();
+                return false;
+            }
+            break;
+        }
+        case 'T':
+            // render later with y86-trace
+            opts->exec_debug = true;
+            opts->trace_file = optarg;
+            break;
+        case 'S':
+            // checkpoints are taken between two steps of the -e loop
+            opts->exec_normal = true;
+            opts->snapshot_file = optarg;
+            break;
+        case 'C':
+        {
+            char *end;
+            opts->snapshot_at = strtoull(optarg, &end, 0);
+            if (*end != '\0' || opts->snapshot_at == 0 || optarg[0] == '-')
+            {
+                usage_options();
+                return false;
+            }
+            break;
+        }
+        case 'R':
+            opts->restore_file = optarg;
+            break;
+        case 'g':
+            // gdb drives execution, see gdbstub.h
+            opts->gdb = optarg;
+            break;
+        case 'w':
+        case 'W':
+        {
+            // stores are checked in the -e loop's store path
+            char *end;
+            opts->exec_normal = true;
+            opts->watch = true;
+            opts->watch_stop = opt == 'W';
+            opts->watch_addr = strtoull(optarg, &end, 0);
+            opts->watch_len = *end == ',' ? strtoull(end + 1, &end, 0) : 8;
+            if (*end != '\0' || opts->watch_len == 0)
+            {
+                usage_options();
+                return false;
+            }
+            break;
+        }
+        case 'A':
+        {
+            char *end;
+            long bits = strtol(optarg, &end, 0);
+            if (*end != '\0' || bits < MINVADDRBITS || bits > MAXVADDRBITS)
+            {
+                usage_options();
+                return false;
+            }
+            opts->vaddrbits = bits;
+            break;
+        }
+        default:
+            usage_options();
+            return false;
+        }
+    }
+    if (opts->watch && opts->exec_debug)
+    {
+        // the -E loop has no store watch
+        fprintf(stderr, "-w and -W cannot be combined with -E or -T\n");
+        usage_options();
+        return false;
+    }
+    if (opts->exec_normal && opts->exec_debug)
+    {
+        opts->exec_normal = false;
+    }
+    if (opts->snapshot_at != 0 && opts->snapshot_file == NULL)
+    {
+        usage_options();
+        return false;
+    }
+    if ((opts->threaded || opts->jit) &&
+        (!opts->exec_normal || opts->profile || opts->pipeline ||
+         opts->predictor >= 0 || opts->snapshot_file != NULL || opts->watch ||
+         opts->memdiff))
+    {
+        // only the -e loop can be traced, profiled, timed, checkpointed,
+        // watched or have its stores tracked
+        fprintf(stderr, "-t and -J cannot be combined with -E, -p, -P, -B, -S, -w, -W or -i\n");
+        usage_options();
+        return false;
+    }
+    // checks if the help command was found and returns true
+    if (printHelp)
+    {
+        opts->header = false;
+        usage_options();
+        return true;
+    }
+    else if (opts->membrief && opts->memfull)
+    {
+        // checks if both the memory full and memory brief
+        // commands were found and returns false as this is invalid
+        usage_options();
+        return false;
+    }
+    else
+    {
+        // sets the last command arg to the file char array
+        opts->file = argv[optind];
+        opts->files = &argv[optind];
+        opts->nfiles = argc - optind;
+        if (opts->file == NULL || (argc > optind + 1 && !opts->batch))
+        {
+            // prints usage and returns false if no file name was given
+            usage_options();
+            return false;
+        }
+
+        return true;
+    }
+}
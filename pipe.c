@@ -0,0 +1,214 @@
+/*
+ * Cycle model of the five-stage PIPE processor (-P).
+ *
+ * The simulator itself executes sequentially; this module replays the
+ * executed instructions through the hazard logic of PIPE to count the
+ * cycles the pipelined processor would take. Only the E, M and W
+ * pipeline registers matter for that: an instruction in decode reads
+ * its operands from them or from the register file, stalls one cycle
+ * when the instruction in execute loads one of them, and bubbles enter
+ * behind a ret or a mispredicted jump. Results are the same as running
+ * PIPE cycle by cycle, at the cost of a few compares per instruction.
+ *
+ * Self-modifying code is timed as if the pipeline saw every store
+ * before fetching, which PIPE does not guarantee.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "./headers/pipe.h"
+
+static const char *fwd_names[] = {
+    "e_valE", "m_valM", "M_valE", "W_valM", "W_valE", "register file"
+};
+
+static const pipe_reg_t bubble = { NOP, BADREG, BADREG };
+
+//=======================================================================
+/*
+ * Set up an empty pipeline. Jumps and rets are predicted by pred if it
+ * is not NULL.
+ */
+void pipe_init(pipe_t *pipe, predictor_t *pred)
+{
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->pred = pred;
+    pipe->e = pipe->m = pipe->w = bubble;
+}
+
+//=======================================================================
+/*
+ * One clock: the pipeline registers move one stage on and in enters E.
+ */
+static inline void advance(pipe_t *pipe, pipe_reg_t in)
+{
+    pipe->w = pipe->m;
+    pipe->m = pipe->e;
+    pipe->e = in;
+    pipe->cycles++;
+}
+
+//=======================================================================
+/*
+ * Count where decode takes register src from, with PIPE's priorities.
+ */
+static inline void forward(pipe_t *pipe, uint8_t src)
+{
+    if (src == BADREG)
+    {
+        return;
+    }
+    pipe_fwd_t from = src == pipe->e.dstE   ? FWD_E_VALE
+                      : src == pipe->m.dstM ? FWD_M_VALM
+                      : src == pipe->m.dstE ? FWD_M_VALE
+                      : src == pipe->w.dstM ? FWD_W_VALM
+                      : src == pipe->w.dstE ? FWD_W_VALE
+                                            : FWD_REGFILE;
+    pipe->fwd[from]++;
+}
+
+//=======================================================================
+/*
+ * Time the instruction ins, fetched from pc, that just executed. cond
+ * is the condition decode_execute() computed, cpu the state after it.
+ */
+void pipe_step(pipe_t *pipe, address_t pc, const y86_inst_t *ins,
+               bool cond, const y86_t *cpu)
+{
+    uint8_t srcA = BADREG, srcB = BADREG;
+    pipe_reg_t out = { ins->type, BADREG, BADREG };
+    uint8_t ra = ins->ra & 0xF, rb = ins->rb & 0xF;
+
+    switch (ins->type)
+    {
+    case CMOV:
+        srcA = ra;
+        out.dstE = cond ? rb : BADREG;
+        break;
+    case IRMOVQ:
+        out.dstE = rb;
+        break;
+    case RMMOVQ:
+        srcA = ra;
+        srcB = rb;
+        break;
+    case MRMOVQ:
+        srcB = rb;
+        out.dstM = ra;
+        break;
+    case OPQ:
+        srcA = ra;
+        srcB = rb;
+        out.dstE = rb;
+        break;
+    case CALL:
+        srcB = RSP;
+        out.dstE = RSP;
+        break;
+    case RET:
+        srcA = RSP;
+        srcB = RSP;
+        out.dstE = RSP;
+        break;
+    case PUSHQ:
+        srcA = ra;
+        srcB = RSP;
+        out.dstE = RSP;
+        break;
+    case POPQ:
+        srcA = RSP;
+        srcB = RSP;
+        out.dstE = RSP;
+        out.dstM = ra;
+        break;
+    default:
+        break;
+    }
+
+    // load/use: hold in decode while a bubble goes into execute, the
+    // loaded value is then forwarded from memory
+    if ((pipe->e.type == MRMOVQ || pipe->e.type == POPQ) && pipe->e.dstM != BADREG &&
+        (pipe->e.dstM == srcA || pipe->e.dstM == srcB))
+    {
+        pipe->load_use++;
+        advance(pipe, bubble);
+    }
+
+    forward(pipe, srcA);
+    forward(pipe, srcB);
+    pipe->instructions++;
+    advance(pipe, out);
+
+    // the predictor learns from every outcome, PIPE's own guesses are
+    // taken for jumps and nothing for ret
+    bool hit = pipe->pred != NULL ? predictor_step(pipe->pred, pc, ins, cond, cpu)
+               : ins->type == JUMP ? cond
+                                   : ins->type != RET;
+    if (cpu->stat != AOK)
+    {
+        // nothing is fetched behind the instruction that stopped the CPU
+        return;
+    }
+    if (ins->type == RET)
+    {
+        pipe->rets++;
+        if (!hit)
+        {
+            pipe->ret_misses++;
+            for (int i = 0; i < PIPE_RET_BUBBLES; i++)
+            {
+                advance(pipe, bubble);
+            }
+        }
+    }
+    else if (ins->type == JUMP && ins->jump != JMP)
+    {
+        pipe->branches++;
+        if (!hit)
+        {
+            pipe->mispredicts++;
+            for (int i = 0; i < PIPE_MISPREDICT_BUBBLES; i++)
+            {
+                advance(pipe, bubble);
+            }
+        }
+    }
+}
+
+//=======================================================================
+/*
+ * Cycles from the first fetch until the last instruction is written
+ * back.
+ */
+uint64_t pipe_cycles(const pipe_t *pipe)
+{
+    return pipe->instructions ? pipe->cycles + PIPE_FILL_DRAIN : 0;
+}
+
+//=======================================================================
+/*
+ * Print cycles, CPI and where the cycles beyond one per instruction
+ * went, then how decode got its operands.
+ */
+void pipe_report(const pipe_t *pipe)
+{
+    uint64_t cycles = pipe_cycles(pipe);
+    double insts = pipe->instructions ? pipe->instructions : 1;
+
+    printf("Pipeline (PIPE): %lu cycles, %lu instructions, CPI %.3f\n",
+           cycles, pipe->instructions, cycles / insts);
+    printf("  %-22s %12lu\n", "instructions", pipe->instructions);
+    printf("  %-22s %12lu\n", "load/use stalls", pipe->load_use);
+    printf("  %-22s %12lu  (%lu of %lu branches)\n", "mispredict bubbles",
+           pipe->mispredicts * PIPE_MISPREDICT_BUBBLES, pipe->mispredicts,
+           pipe->branches);
+    printf("  %-22s %12lu  (%lu of %lu rets)\n", "ret bubbles",
+           pipe->ret_misses * PIPE_RET_BUBBLES, pipe->ret_misses, pipe->rets);
+    printf("  %-22s %12d\n", "fill and drain", pipe->instructions ? PIPE_FILL_DRAIN : 0);
+    printf("Operands by source:\n");
+    for (int i = 0; i < FWD_SOURCES; i++)
+    {
+        printf("  %-22s %12lu\n", fwd_names[i], pipe->fwd[i]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,249 @@
+/*
+ * Branch predictors (-B).
+ *
+ * predictor_step() sees every executed instruction after the fact,
+ * predicts the conditional jumps and rets among them the way the chosen
+ * model would have before fetching on, and learns the real outcome.
+ * The predictor keeps aggregate and per jump counts; the PIPE model
+ * (pipe.c) charges its bubbles after the predictions when one is
+ * attached.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/pipe.h"
+#include "./headers/predict.h"
+
+#define TABLE_MASK ((1 << PRED_TABLE_BITS) - 1)
+#define RAS_MASK (PRED_RAS_DEPTH - 1)
+
+static const char *kind_names[] = { "taken", "btfn", "2bit", "gshare" };
+
+//=======================================================================
+/*
+ * The predictor called name on the command line, -1 if there is none.
+ */
+int predictor_kind(const char *name)
+{
+    for (int i = 0; i < PRED_KINDS; i++)
+    {
+        if (strcmp(name, kind_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//=======================================================================
+/*
+ * Set up pred as a fresh predictor of the given kind. Return false if
+ * out of memory.
+ */
+bool predictor_init(predictor_t *pred, pred_kind_t kind)
+{
+    memset(pred, 0, sizeof(*pred));
+    pred->kind = kind;
+    // weakly taken: loops predict right from their second iteration
+    memset(pred->counters, 2, sizeof(pred->counters));
+    pred->table_cap = 64;
+    pred->table = calloc(pred->table_cap, sizeof(pred_branch_t));
+    return pred->table != NULL;
+}
+
+//=======================================================================
+/*
+ * Statistics slot of the jump at pc, NULL if out of memory.
+ */
+static pred_branch_t *branch_slot(predictor_t *pred, address_t pc)
+{
+    if (2 * (pred->nbranches + 1) > pred->table_cap)
+    {
+        int cap = pred->table_cap * 2;
+        pred_branch_t *table = calloc(cap, sizeof(pred_branch_t));
+        if (table == NULL)
+        {
+            return NULL;
+        }
+        for (int i = 0; i < pred->table_cap; i++)
+        {
+            if (pred->table[i].count != 0)
+            {
+                int j = (pred->table[i].pc * 0x9E3779B1u) & (cap - 1);
+                while (table[j].count != 0)
+                {
+                    j = (j + 1) & (cap - 1);
+                }
+                table[j] = pred->table[i];
+            }
+        }
+        free(pred->table);
+        pred->table = table;
+        pred->table_cap = cap;
+    }
+    int i = (pc * 0x9E3779B1u) & (pred->table_cap - 1);
+    while (pred->table[i].count != 0 && pred->table[i].pc != pc)
+    {
+        i = (i + 1) & (pred->table_cap - 1);
+    }
+    if (pred->table[i].count == 0)
+    {
+        pred->table[i].pc = pc;
+        pred->nbranches++;
+    }
+    return &pred->table[i];
+}
+
+//=======================================================================
+/*
+ * Predict the conditional jump ins at pc, then learn that it went the
+ * way taken says. Return whether the prediction was right.
+ */
+static bool predict_jump(predictor_t *pred, address_t pc,
+                         const y86_inst_t *ins, bool taken)
+{
+    bool guess = true;
+    uint8_t *counter = NULL;
+    switch (pred->kind)
+    {
+    case PRED_TAKEN:
+        break;
+    case PRED_BTFN:
+        guess = ins->dest <= pc;
+        break;
+    case PRED_BIMODAL:
+        counter = &pred->counters[pc & TABLE_MASK];
+        break;
+    case PRED_GSHARE:
+        counter = &pred->counters[(pc ^ pred->history) & TABLE_MASK];
+        break;
+    default:
+        break;
+    }
+    if (counter != NULL)
+    {
+        guess = *counter >= 2;
+        if (taken && *counter < 3)
+        {
+            (*counter)++;
+        }
+        else if (!taken && *counter > 0)
+        {
+            (*counter)--;
+        }
+    }
+    pred->history = (pred->history << 1 | taken) & TABLE_MASK;
+    return guess == taken;
+}
+
+//=======================================================================
+/*
+ * Account for the instruction ins, fetched from pc, that just executed.
+ * cond is the condition decode_execute() computed, cpu the state after
+ * it. Return false if the predictor would have fetched the wrong next
+ * instruction.
+ */
+bool predictor_step(predictor_t *pred, address_t pc, const y86_inst_t *ins,
+                    bool cond, const y86_t *cpu)
+{
+    if (ins->type == JUMP && ins->jump != JMP)
+    {
+        bool hit = predict_jump(pred, pc, ins, cond);
+        pred->branches++;
+        pred->mispredicts += !hit;
+        pred_branch_t *branch = branch_slot(pred, pc);
+        if (branch != NULL)
+        {
+            branch->count++;
+            branch->taken += cond;
+            branch->mispredicts += !hit;
+        }
+        return hit;
+    }
+    if (ins->type == CALL)
+    {
+        pred->ras[pred->ras_top++ & RAS_MASK] = pc + ins->size;
+        if (pred->ras_count < PRED_RAS_DEPTH)
+        {
+            pred->ras_count++;
+        }
+    }
+    else if (ins->type == RET)
+    {
+        bool hit = false;
+        if (pred->ras_count > 0)
+        {
+            pred->ras_count--;
+            hit = pred->ras[--pred->ras_top & RAS_MASK] == cpu->pc;
+        }
+        pred->rets++;
+        pred->ret_misses += !hit;
+        return hit;
+    }
+    return true;
+}
+
+//=======================================================================
+static int compare_mispredicts(const void *a, const void *b)
+{
+    const pred_branch_t *ba = a, *bb = b;
+    if (ba->mispredicts != bb->mispredicts)
+    {
+        return ba->mispredicts < bb->mispredicts ? 1 : -1;
+    }
+    return ba->pc < bb->pc ? -1 : ba->pc > bb->pc;
+}
+
+//=======================================================================
+/*
+ * Print the misprediction rates, the bubbles they cost PIPE and every
+ * conditional jump, the worst predicted first.
+ */
+void predictor_report(const predictor_t *pred)
+{
+    double branches = pred->branches ? pred->branches : 1;
+    double rets = pred->rets ? pred->rets : 1;
+
+    printf("Branch prediction (%s, %d entry return stack):\n",
+           kind_names[pred->kind], PRED_RAS_DEPTH);
+    printf("  %-22s %12lu  mispredicted %12lu %7.2f%%\n", "conditional jumps",
+           pred->branches, pred->mispredicts, 100.0 * pred->mispredicts / branches);
+    printf("  %-22s %12lu  mispredicted %12lu %7.2f%%\n", "returns",
+           pred->rets, pred->ret_misses, 100.0 * pred->ret_misses / rets);
+    printf("  %-22s %12lu\n", "penalty cycles",
+           pred->mispredicts * PIPE_MISPREDICT_BUBBLES +
+           pred->ret_misses * PIPE_RET_BUBBLES);
+    printf("\n");
+
+    printf("Conditional jumps by mispredictions:\n");
+    printf("  %-7s%12s %8s %21s\n", "address", "count", "taken", "mispredicted");
+    pred_branch_t *sorted = malloc(pred->nbranches * sizeof(pred_branch_t));
+    if (sorted != NULL)
+    {
+        int n = 0;
+        for (int i = 0; i < pred->table_cap; i++)
+        {
+            if (pred->table[i].count != 0)
+            {
+                sorted[n++] = pred->table[i];
+            }
+        }
+        qsort(sorted, n, sizeof(pred_branch_t), compare_mispredicts);
+        for (int i = 0; i < n; i++)
+        {
+            printf("  0x%04lx %12lu %7.2f%% %12lu %7.2f%%\n", sorted[i].pc,
+                   sorted[i].count, 100.0 * sorted[i].taken / sorted[i].count,
+                   sorted[i].mispredicts, 100.0 * sorted[i].mispredicts / sorted[i].count);
+        }
+        free(sorted);
+    }
+    printf("\n");
+}
+
+//=======================================================================
+void predictor_free(predictor_t *pred)
+{
+    free(pred->table);
+    memset(pred, 0, sizeof(*pred));
+}
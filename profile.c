@@ -0,0 +1,363 @@
+/*
+ * Execution profiler (-p).
+ *
+ * The -e loop reports every executed instruction to profile_step(),
+ * which counts executions per address, per instruction class and, for
+ * conditional jumps, how often they were taken. A shadow call stack
+ * driven by call and ret attributes instructions to functions: each
+ * function's inclusive count covers everything executed from its entry
+ * to its ret, callees included. Recursive activations are counted once.
+ * Instructions are the unit of time, the simulator has no cycle model.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/profile.h"
+#include "./headers/disassemble.h"
+#include "./headers/mem-access.h"
+
+static const char *class_names[] = {
+    "halt", "nop", "cmovXX", "irmovq", "rmmovq", "mrmovq", "OPq", "jXX",
+    "call", "ret", "pushq", "popq", "invalid"
+};
+
+static const char *jump_names[] = {
+    "jmp", "jle", "jl", "je", "jne", "jge", "jg"
+};
+
+//=======================================================================
+/*
+ * Index of the function entered at addr, added on first use. -1 if out
+ * of memory.
+ */
+static int func_index(profile_t *prof, address_t addr)
+{
+    if (2 * (prof->nfuncs + 1) > prof->slots_cap)
+    {
+        int cap = prof->slots_cap * 2;
+        int *slots = calloc(cap, sizeof(int));
+        if (slots == NULL)
+        {
+            return -1;
+        }
+        for (int i = 0; i < prof->nfuncs; i++)
+        {
+            int j = (prof->funcs[i].addr * 0x9E3779B1u) & (cap - 1);
+            while (slots[j] != 0)
+            {
+                j = (j + 1) & (cap - 1);
+            }
+            slots[j] = i + 1;
+        }
+        free(prof->slots);
+        prof->slots = slots;
+        prof->slots_cap = cap;
+    }
+    int slot = (addr * 0x9E3779B1u) & (prof->slots_cap - 1);
+    while (prof->slots[slot] != 0)
+    {
+        if (prof->funcs[prof->slots[slot] - 1].addr == addr)
+        {
+            return prof->slots[slot] - 1;
+        }
+        slot = (slot + 1) & (prof->slots_cap - 1);
+    }
+    if (prof->nfuncs == prof->funcs_cap)
+    {
+        int cap = prof->funcs_cap ? prof->funcs_cap * 2 : 16;
+        profile_func_t *funcs = realloc(prof->funcs, cap * sizeof(profile_func_t));
+        if (funcs == NULL)
+        {
+            return -1;
+        }
+        prof->funcs = funcs;
+        prof->funcs_cap = cap;
+    }
+    profile_func_t *func = &prof->funcs[prof->nfuncs];
+    memset(func, 0, sizeof(*func));
+    func->addr = addr;
+    prof->slots[slot] = ++prof->nfuncs;
+    return prof->nfuncs - 1;
+}
+
+//=======================================================================
+/*
+ * Enter the function at addr.
+ */
+static void push_frame(profile_t *prof, address_t addr)
+{
+    int func = func_index(prof, addr);
+    if (func < 0)
+    {
+        return;
+    }
+    if (prof->depth == prof->stack_cap)
+    {
+        int cap = prof->stack_cap ? prof->stack_cap * 2 : 64;
+        profile_frame_t *stack = realloc(prof->stack, cap * sizeof(profile_frame_t));
+        if (stack == NULL)
+        {
+            return;
+        }
+        prof->stack = stack;
+        prof->stack_cap = cap;
+    }
+    prof->stack[prof->depth].func = func;
+    prof->stack[prof->depth].start = prof->total;
+    prof->depth++;
+    prof->funcs[func].calls++;
+    prof->funcs[func].active++;
+}
+
+//=======================================================================
+/*
+ * Leave the innermost function.
+ */
+static void pop_frame(profile_t *prof)
+{
+    profile_frame_t *frame = &prof->stack[--prof->depth];
+    profile_func_t *func = &prof->funcs[frame->func];
+    if (--func->active == 0)
+    {
+        func->inclusive += prof->total - frame->start;
+    }
+}
+
+//=======================================================================
+/*
+ * Set up an empty profile for memory, with the program entered at
+ * entry. The report names functions and labels the disassembly after
+ * syms (may be NULL), which must outlive the profile. Return false if
+ * out of memory.
+ */
+bool profile_init(profile_t *prof, memory_t memory, address_t entry,
+                  const symbol_index_t *syms)
+{
+    memset(prof, 0, sizeof(*prof));
+    prof->syms = syms;
+    prof->npages = memory->npages;
+    prof->pages = calloc(prof->npages, sizeof(profile_page_t *));
+    prof->slots_cap = 64;
+    prof->slots = calloc(prof->slots_cap, sizeof(int));
+    if (prof->pages == NULL || prof->slots == NULL)
+    {
+        return false;
+    }
+    push_frame(prof, entry);
+    return prof->depth == 1;
+}
+
+//=======================================================================
+/*
+ * Count the instruction ins, fetched from pc, that just executed. cond
+ * is the condition decode_execute() computed, cpu the state after it.
+ */
+void profile_step(profile_t *prof, address_t pc, const y86_inst_t *ins,
+                  bool cond, const y86_t *cpu)
+{
+    prof->total++;
+    prof->classes[ins->type <= INVALID ? ins->type : INVALID]++;
+
+    if ((pc >> PAGEBITS) < prof->npages)
+    {
+        profile_page_t **page = &prof->pages[pc >> PAGEBITS];
+        if (*page == NULL)
+        {
+            *page = calloc(1, sizeof(profile_page_t));
+        }
+        if (*page != NULL)
+        {
+            (*page)->count[pc & PAGEMASK]++;
+            if (ins->type == JUMP && cond)
+            {
+                (*page)->taken[pc & PAGEMASK]++;
+            }
+        }
+    }
+
+    if (ins->type == CALL && cpu->stat == AOK)
+    {
+        push_frame(prof, ins->dest);
+    }
+    else if (ins->type == RET && cpu->stat == AOK && prof->depth > 1)
+    {
+        // a ret without a matching call leaves the entry frame alone
+        pop_frame(prof);
+    }
+}
+
+//=======================================================================
+/*
+ * Executions of the instruction at pc, and how often it jumped.
+ */
+static uint64_t pc_count(const profile_t *prof, address_t pc, uint64_t *taken)
+{
+    profile_page_t *page = (pc >> PAGEBITS) < prof->npages ? prof->pages[pc >> PAGEBITS] : NULL;
+    if (page == NULL)
+    {
+        *taken = 0;
+        return 0;
+    }
+    *taken = page->taken[pc & PAGEMASK];
+    return page->count[pc & PAGEMASK];
+}
+
+//=======================================================================
+/*
+ * Name of the function at addr for the report.
+ */
+static const char *func_name(const profile_t *prof, address_t addr,
+                             bool entry, char *buf, size_t len)
+{
+    const elf_symbol_t *sym = symbol_at(prof->syms, addr, NULL);
+    if (sym != NULL)
+    {
+        return sym->name;
+    }
+    if (entry)
+    {
+        // the label disassemble_code() gives the entry point
+        return "_start";
+    }
+    snprintf(buf, len, "0x%04lx", addr);
+    return buf;
+}
+
+//=======================================================================
+static int compare_inclusive(const void *a, const void *b)
+{
+    const profile_func_t *fa = a, *fb = b;
+    if (fa->inclusive != fb->inclusive)
+    {
+        return fa->inclusive < fb->inclusive ? 1 : -1;
+    }
+    return fa->addr < fb->addr ? -1 : fa->addr > fb->addr;
+}
+
+//=======================================================================
+/*
+ * Count and taken columns in front of each disassembled line.
+ */
+static void annotate(address_t pc, const y86_inst_t *ins, void *arg)
+{
+    if (ins == NULL)
+    {
+        printf("%20s", "");
+        return;
+    }
+    uint64_t taken;
+    uint64_t count = pc_count(arg, pc, &taken);
+    printf("%12lu ", count);
+    if (ins->type == JUMP && ins->jump != JMP && count > 0)
+    {
+        printf("%6.1f%%", 100.0 * taken / count);
+    }
+    else
+    {
+        printf("%7s", "");
+    }
+}
+
+//=======================================================================
+/*
+ * Print the profile: instruction classes, conditional jumps, functions
+ * by inclusive instructions and the code annotated with counts. The
+ * disassembly shows memory as it is at the end of the run.
+ */
+void profile_report(profile_t *prof, memory_t memory,
+                    elf_hdr_t *hdr, elf_phdr_t phdr[])
+{
+    double total = prof->total ? prof->total : 1;
+
+    // close the activations still open when the program stopped
+    address_t entry = prof->funcs[0].addr;
+    while (prof->depth > 0)
+    {
+        pop_frame(prof);
+    }
+
+    printf("Profile: %lu instructions\n\n", prof->total);
+
+    printf("Instructions by class:\n");
+    for (int i = 0; i <= INVALID; i++)
+    {
+        if (prof->classes[i] != 0)
+        {
+            printf("  %-8s %12lu %7.2f%%\n", class_names[i], prof->classes[i],
+                   100.0 * prof->classes[i] / total);
+        }
+    }
+    printf("\n");
+
+    printf("Conditional jumps:\n");
+    printf("  address  jump        taken    not taken\n");
+    for (uint64_t p = 0; p < prof->npages; p++)
+    {
+        profile_page_t *page = prof->pages[p];
+        for (int i = 0; page != NULL && i < PAGESIZE; i++)
+        {
+            if (page->count[i] == 0)
+            {
+                continue;
+            }
+            y86_t scratch;
+            memset(&scratch, 0, sizeof(scratch));
+            scratch.stat = AOK;
+            scratch.memsize = mem_size(memory);
+            scratch.pc = (p << PAGEBITS) + i;
+            y86_inst_t ins = fetch(&scratch, memory);
+            if (ins.type == JUMP && ins.jump > JMP && ins.jump < BADJUMP)
+            {
+                printf("  0x%04lx   %-4s %12lu %12lu\n", (p << PAGEBITS) + i,
+                       jump_names[ins.jump], page->taken[i],
+                       page->count[i] - page->taken[i]);
+            }
+        }
+    }
+    printf("\n");
+
+    printf("Functions (inclusive instructions):\n");
+    printf("       instructions        %%        calls  function\n");
+    profile_func_t *funcs = malloc(prof->nfuncs * sizeof(profile_func_t));
+    if (funcs != NULL)
+    {
+        memcpy(funcs, prof->funcs, prof->nfuncs * sizeof(profile_func_t));
+        qsort(funcs, prof->nfuncs, sizeof(profile_func_t), compare_inclusive);
+        for (int i = 0; i < prof->nfuncs; i++)
+        {
+            char buf[24];
+            printf("  %17lu %7.2f%% %12lu  %s\n", funcs[i].inclusive,
+                   100.0 * funcs[i].inclusive / total, funcs[i].calls,
+                   func_name(prof, funcs[i].addr, funcs[i].addr == entry,
+                             buf, sizeof(buf)));
+        }
+        free(funcs);
+    }
+    printf("\n");
+
+    printf("Annotated disassembly:\n");
+    printf("%12s %7s\n", "count", "taken");
+    for (int i = 0; i < hdr->e_num_phdr; i++)
+    {
+        if (phdr[i].p_type == CODE)
+        {
+            disassemble_code_with(memory, &phdr[i], hdr, prof->syms, annotate, prof);
+            printf("\n");
+        }
+    }
+}
+
+//=======================================================================
+void profile_free(profile_t *prof)
+{
+    for (uint64_t i = 0; i < prof->npages; i++)
+    {
+        free(prof->pages[i]);
+    }
+    free(prof->pages);
+    free(prof->funcs);
+    free(prof->slots);
+    free(prof->stack);
+    memset(prof, 0, sizeof(*prof));
+}
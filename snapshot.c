@@ -0,0 +1,211 @@
+/*
+ * CPU and memory checkpoints (-S, -R).
+ *
+ * A checkpoint holds the registers, flags, pc, status and instruction
+ * count, then every memory page that is not all zeroes. Page contents
+ * start on a PAGESIZE boundary of the file, and restoring maps the
+ * file and copies each page straight into place, so even a large
+ * image comes back in a few page copies.
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/interpret.h"
+#include "./headers/loader.h"
+#include "./headers/mem-access.h"
+#include "./headers/snapshot.h"
+
+// set from the signal handler, see snapshot_on_signal()
+static volatile sig_atomic_t requested;
+
+//=======================================================================
+/*
+ * Offset of the first page in a checkpoint of npages pages.
+ */
+static uint64_t pages_offset(uint64_t npages)
+{
+    uint64_t end = sizeof(snapshot_hdr_t) + npages * sizeof(uint64_t);
+    return (end + PAGEMASK) & ~(uint64_t)PAGEMASK;
+}
+
+//=======================================================================
+/*
+ * Whether page holds anything but zeroes.
+ */
+static bool page_used(const uint8_t *page)
+{
+    static const uint8_t zero[PAGESIZE];
+    return page != NULL && memcmp(page, zero, PAGESIZE) != 0;
+}
+
+//=======================================================================
+static int compare_pages(const void *a, const void *b)
+{
+    uint64_t pa = *(const uint64_t *)a;
+    uint64_t pb = *(const uint64_t *)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+//=======================================================================
+/*
+ * Write the state of cpu and memory, after count instructions, to a
+ * checkpoint at path. The flags are settled first. Only the allocated
+ * pages are looked at, sorted for the index. Return false if the file
+ * cannot be written or the index cannot be allocated.
+ */
+bool snapshot_write(const char *path, y86_t *cpu, memory_t memory,
+                    uint64_t count)
+{
+    settle_flags(cpu);
+
+    snapshot_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.vaddrbits = memory->vaddrbits;
+    hdr.stat = cpu->stat;
+    hdr.zf = cpu->zf;
+    hdr.sf = cpu->sf;
+    hdr.of = cpu->of;
+    memcpy(hdr.regs, cpu->regs, sizeof(hdr.regs));
+    hdr.pc = cpu->pc;
+    hdr.count = count;
+
+    // the used list is in allocation order, the index is ascending
+    uint64_t *index = malloc((memory->used.count + 1) * sizeof(uint64_t));
+    if (index == NULL)
+    {
+        return false;
+    }
+    for (uint64_t i = 0; i < memory->used.count; i++)
+    {
+        uint64_t page = memory->used.pages[i];
+        if (page_used(memory->pages[page]))
+        {
+            index[hdr.npages++] = page;
+        }
+    }
+    qsort(index, hdr.npages, sizeof(uint64_t), compare_pages);
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        free(index);
+        return false;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1 &&
+              fwrite(index, sizeof(uint64_t), hdr.npages, out) == hdr.npages;
+    uint64_t pad = pages_offset(hdr.npages) - sizeof(hdr) - hdr.npages * sizeof(uint64_t);
+    for (uint64_t i = 0; ok && i < pad; i++)
+    {
+        ok = fputc(0, out) != EOF;
+    }
+    for (uint64_t i = 0; ok && i < hdr.npages; i++)
+    {
+        ok = fwrite(memory->pages[index[i]], PAGESIZE, 1, out) == 1;
+    }
+    free(index);
+    return fclose(out) == 0 && ok;
+}
+
+//=======================================================================
+/*
+ * Replace the state of cpu and memory with the checkpoint at path and
+ * set *count to the instructions executed before it was taken. memory
+ * must have the address space the checkpoint was written with. Return
+ * NULL on success, else the message to print; memory may then be
+ * partly restored.
+ */
+const char *snapshot_restore(const char *path, y86_t *cpu, memory_t memory,
+                             uint64_t *count)
+{
+    elf_image_t file;
+    if (!map_image(path, &file))
+    {
+        return "Failed to open Snapshot";
+    }
+    snapshot_hdr_t hdr;
+    if (file.len < sizeof(hdr))
+    {
+        unmap_image(&file);
+        return "Failed to Read Snapshot Header";
+    }
+    memcpy(&hdr, file.data, sizeof(hdr));
+    if (hdr.magic != SNAPSHOT_MAGIC || hdr.version != SNAPSHOT_VERSION ||
+        hdr.stat < AOK || hdr.stat > INS || hdr.npages > memory->npages ||
+        file.len < pages_offset(hdr.npages) + hdr.npages * PAGESIZE)
+    {
+        unmap_image(&file);
+        return "Failed to Read Snapshot Header";
+    }
+    if (hdr.vaddrbits != memory->vaddrbits)
+    {
+        unmap_image(&file);
+        return "Snapshot was taken with a different address space size";
+    }
+
+    mem_clear(memory);
+    const uint8_t *index = file.data + sizeof(hdr);
+    const uint8_t *pages = file.data + pages_offset(hdr.npages);
+    for (uint64_t i = 0; i < hdr.npages; i++)
+    {
+        uint64_t page;
+        memcpy(&page, index + i * sizeof(page), sizeof(page));
+        uint8_t *dest = page < memory->npages ? mem_alloc_page(memory, page << PAGEBITS) : NULL;
+        if (dest == NULL)
+        {
+            unmap_image(&file);
+            return "Failed to Load Snapshot Page";
+        }
+        memcpy(dest, pages + i * PAGESIZE, PAGESIZE);
+    }
+
+    memset(cpu, 0, sizeof(*cpu));
+    memcpy(cpu->regs, hdr.regs, sizeof(hdr.regs));
+    cpu->zf = hdr.zf;
+    cpu->sf = hdr.sf;
+    cpu->of = hdr.of;
+    cpu->pc = hdr.pc;
+    cpu->stat = hdr.stat;
+    cpu->memsize = mem_size(memory);
+    *count = hdr.count;
+    unmap_image(&file);
+    return NULL;
+}
+
+//=======================================================================
+static void catch_signal(int signo)
+{
+    requested = 1;
+}
+
+//=======================================================================
+/*
+ * Ask for a checkpoint whenever signo arrives, see snapshot_pending().
+ * Return false if the handler cannot be installed.
+ */
+bool snapshot_on_signal(int signo)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = catch_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(signo, &sa, NULL) == 0;
+}
+
+//=======================================================================
+/*
+ * Whether a checkpoint was asked for by signal since the last call.
+ */
+bool snapshot_pending()
+{
+    if (!requested)
+    {
+        return false;
+    }
+    requested = 0;
+    return true;
+}
@@ -0,0 +1,220 @@
+/*
+ * y86sim-test - exercise the embeddable simulator (headers/y86sim.h)
+ * on the calls test program, for make check.
+ *
+ *     y86sim-test calls.o
+ *
+ * Runs the program to completion, steps it, writes and reads memory and
+ * reverse steps over it all, checking each against a plain run. Prints
+ * one line per failed check and exits non-zero if there were any.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/y86sim.h"
+
+#define CALLS_COUNT 171       /* instructions calls.o executes */
+#define CALLS_HALT  0x11e     /* where it halts */
+#define CALLS_RET   0x173     /* fib's ret */
+#define CALLS_RAX   8         /* fib(5) as it counts */
+#define RECORD_MAX  (CALLS_COUNT + 1)
+
+static int failed;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+//=======================================================================
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok)
+    {
+        printf("FAIL: y86sim-test.c:%d: %s\n", line, what);
+        failed++;
+    }
+}
+
+/* Everything a step can change, to compare states. */
+typedef struct sim_state {
+    y86_t   cpu;
+    uint8_t mem[MEMSIZE];
+} sim_state_t;
+
+//=======================================================================
+/*
+ * Copy the state of sim into state.
+ */
+static void save_state(const y86sim_t *sim, sim_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    const y86_t *cpu = y86sim_cpu(sim);
+    memcpy(state->cpu.regs, cpu->regs, sizeof(cpu->regs));
+    state->cpu.pc = y86sim_pc(sim);
+    state->cpu.stat = y86sim_stat(sim);
+    bool zf, sf, of;
+    y86sim_flags(sim, &zf, &sf, &of);
+    state->cpu.zf = zf;
+    state->cpu.sf = sf;
+    state->cpu.of = of;
+    y86sim_read(sim, 0, state->mem, sizeof(state->mem));
+}
+
+//=======================================================================
+/*
+ * Whether sim is in the state saved in state.
+ */
+static bool same_state(const y86sim_t *sim, const sim_state_t *state)
+{
+    static sim_state_t now;
+    save_state(sim, &now);
+    return memcmp(&now, state, sizeof(now)) == 0;
+}
+
+//=======================================================================
+/*
+ * Run to completion, and in steps of varying size to the same end.
+ */
+static void test_run(const char *path)
+{
+    y86sim_t *sim = y86sim_create(VADDRBITS);
+    CHECK(sim != NULL && y86sim_load_file(sim, path));
+    CHECK(y86sim_run(sim) == CALLS_COUNT);
+    CHECK(y86sim_stat(sim) == HLT);
+    CHECK(y86sim_pc(sim) == CALLS_HALT);
+    CHECK(y86sim_reg(sim, 0) == CALLS_RAX);
+    CHECK(y86sim_count(sim) == CALLS_COUNT);
+    sim_state_t *end = malloc(sizeof(sim_state_t));
+    save_state(sim, end);
+
+    CHECK(y86sim_load_file(sim, path));
+    CHECK(y86sim_count(sim) == 0 && y86sim_stat(sim) == AOK);
+    uint64_t total = 0;
+    for (uint64_t n = 1; y86sim_stat(sim) == AOK; n++)
+    {
+        uint64_t done = y86sim_step(sim, n);
+        CHECK(done == n || y86sim_stat(sim) != AOK);
+        total += done;
+    }
+    CHECK(total == CALLS_COUNT && y86sim_count(sim) == CALLS_COUNT);
+    CHECK(same_state(sim, end));
+    CHECK(y86sim_step(sim, 1) == 0);
+    free(end);
+    y86sim_destroy(sim);
+}
+
+//=======================================================================
+/*
+ * Writes read back, within a page and across one, and the address space
+ * ends where y86sim_mem_size() says.
+ */
+static void test_write(const char *path)
+{
+    // two pages, so a write can cross from one to the other
+    y86sim_t *sim = y86sim_create(PAGEBITS + 1);
+    CHECK(sim != NULL && y86sim_load_file(sim, path));
+    address_t size = y86sim_mem_size(sim);
+    CHECK(size == 2 * PAGESIZE);
+
+    uint8_t out[32], in[32];
+    for (size_t i = 0; i < sizeof(out); i++)
+    {
+        out[i] = 0xa0 + i;
+    }
+    address_t addrs[] = { 0x800, PAGESIZE - 16, size - sizeof(out) };
+    for (size_t i = 0; i < sizeof(addrs) / sizeof(addrs[0]); i++)
+    {
+        memset(in, 0, sizeof(in));
+        CHECK(y86sim_write(sim, addrs[i], out, sizeof(out)));
+        CHECK(y86sim_read(sim, addrs[i], in, sizeof(in)));
+        CHECK(memcmp(in, out, sizeof(in)) == 0);
+    }
+    CHECK(!y86sim_write(sim, size - 4, out, 8));
+    CHECK(!y86sim_read(sim, size - 4, in, 8));
+    CHECK(!y86sim_write(sim, size + 1, out, 0));
+
+    // overwriting the first instruction's immediate changes what runs
+    uint64_t stack = 0x600;
+    CHECK(y86sim_write(sim, 0x102, &stack, sizeof(stack)));
+    CHECK(y86sim_step(sim, 1) == 1);
+    CHECK(y86sim_reg(sim, 4) == stack);
+    y86sim_destroy(sim);
+}
+
+//=======================================================================
+/*
+ * Record a run with a register and a memory write in it, then reverse
+ * step through it one instruction at a time, and in one go, checking
+ * every state on the way against the one saved going forward.
+ */
+static void test_reverse(const char *path)
+{
+    y86sim_t *sim = y86sim_create(VADDRBITS);
+    sim_state_t *states = malloc(RECORD_MAX * sizeof(sim_state_t));
+    CHECK(sim != NULL && states != NULL && y86sim_load_file(sim, path));
+    CHECK(y86sim_reverse_step(sim, 1) == 0);
+    CHECK(y86sim_record(sim, true));
+
+    uint64_t n = 0;
+    while (y86sim_stat(sim) == AOK)
+    {
+        if (n == 40)
+        {
+            y86sim_set_reg(sim, 8, 0x1234);
+        }
+        if (n == 90)
+        {
+            uint64_t value = 0x5555;
+            CHECK(y86sim_write(sim, 0x900, &value, sizeof(value)));
+        }
+        save_state(sim, &states[n++]);
+        CHECK(y86sim_step(sim, 1) == 1);
+    }
+    CHECK(n == CALLS_COUNT);
+    save_state(sim, &states[n]);
+
+    for (uint64_t k = n; k > 0; k--)
+    {
+        CHECK(y86sim_reverse_step(sim, 1) == 1);
+        if (!same_state(sim, &states[k - 1]))
+        {
+            printf("FAIL: y86sim-test.c: state after reverse step to %lu\n", k - 1);
+            failed++;
+            break;
+        }
+    }
+    CHECK(y86sim_count(sim) == 0);
+    CHECK(y86sim_reverse_step(sim, 1) == 0);
+
+    // forward again runs the program without the two writes, which were
+    // undone with the steps after them; then back to the start at once
+    CHECK(y86sim_run(sim) == n);
+    CHECK(!same_state(sim, &states[n]));
+    CHECK(y86sim_reg(sim, 8) == 0);
+    CHECK(y86sim_reverse_step(sim, n) == n);
+    CHECK(same_state(sim, &states[0]));
+
+    // back to a breakpoint: the last ret, before the halt
+    CHECK(y86sim_run(sim) == n);
+    address_t breaks[] = { CALLS_RET };
+    CHECK(y86sim_reverse_continue(sim, breaks, 1) == 2);
+    CHECK(y86sim_pc(sim) == CALLS_RET);
+
+    CHECK(y86sim_record(sim, false));
+    CHECK(y86sim_reverse_step(sim, 1) == 0);
+    free(states);
+    y86sim_destroy(sim);
+}
+
+//=======================================================================
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        printf("Usage: y86sim-test calls.o\n");
+        return EXIT_FAILURE;
+    }
+    test_run(argv[1]);
+    test_write(argv[1]);
+    test_reverse(argv[1]);
+    return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
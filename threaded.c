@@ -0,0 +1,729 @@
+/*
+ * Direct-threaded execution engine.
+ *
+ * Every CODE segment is translated up front into slots, one per byte
+ * address (kept per memory page), each holding the address of a handler specialised
+ * for its opcode byte (addq, jle, cmovg, ...). Execution jumps from
+ * handler to handler with GCC computed gotos instead of going through
+ * fetch(), decode_execute() and memory_wb_pc(). Anything unusual (invalid
+ * opcodes, writes to the 0xF register, fetches that fail) runs through
+ * the portable engine one instruction at a time, so the architectural
+ * results and the printed output are identical to -e.
+ *
+ * Common pairs and triples are fused into superinstructions: the slot of
+ * the first instruction gets a handler that runs the whole sequence and
+ * goes straight to the next handler with a direct jump instead of a
+ * dispatch. Fused sequences are OPq + jXX (compare and branch), irmovq +
+ * OPq (constant operand), irmovq + OPq + jXX and mrmovq + OPq (load and
+ * accumulate). The slots of the later instructions keep their own
+ * handlers, so a jump into the middle of a sequence runs the rest of it
+ * one instruction at a time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/threaded.h"
+#include "./headers/disassemble.h"
+#include "./headers/interpret.h"
+#include "./headers/decode-cache.h"
+#include "./headers/mem-access.h"
+
+// Longest fused sequence in bytes, irmovq + OPq + jXX.
+#define MAX_FUSED_SIZE 21
+
+#if defined(__GNUC__)
+
+//=======================================================================
+/*
+ * Translate the instruction at pc into slot. handlers is indexed by the
+ * opcode byte; a NULL entry selects the portable fallback.
+ */
+static void translate(threaded_slot_t *slot, address_t pc, y86_t *cpu,
+                      memory_t memory, void *const handlers[256], void *slow)
+{
+    y86_t scratch;
+    memset(&scratch, 0, sizeof(scratch));
+    scratch.stat = AOK;
+    scratch.memsize = mem_size(memory);
+    scratch.pc = pc;
+
+    y86_inst_t ins = fetch(&scratch, memory);
+    slot->handler = slow;
+    slot->size = ins.size;
+    slot->opcode = ins.opcode;
+    if (ins.type == INVALID || (scratch.stat != AOK && ins.type != HALT))
+    {
+        return;
+    }
+
+    // writes to the 0xF register are an error the fast handlers skip
+    bool writes_ra = ins.type == MRMOVQ || ins.type == POPQ;
+    bool writes_rb = ins.type == CMOV || ins.type == IRMOVQ || ins.type == OPQ;
+    if ((writes_ra && ins.ra == BADREG) || (writes_rb && ins.rb == BADREG))
+    {
+        return;
+    }
+
+    // the 0xF encoding points at the always-zero BADREG slot
+    slot->ra = &cpu->regs[ins.ra & 0xF];
+    slot->rb = &cpu->regs[ins.rb & 0xF];
+    switch (ins.type)
+    {
+    case (IRMOVQ):
+        slot->imm = ins.value;
+        break;
+    case (RMMOVQ):
+    case (MRMOVQ):
+        slot->imm = ins.d;
+        break;
+    case (JUMP):
+    case (CALL):
+        slot->imm = (int64_t)ins.dest;
+        break;
+    default:
+        slot->imm = 0;
+        break;
+    }
+    if (handlers[ins.opcode] != NULL)
+    {
+        slot->handler = handlers[ins.opcode];
+    }
+}
+
+/* Handlers the fusion pass chooses from, see run_threaded(). */
+typedef struct fusion {
+    void *untranslated;             /* slot not translated yet */
+    void *slow;                     /* portable fallback */
+    void *const (*opq_jump)[7];     /* OPq + jXX, by op and jump */
+    void *const (*irmovq_opq)[7];   /* irmovq + OPq (+ jXX), by op and jump */
+    void *const *mrmovq_opq;        /* mrmovq + OPq, by op */
+} fusion_t;
+
+//=======================================================================
+/*
+ * Return the slot of the instruction after slot (at pc) if it is on the
+ * same page and translated to a fast handler, otherwise NULL.
+ */
+static threaded_slot_t *follower(threaded_slot_t *slot, address_t pc,
+                                 const fusion_t *fusion)
+{
+    if ((pc & PAGEMASK) + slot->size >= PAGESIZE)
+    {
+        return NULL;
+    }
+    threaded_slot_t *next = slot + slot->size;
+    if (next->handler == fusion->untranslated || next->handler == fusion->slow)
+    {
+        return NULL;
+    }
+    return next;
+}
+
+//=======================================================================
+/*
+ * Replace the handler of the translated slot at pc by a superinstruction
+ * if it starts a sequence that has one. The following instructions must
+ * already be translated; nothing is fused otherwise.
+ */
+static void fuse(threaded_slot_t *slot, address_t pc, const fusion_t *fusion)
+{
+    if (slot->handler == fusion->slow)
+    {
+        return;
+    }
+    threaded_slot_t *second = follower(slot, pc, fusion);
+    if (second == NULL)
+    {
+        return;
+    }
+    threaded_slot_t *third = follower(second, pc + slot->size, fusion);
+
+    // only fast opcodes get here, so the low nibbles are in range
+    int op = second->opcode & 0xF;
+    int jump = 0;
+    if (third != NULL && third->opcode >> 4 == JUMP)
+    {
+        jump = third->opcode & 0xF;
+    }
+
+    void *handler = NULL;
+    if (slot->opcode >> 4 == OPQ && second->opcode >> 4 == JUMP)
+    {
+        handler = fusion->opq_jump[slot->opcode & 0xF][op];
+    }
+    else if (slot->opcode >> 4 == IRMOVQ && second->opcode >> 4 == OPQ)
+    {
+        handler = fusion->irmovq_opq[op][jump];
+    }
+    else if (slot->opcode >> 4 == MRMOVQ && second->opcode >> 4 == OPQ)
+    {
+        handler = fusion->mrmovq_opq[op];
+    }
+    if (handler != NULL)
+    {
+        slot->handler = handler;
+    }
+}
+
+//=======================================================================
+/*
+ * Return the slots of the page holding pc, creating them on first use
+ * with every slot set to the translate handler. NULL if out of memory.
+ */
+static threaded_slot_t *slot_page(threaded_slot_t **pages, address_t pc,
+                                  void *untranslated)
+{
+    threaded_slot_t **page = &pages[pc >> PAGEBITS];
+    if (*page == NULL)
+    {
+        *page = malloc(PAGESIZE * sizeof(threaded_slot_t));
+        if (*page == NULL)
+        {
+            return NULL;
+        }
+        for (int i = 0; i < PAGESIZE; i++)
+        {
+            (*page)[i].handler = untranslated;
+        }
+    }
+    return *page;
+}
+
+//=======================================================================
+/*
+ * Widen [*lo, *hi), the bytes holding translated instructions, to cover
+ * the instruction translated into slot at pc.
+ */
+static void cover(address_t *lo, address_t *hi, address_t pc,
+                  const threaded_slot_t *slot)
+{
+    address_t end = pc + (slot->size ? slot->size : 1);
+    *lo = pc < *lo ? pc : *lo;
+    *hi = end > *hi ? end : *hi;
+}
+
+//=======================================================================
+/*
+ * Mark the translations overlapping an 8-byte store at addr as stale,
+ * including superinstructions whose later instructions it overlaps.
+ * [code_lo, code_hi) holds every translated instruction; stores outside
+ * it (most data) only touch the decode cache.
+ */
+static void invalidate_slots(threaded_slot_t **pages, memory_t memory,
+                             address_t addr, void *untranslated,
+                             address_t code_lo, address_t code_hi)
+{
+    if (addr + 8 <= code_lo || addr >= code_hi)
+    {
+        decode_cache_invalidate(memory, addr, 8);
+        return;
+    }
+    address_t lo = addr >= MAX_FUSED_SIZE - 1 ? addr - (MAX_FUSED_SIZE - 1) : 0;
+    address_t hi = addr + 8 < mem_size(memory) ? addr + 8 : mem_size(memory);
+    for (address_t i = lo; i < hi; i++)
+    {
+        threaded_slot_t *page = pages[i >> PAGEBITS];
+        if (page != NULL)
+        {
+            page[i & PAGEMASK].handler = untranslated;
+        }
+    }
+    decode_cache_invalidate(memory, addr, 8);
+}
+
+// Condition codes, as computed by checkCondition() and jumpChecker().
+#define COND_LE (cpu->zf || (cpu->sf != cpu->of))
+#define COND_L  (cpu->sf != cpu->of)
+#define COND_E  (cpu->zf)
+#define COND_NE (!cpu->zf)
+#define COND_GE (cpu->sf == cpu->of)
+#define COND_G  (!cpu->zf && cpu->sf == cpu->of)
+
+// Jump to the handler of the instruction at pc. Straight-line code stays
+// on the page of the previous instruction, so only leaving it costs a
+// bounds check and a page table lookup.
+#define DISPATCH()                                         \
+    do                                                     \
+    {                                                      \
+        if ((pc >> PAGEBITS) != pagenum)                   \
+        {                                                  \
+            if (pc >= size)                                \
+            {                                              \
+                goto bad_pc;                               \
+            }                                              \
+            page = pages[pc >> PAGEBITS];                  \
+            if (page == NULL)                              \
+            {                                              \
+                goto new_page;                             \
+            }                                              \
+            pagenum = pc >> PAGEBITS;                      \
+        }                                                  \
+        slot = &page[pc & PAGEMASK];                       \
+        goto *slot->handler;                               \
+    } while (0)
+
+// Count the instruction just executed and continue with the next one.
+#define NEXT()                           \
+    do                                   \
+    {                                    \
+        count++;                         \
+        DISPATCH();                      \
+    } while (0)
+
+// Count the instruction just executed and stop, the CPU left AOK.
+#define FINISH()                         \
+    do                                   \
+    {                                    \
+        count++;                         \
+        if (pc >= size)                  \
+        {                                \
+            goto bad_pc;                 \
+        }                                \
+        goto done;                       \
+    } while (0)
+
+// Count the instruction just executed and run the next one, whose
+// handler is known, with slot advanced past size bytes.
+#define FUSE(size, label)                \
+    do                                   \
+    {                                    \
+        count++;                         \
+        slot += (size);                  \
+        goto label;                      \
+    } while (0)
+
+#define ADD_RESULT b + a
+#define ADD_OVERFLOW (sb < 0 && sa < 0 && se > 0) || (sb > 0 && sa > 0 && se < 0)
+#define SUB_RESULT b - a
+#define SUB_OVERFLOW (sb < 0 && sa > 0 && se > 0) || (sb > 0 && sa < 0 && se < 0)
+#define AND_RESULT b & a
+#define AND_OVERFLOW false
+#define XOR_RESULT a ^ b
+#define XOR_OVERFLOW false
+
+#define OPQ_HANDLER(name, expr, overflow, next)                    \
+    name:                                                          \
+    {                                                              \
+        uint64_t a = *slot->ra;                                    \
+        uint64_t b = *slot->rb;                                    \
+        uint64_t e = (expr);                                       \
+        int64_t sa = (int64_t)a, sb = (int64_t)b, se = (int64_t)e; \
+        (void)sa;                                                  \
+        (void)sb;                                                  \
+        (void)se;                                                  \
+        cpu->of = (overflow);                                      \
+        cpu->sf = (e >> 63) == 1;                                  \
+        cpu->zf = e == 0;                                          \
+        *slot->rb = e;                                             \
+        pc += 2;                                                   \
+        next;                                                      \
+    }
+
+// OPq on its own and followed by each conditional jump.
+#define OPQ_HANDLERS(op, expr, overflow)                                 \
+    OPQ_HANDLER(op_##op, expr, overflow, NEXT())                         \
+    OPQ_HANDLER(fuse_##op##_jle, expr, overflow, FUSE(2, op_jle))        \
+    OPQ_HANDLER(fuse_##op##_jl, expr, overflow, FUSE(2, op_jl))          \
+    OPQ_HANDLER(fuse_##op##_je, expr, overflow, FUSE(2, op_je))          \
+    OPQ_HANDLER(fuse_##op##_jne, expr, overflow, FUSE(2, op_jne))        \
+    OPQ_HANDLER(fuse_##op##_jge, expr, overflow, FUSE(2, op_jge))        \
+    OPQ_HANDLER(fuse_##op##_jg, expr, overflow, FUSE(2, op_jg))
+
+#define IRMOVQ_HANDLER(name, next)                  \
+    name:                                           \
+    *slot->rb = (y86_register_t)slot->imm;          \
+    pc += 10;                                       \
+    next;
+
+// irmovq followed by OPq op, alone or followed by each conditional jump.
+#define IRMOVQ_HANDLERS(op)                                              \
+    IRMOVQ_HANDLER(fuse_irmovq_##op, FUSE(10, op_##op))                  \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_jle, FUSE(10, fuse_##op##_jle))    \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_jl, FUSE(10, fuse_##op##_jl))      \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_je, FUSE(10, fuse_##op##_je))      \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_jne, FUSE(10, fuse_##op##_jne))    \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_jge, FUSE(10, fuse_##op##_jge))    \
+    IRMOVQ_HANDLER(fuse_irmovq_##op##_jg, FUSE(10, fuse_##op##_jg))
+
+#define MRMOVQ_HANDLER(name, next)                          \
+    name:                                                   \
+    {                                                       \
+        address_t addr = (uint64_t)slot->imm + *slot->rb;   \
+        if (addr >= size)                                   \
+        {                                                   \
+            cpu->stat = ADR;                                \
+            pc += 10;                                       \
+            FINISH();                                       \
+        }                                                   \
+        *slot->ra = mem_read64(memory, addr);               \
+        pc += 10;                                           \
+        next;                                               \
+    }
+
+// Row of a fusion table: the pair, then the pair plus each conditional
+// jump.
+#define FUSED_ROW(pair, prefix)                                     \
+    {                                                               \
+        pair, &&prefix##_jle, &&prefix##_jl, &&prefix##_je,         \
+        &&prefix##_jne, &&prefix##_jge, &&prefix##_jg               \
+    }
+
+#define CMOV_HANDLER(name, cond)   \
+    name:                          \
+    if (cond)                      \
+    {                              \
+        *slot->rb = *slot->ra;     \
+    }                              \
+    pc += 2;                       \
+    NEXT();
+
+#define JUMP_HANDLER(name, cond)   \
+    name:                          \
+    if (cond)                      \
+    {                              \
+        pc = (address_t)slot->imm; \
+    }                              \
+    else                           \
+    {                              \
+        pc += 9;                   \
+    }                              \
+    NEXT();
+
+//=======================================================================
+/*
+ * Run cpu until it leaves the AOK state and return the number of
+ * instructions executed. Output matches the -e loop in main.c.
+ */
+uint64_t run_threaded(y86_t *cpu, memory_t memory,
+                      elf_hdr_t *hdr, elf_phdr_t phdr[])
+{
+    static void *const handlers[256] = {
+        [0x00] = &&op_halt,
+        [0x10] = &&op_nop,
+        [0x20] = &&op_rrmovq,
+        [0x21] = &&op_cmovle,
+        [0x22] = &&op_cmovl,
+        [0x23] = &&op_cmove,
+        [0x24] = &&op_cmovne,
+        [0x25] = &&op_cmovge,
+        [0x26] = &&op_cmovg,
+        [0x30] = &&op_irmovq,
+        [0x40] = &&op_rmmovq,
+        [0x50] = &&op_mrmovq,
+        [0x60] = &&op_addq,
+        [0x61] = &&op_subq,
+        [0x62] = &&op_andq,
+        [0x63] = &&op_xorq,
+        [0x70] = &&op_jmp,
+        [0x71] = &&op_jle,
+        [0x72] = &&op_jl,
+        [0x73] = &&op_je,
+        [0x74] = &&op_jne,
+        [0x75] = &&op_jge,
+        [0x76] = &&op_jg,
+        [0x80] = &&op_call,
+        [0x90] = &&op_ret,
+        [0xA0] = &&op_pushq,
+        [0xB0] = &&op_popq,
+    };
+    static void *const opq_jump[4][7] = {
+        [ADD] = FUSED_ROW(NULL, fuse_addq),
+        [SUB] = FUSED_ROW(NULL, fuse_subq),
+        [AND] = FUSED_ROW(NULL, fuse_andq),
+        [XOR] = FUSED_ROW(NULL, fuse_xorq),
+    };
+    static void *const irmovq_opq[4][7] = {
+        [ADD] = FUSED_ROW(&&fuse_irmovq_addq, fuse_irmovq_addq),
+        [SUB] = FUSED_ROW(&&fuse_irmovq_subq, fuse_irmovq_subq),
+        [AND] = FUSED_ROW(&&fuse_irmovq_andq, fuse_irmovq_andq),
+        [XOR] = FUSED_ROW(&&fuse_irmovq_xorq, fuse_irmovq_xorq),
+    };
+    static void *const mrmovq_opq[4] = {
+        [ADD] = &&fuse_mrmovq_addq,
+        [SUB] = &&fuse_mrmovq_subq,
+        [AND] = &&fuse_mrmovq_andq,
+        [XOR] = &&fuse_mrmovq_xorq,
+    };
+
+    if (cpu == NULL || memory == NULL)
+    {
+        return 0;
+    }
+    settle_flags(cpu);
+
+    const fusion_t fusion = {
+        &&do_translate, &&do_slow, opq_jump, irmovq_opq, mrmovq_opq
+    };
+    address_t size = mem_size(memory);
+    threaded_slot_t **pages = calloc(memory->npages, sizeof(threaded_slot_t *));
+    if (pages == NULL)
+    {
+        // no room for a translation, use the portable engine
+        uint64_t count = 0;
+        while (cpu->stat == AOK)
+        {
+            step_portable(cpu, memory, NULL, NULL);
+            count++;
+        }
+        return count;
+    }
+
+    // bytes holding translated instructions, see invalidate_slots()
+    address_t code_lo = size;
+    address_t code_hi = 0;
+
+    // translate the loaded code segments ahead of time
+    for (int i = 0; hdr != NULL && i < hdr->e_num_phdr; i++)
+    {
+        if (phdr[i].p_type != CODE)
+        {
+            continue;
+        }
+        address_t end = phdr[i].p_vaddr + phdr[i].p_filesz;
+        for (address_t pc = phdr[i].p_vaddr; pc < end && pc < size;)
+        {
+            threaded_slot_t *page = slot_page(pages, pc, &&do_translate);
+            if (page == NULL)
+            {
+                break;
+            }
+            threaded_slot_t *slot = &page[pc & PAGEMASK];
+            translate(slot, pc, cpu, memory, handlers, &&do_slow);
+            cover(&code_lo, &code_hi, pc, slot);
+            pc += slot->size ? slot->size : 1;
+        }
+    }
+
+    // then fuse, now that the instructions after each one are translated
+    for (int i = 0; hdr != NULL && i < hdr->e_num_phdr; i++)
+    {
+        if (phdr[i].p_type != CODE)
+        {
+            continue;
+        }
+        address_t end = phdr[i].p_vaddr + phdr[i].p_filesz;
+        for (address_t pc = phdr[i].p_vaddr; pc < end && pc < size;)
+        {
+            threaded_slot_t *page = pages[pc >> PAGEBITS];
+            if (page == NULL)
+            {
+                break;
+            }
+            threaded_slot_t *slot = &page[pc & PAGEMASK];
+            fuse(slot, pc, &fusion);
+            pc += slot->size ? slot->size : 1;
+        }
+    }
+
+    uint64_t count = 0;
+    address_t pc = cpu->pc;
+    // no address maps to this page number
+    uint64_t pagenum = 0xffffffffffffffff;
+    threaded_slot_t *page = NULL;
+    threaded_slot_t *slot;
+
+    if (cpu->stat != AOK)
+    {
+        goto done;
+    }
+    if (pc >= size)
+    {
+        goto do_slow;
+    }
+    DISPATCH();
+
+new_page:
+    if (slot_page(pages, pc, &&do_translate) == NULL)
+    {
+        // page is NULL now, make the next dispatch look it up again
+        pagenum = 0xffffffffffffffff;
+        goto do_slow;
+    }
+    DISPATCH();
+
+do_translate:
+    translate(slot, pc, cpu, memory, handlers, &&do_slow);
+    cover(&code_lo, &code_hi, pc, slot);
+    fuse(slot, pc, &fusion);
+    goto *slot->handler;
+
+do_slow:
+{
+    // execute one instruction with the switch engine; when no slot page
+    // could be allocated that can be any instruction, stores included
+    cpu->pc = pc;
+    y86_inst_t ins;
+    y86_register_t valE;
+    step_portable(cpu, memory, &ins, &valE);
+    bool stored = ins.type == RMMOVQ || ins.type == CALL || ins.type == PUSHQ;
+    if (stored && valE <= size)
+    {
+        invalidate_slots(pages, memory, valE, &&do_translate, code_lo, code_hi);
+    }
+    pc = cpu->pc;
+    count++;
+    if (cpu->stat != AOK)
+    {
+        goto done;
+    }
+    DISPATCH();
+}
+
+op_halt:
+    cpu->stat = HLT;
+    cpu->zf = false;
+    cpu->sf = false;
+    cpu->of = false;
+    pc += 1;
+    FINISH();
+
+op_nop:
+    pc += 1;
+    NEXT();
+
+    CMOV_HANDLER(op_rrmovq, true)
+    CMOV_HANDLER(op_cmovle, COND_LE)
+    CMOV_HANDLER(op_cmovl, COND_L)
+    CMOV_HANDLER(op_cmove, COND_E)
+    CMOV_HANDLER(op_cmovne, COND_NE)
+    CMOV_HANDLER(op_cmovge, COND_GE)
+    CMOV_HANDLER(op_cmovg, COND_G)
+
+    IRMOVQ_HANDLER(op_irmovq, NEXT())
+    IRMOVQ_HANDLERS(addq)
+    IRMOVQ_HANDLERS(subq)
+    IRMOVQ_HANDLERS(andq)
+    IRMOVQ_HANDLERS(xorq)
+
+op_rmmovq:
+{
+    address_t addr = (uint64_t)slot->imm + *slot->rb;
+    if (addr > size)
+    {
+        cpu->stat = ADR;
+        pc = 0xffffffffffffffff;
+        FINISH();
+    }
+    y86_register_t value = *slot->ra;
+    mem_write64(memory, addr, value);
+    invalidate_slots(pages, memory, addr, &&do_translate, code_lo, code_hi);
+    TRACE_STORE(memory, addr, value);
+    pc += 10;
+    NEXT();
+}
+
+    MRMOVQ_HANDLER(op_mrmovq, NEXT())
+    MRMOVQ_HANDLER(fuse_mrmovq_addq, FUSE(10, op_addq))
+    MRMOVQ_HANDLER(fuse_mrmovq_subq, FUSE(10, op_subq))
+    MRMOVQ_HANDLER(fuse_mrmovq_andq, FUSE(10, op_andq))
+    MRMOVQ_HANDLER(fuse_mrmovq_xorq, FUSE(10, op_xorq))
+
+    OPQ_HANDLERS(addq, ADD_RESULT, ADD_OVERFLOW)
+    OPQ_HANDLERS(subq, SUB_RESULT, SUB_OVERFLOW)
+    OPQ_HANDLERS(andq, AND_RESULT, AND_OVERFLOW)
+    OPQ_HANDLERS(xorq, XOR_RESULT, XOR_OVERFLOW)
+
+    JUMP_HANDLER(op_jmp, true)
+    JUMP_HANDLER(op_jle, COND_LE)
+    JUMP_HANDLER(op_jl, COND_L)
+    JUMP_HANDLER(op_je, COND_E)
+    JUMP_HANDLER(op_jne, COND_NE)
+    JUMP_HANDLER(op_jge, COND_GE)
+    JUMP_HANDLER(op_jg, COND_G)
+
+op_call:
+{
+    address_t addr = cpu->rsp - 8;
+    if (addr >= size)
+    {
+        cpu->stat = ADR;
+        pc = (address_t)slot->imm;
+        FINISH();
+    }
+    mem_write64(memory, addr, pc + 9);
+    invalidate_slots(pages, memory, addr, &&do_translate, code_lo, code_hi);
+    cpu->rsp = addr;
+    TRACE_STORE(memory, addr, pc + 9);
+    pc = (address_t)slot->imm;
+    NEXT();
+}
+
+op_ret:
+    if (cpu->rsp >= size)
+    {
+        cpu->stat = ADR;
+        pc = 0xffffffffffffffff;
+        FINISH();
+    }
+    pc = mem_read64(memory, cpu->rsp);
+    cpu->rsp += 8;
+    NEXT();
+
+op_pushq:
+{
+    y86_register_t value = *slot->ra;
+    address_t addr = cpu->rsp - 8;
+    if (addr >= size)
+    {
+        cpu->stat = ADR;
+        pc = 0xffffffffffffffff;
+        FINISH();
+    }
+    mem_write64(memory, addr, value);
+    invalidate_slots(pages, memory, addr, &&do_translate, code_lo, code_hi);
+    cpu->rsp = addr;
+    TRACE_STORE(memory, addr, value);
+    pc += 2;
+    NEXT();
+}
+
+op_popq:
+{
+    address_t addr = cpu->rsp;
+    if (addr >= size)
+    {
+        cpu->stat = ADR;
+        pc = 0xffffffffffffffff;
+        FINISH();
+    }
+    y86_register_t value = mem_read64(memory, addr);
+    cpu->rsp = addr + 8;
+    *slot->ra = value;
+    pc += 2;
+    NEXT();
+}
+
+bad_pc:
+    cpu->stat = ADR;
+    pc = 0xffffffffffffffff;
+
+done:
+    cpu->pc = pc;
+    for (uint64_t i = 0; i < memory->npages; i++)
+    {
+        free(pages[i]);
+    }
+    free(pages);
+    return count;
+}
+
+#else
+
+//=======================================================================
+/*
+ * Without computed gotos fall back to the portable switch engine.
+ */
+uint64_t run_threaded(y86_t *cpu, memory_t memory,
+                      elf_hdr_t *hdr, elf_phdr_t phdr[])
+{
+    uint64_t count = 0;
+    while (cpu != NULL && memory != NULL && cpu->stat == AOK)
+    {
+        step_portable(cpu, memory, NULL, NULL);
+        count++;
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,171 @@
+#!/bin/sh
+#
+# make check: compare the simulator with known output, and every engine
+# with the others.
+#
+#   tools/check.sh build-dir random-count
+#
+# Each tests/NAME.ys is assembled and run with -e, -E and -a -d -D; the
+# output and exit status must match tests/expected/NAME.{exec,debug,dump}.out,
+# which were recorded with the original simulator before any engine or
+# the lazy condition codes existed.
+#
+# Each line of tests/NAME.args is a further run of NAME: a case name, then
+# the flags to run it with. The output and exit status must match
+# tests/expected/NAME.CASE.out. The runs are made from the directory the
+# tests are assembled into, in order, so the flags can name the other
+# tests' objects and the files that earlier cases wrote.
+#
+# Each tests/NAME.rsp is a gdb session that y86-rsp plays against NAME
+# served by y86 -g; the packets and replies must match
+# tests/expected/NAME.rsp.out.
+#
+# y86sim-test drives the calls test through the library interface.
+#
+# Each test is also resumed from checkpoints taken partway (-S -C, then
+# -R); from there on its -E trace, final memory and exit status must be
+# those of the run the checkpoint was taken from.
+#
+# The example and benchmark programs, and random-count programs from
+# y86-gen, then run under -e, -t (threaded) and -J (JIT). Their output
+# must be identical. Random programs that do not halt within
+# CHECK_TIMEOUT seconds under -e are skipped.
+#
+
+BUILD=$1
+RANDOM_COUNT=${2:-200}
+CHECK_TIMEOUT=${CHECK_TIMEOUT:-2}
+Y86=$BUILD/y86
+TMP=$BUILD/check
+failed=0
+
+mkdir -p "$TMP"
+Y86_ABS=$(cd "$BUILD" && pwd)/y86
+
+# compare -t and -J with -e on one program, with extra flags in $2
+compare()
+{
+    timeout "$CHECK_TIMEOUT" "$Y86" -e $2 "$1" > "$TMP/e.out" 2>&1
+    if [ $? -eq 124 ]; then
+        return 2
+    fi
+    for engine in -t -J; do
+        timeout "$CHECK_TIMEOUT" "$Y86" $engine $2 "$1" > "$TMP/engine.out" 2>&1
+        if ! cmp -s "$TMP/e.out" "$TMP/engine.out"; then
+            echo "FAIL: $engine $2 $1 differs from -e"
+            diff "$TMP/e.out" "$TMP/engine.out" | head -10
+            failed=$((failed + 1))
+        fi
+    done
+    return 0
+}
+
+# resume $1 from a checkpoint after $2 instructions, compare with a full
+# run; programs that stop by then have nothing to resume
+resume()
+{
+    total=$("$Y86" -q "$1" 2>&1 | sed -n 's/^Total execution count: \([0-9]*\).*/\1/p')
+    if [ -z "$total" ] || [ "$2" -ge "$total" ]; then
+        return
+    fi
+    rm -f "$TMP/resume.snap"
+    if ! "$Y86" -S "$TMP/resume.snap" -C "$2" -q "$1" > /dev/null 2>&1; then
+        echo "FAIL: no checkpoint of $1 after $2 instructions"
+        failed=$((failed + 1))
+        return
+    fi
+    "$Y86" -E "$1" > "$TMP/full.out" 2>&1
+    echo "exit $?" >> "$TMP/full.out"
+    "$Y86" -R "$TMP/resume.snap" -E "$1" > "$TMP/resumed.out" 2>&1
+    echo "exit $?" >> "$TMP/resumed.out"
+    awk -v n="$2" '/^Executing:/ { seen++ } seen > n' "$TMP/full.out" > "$TMP/e.out"
+    awk '/^Executing:/ { seen++ } seen > 0' "$TMP/resumed.out" > "$TMP/engine.out"
+    if ! cmp -s "$TMP/e.out" "$TMP/engine.out"; then
+        echo "FAIL: $1 resumed after $2 instructions differs from a full run"
+        diff "$TMP/e.out" "$TMP/engine.out" | head -10
+        failed=$((failed + 1))
+    fi
+}
+
+for source in tests/*.ys; do
+    name=$(basename "$source" .ys)
+    "$BUILD/y86-as" -o "$TMP/$name.o" "$source" || exit 1
+    for mode in exec:-e debug:-E "dump:-a -d -D"; do
+        "$Y86" ${mode#*:} "$TMP/$name.o" > "$TMP/golden.out" 2>&1
+        echo "exit $?" >> "$TMP/golden.out"
+        if ! cmp -s "tests/expected/$name.${mode%%:*}.out" "$TMP/golden.out"; then
+            echo "FAIL: ${mode#*:} $source differs from tests/expected/$name.${mode%%:*}.out"
+            diff "tests/expected/$name.${mode%%:*}.out" "$TMP/golden.out" | head -10
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+for cases in tests/*.args; do
+    name=$(basename "$cases" .args)
+    while read -r case flags; do
+        case "$case" in
+        ''|'#'*) continue ;;
+        esac
+        (cd "$TMP" && "$Y86_ABS" $flags "$name.o") < /dev/null > "$TMP/golden.out" 2>&1
+        echo "exit $?" >> "$TMP/golden.out"
+        if ! cmp -s "tests/expected/$name.$case.out" "$TMP/golden.out"; then
+            echo "FAIL: $flags $name differs from tests/expected/$name.$case.out"
+            diff "tests/expected/$name.$case.out" "$TMP/golden.out" | head -10
+            failed=$((failed + 1))
+        fi
+    done < "$cases"
+done
+
+for script in tests/*.rsp; do
+    name=$(basename "$script" .rsp)
+    rm -f "$TMP/gdb.sock"
+    timeout 10 "$Y86" -g "$TMP/gdb.sock" "$TMP/$name.o" > /dev/null &
+    timeout 10 "$BUILD/y86-rsp" "$TMP/gdb.sock" "$script" > "$TMP/rsp.out" 2>&1
+    echo "exit $?" >> "$TMP/rsp.out"
+    wait
+    if ! cmp -s "tests/expected/$name.rsp.out" "$TMP/rsp.out"; then
+        echo "FAIL: gdb session $script differs from tests/expected/$name.rsp.out"
+        diff "tests/expected/$name.rsp.out" "$TMP/rsp.out" | head -10
+        failed=$((failed + 1))
+    fi
+done
+
+for source in tests/*.ys; do
+    for count in 1 7 50; do
+        resume "$TMP/$(basename "$source" .ys).o" "$count"
+    done
+done
+
+if ! "$BUILD/y86sim-test" "$TMP/calls.o"; then
+    echo "FAIL: y86sim-test $TMP/calls.o"
+    failed=$((failed + 1))
+fi
+
+# the benchmarks store too often for the write trace, run them with -q
+for prog in examples/*.o; do
+    compare "$prog" ""
+done
+for prog in bench/*.o; do
+    compare "$prog" -q
+done
+
+skipped=0
+seed=1
+while [ "$seed" -le "$RANDOM_COUNT" ]; do
+    "$BUILD/y86-gen" "$seed" "$TMP/random.o" || exit 1
+    before=$failed
+    compare "$TMP/random.o" ""
+    if [ $? -eq 2 ]; then
+        skipped=$((skipped + 1))
+    elif [ "$failed" -gt "$before" ]; then
+        echo "  (random program: $BUILD/y86-gen $seed prog.o)"
+    fi
+    seed=$((seed + 1))
+done
+
+if [ "$failed" -gt 0 ]; then
+    echo "check: $failed failures"
+    exit 1
+fi
+echo "check: expected output and gdb sessions match, all engines agree ($RANDOM_COUNT random programs, $skipped did not halt)"
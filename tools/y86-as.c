@@ -0,0 +1,799 @@
+/*
+ * y86-as - assemble Y86 source into a Mini-ELF file.
+ *
+ * The syntax is the one "y86 -d -D" prints, so a disassembly listing
+ * assembles back into the program (the address and byte columns before
+ * the '|' are ignored):
+ *
+ *     .pos 0x100 code          start a segment: code, data, rodata, stack
+ *     _start:                  labels, _start is the entry point
+ *       irmovq stack, %rsp     immediates are numbers, labels or label+N
+ *       mrmovq 8(%rsp), %rax
+ *       halt
+ *     .pos 0x400 data
+ *       .quad 0x10
+ *       .string "text"
+ *       .align 8
+ *
+ * '#' starts a comment. With -s the labels are written to a symbol and a
+ * string table. "-" reads the source from stdin, so generators can pipe
+ * programs straight in.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../headers/elf.h"
+#include "../headers/y86.h"
+
+#define MAX_LINE 4096
+
+/* One .pos section, its bytes as they will be loaded. */
+typedef struct as_segment {
+    uint32_t     vaddr;
+    uint16_t     type;      /* elf_segtype_t */
+    uint16_t     flag;      /* elf_segflag_t */
+    uint8_t     *bytes;
+    size_t       len;
+    size_t       cap;
+} as_segment_t;
+
+typedef struct as_label {
+    char     *name;
+    uint64_t  value;
+    int       line;
+} as_label_t;
+
+/* An 8-byte field that names a label, patched once all labels are known. */
+typedef struct as_fixup {
+    int       segment;
+    size_t    offset;
+    char     *label;
+    int64_t   addend;
+    int       line;
+} as_fixup_t;
+
+typedef struct as_state {
+    const char   *file;
+    int           line;
+    int           errors;
+
+    as_segment_t *segments;
+    int           nsegments;
+
+    as_label_t   *labels;
+    int           nlabels;
+
+    as_fixup_t   *fixups;
+    int           nfixups;
+} as_state_t;
+
+static const char *reg_names[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14"
+};
+
+static const char *op_names[] = { "addq", "subq", "andq", "xorq" };
+static const char *jump_names[] = { "jmp", "jle", "jl", "je", "jne", "jge", "jg" };
+static const char *cmov_names[] = {
+    "rrmovq", "cmovle", "cmovl", "cmove", "cmovne", "cmovge", "cmovg"
+};
+
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_as()
+{
+    printf("Usage: y86-as [-s] [-o mini-elf-file] source-file\n");
+    printf(" Options are:\n");
+    printf("  -h      Display usage\n");
+    printf("  -s      Write symbol and string tables\n");
+    printf("  -o file Output file (default: source with .o suffix)\n");
+}
+
+//=======================================================================
+static void error(as_state_t *as, const char *msg, const char *arg)
+{
+    fprintf(stderr, "%s:%d: %s%s%s\n", as->file, as->line, msg,
+            arg ? ": " : "", arg ? arg : "");
+    as->errors++;
+}
+
+//=======================================================================
+static void *grow(void *array, int count, size_t size)
+{
+    // grow by doubling whenever count reaches a power of two
+    if (count == 0 || (count & (count - 1)) == 0)
+    {
+        array = realloc(array, (count ? count * 2 : 16) * size);
+        if (array == NULL)
+        {
+            fprintf(stderr, "y86-as: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return array;
+}
+
+//=======================================================================
+/*
+ * Append len bytes to the current segment, starting one at 0x0 if no
+ * .pos came first. Return the offset of the first byte.
+ */
+static size_t emit(as_state_t *as, const void *bytes, size_t len)
+{
+    if (as->nsegments == 0)
+    {
+        as->segments = grow(as->segments, as->nsegments, sizeof(as_segment_t));
+        memset(&as->segments[0], 0, sizeof(as_segment_t));
+        as->segments[0].type = CODE;
+        as->segments[0].flag = RX;
+        as->nsegments = 1;
+    }
+    as_segment_t *seg = &as->segments[as->nsegments - 1];
+    if (seg->len + len > seg->cap)
+    {
+        seg->cap = (seg->len + len) * 2;
+        seg->bytes = realloc(seg->bytes, seg->cap);
+        if (seg->bytes == NULL)
+        {
+            fprintf(stderr, "y86-as: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(seg->bytes + seg->len, bytes, len);
+    seg->len += len;
+    return seg->len - len;
+}
+
+//=======================================================================
+static uint64_t here(as_state_t *as)
+{
+    if (as->nsegments == 0)
+    {
+        return 0;
+    }
+    as_segment_t *seg = &as->segments[as->nsegments - 1];
+    return seg->vaddr + seg->len;
+}
+
+//=======================================================================
+static char *skip_space(char *s)
+{
+    while (isspace((unsigned char)*s))
+    {
+        s++;
+    }
+    return s;
+}
+
+//=======================================================================
+static void trim(char *s)
+{
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1]))
+    {
+        s[--len] = '\0';
+    }
+}
+
+//=======================================================================
+static bool is_ident(const char *s)
+{
+    if (!(isalpha((unsigned char)*s) || *s == '_' || *s == '.'))
+    {
+        return false;
+    }
+    for (s++; *s; s++)
+    {
+        if (!(isalnum((unsigned char)*s) || *s == '_' || *s == '.'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Register number of name, or -1.
+ */
+static int parse_reg(as_state_t *as, char *name)
+{
+    name = skip_space(name);
+    trim(name);
+    for (int i = 0; i < NUMREGS; i++)
+    {
+        if (strcmp(name, reg_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    error(as, "bad register", name);
+    return -1;
+}
+
+//=======================================================================
+/*
+ * Store the 64-bit value of expr (number, label or label+/-number) at
+ * offset in the current segment, now or once the label is defined.
+ */
+static void put_value(as_state_t *as, size_t offset, char *expr)
+{
+    expr = skip_space(expr);
+    trim(expr);
+    if (*expr == '\0')
+    {
+        error(as, "missing value", NULL);
+        return;
+    }
+
+    uint64_t value = 0;
+    char *end;
+    if (isdigit((unsigned char)*expr) || *expr == '-' || *expr == '+')
+    {
+        errno = 0;
+        value = *expr == '-' ? (uint64_t)strtoll(expr, &end, 0) : strtoull(expr, &end, 0);
+        if (errno != 0 || *skip_space(end) != '\0')
+        {
+            error(as, "bad number", expr);
+        }
+    }
+    else
+    {
+        // label, optionally followed by +N or -N
+        char *sign = strpbrk(expr, "+-");
+        int64_t addend = 0;
+        if (sign != NULL)
+        {
+            addend = strtoll(sign, &end, 0);
+            if (*skip_space(end) != '\0')
+            {
+                error(as, "bad offset", sign);
+            }
+            *sign = '\0';
+            trim(expr);
+        }
+        if (!is_ident(expr))
+        {
+            error(as, "bad label", expr);
+            return;
+        }
+        as->fixups = grow(as->fixups, as->nfixups, sizeof(as_fixup_t));
+        as_fixup_t *fix = &as->fixups[as->nfixups++];
+        fix->segment = as->nsegments - 1;
+        fix->offset = offset;
+        fix->label = strdup(expr);
+        fix->addend = addend;
+        fix->line = as->line;
+    }
+    memcpy(as->segments[as->nsegments - 1].bytes + offset, &value, sizeof(value));
+}
+
+//=======================================================================
+/*
+ * Emit a memory operand instruction: D(%rb), (%rb) or D.
+ */
+static void put_memory(as_state_t *as, uint8_t opcode, int ra, char *operand)
+{
+    operand = skip_space(operand);
+    trim(operand);
+    int rb = BADREG;
+    char *paren = strchr(operand, '(');
+    if (paren != NULL)
+    {
+        char *close = strchr(paren, ')');
+        if (close == NULL || *skip_space(close + 1) != '\0')
+        {
+            error(as, "bad memory operand", operand);
+            return;
+        }
+        *close = '\0';
+        rb = parse_reg(as, paren + 1);
+        *paren = '\0';
+        trim(operand);
+    }
+    uint8_t bytes[10] = { opcode, (uint8_t)((ra & 0xF) << 4 | (rb & 0xF)) };
+    size_t at = emit(as, bytes, sizeof(bytes));
+    put_value(as, at + 2, *operand ? operand : "0");
+}
+
+//=======================================================================
+/*
+ * Split "a, b" at the last comma outside parentheses.
+ */
+static bool split2(char *args, char **a, char **b)
+{
+    int depth = 0;
+    char *comma = NULL;
+    for (char *s = args; *s; s++)
+    {
+        depth += *s == '(' ? 1 : *s == ')' ? -1 : 0;
+        if (*s == ',' && depth == 0)
+        {
+            comma = s;
+        }
+    }
+    if (comma == NULL)
+    {
+        return false;
+    }
+    *comma = '\0';
+    *a = args;
+    *b = comma + 1;
+    return true;
+}
+
+//=======================================================================
+static int lookup(const char *name, const char **names, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//=======================================================================
+/*
+ * Assemble one instruction or directive.
+ */
+static void statement(as_state_t *as, char *text)
+{
+    char *args = text;
+    while (*args && !isspace((unsigned char)*args))
+    {
+        args++;
+    }
+    if (*args)
+    {
+        *args++ = '\0';
+    }
+    args = skip_space(args);
+    trim(args);
+
+    char *a;
+    char *b;
+    int n;
+    if (strcmp(text, ".pos") == 0)
+    {
+        char kind[16] = "code";
+        unsigned long long addr;
+        if (sscanf(args, "%lli %15s", &addr, kind) < 1 || addr > UINT32_MAX)
+        {
+            error(as, "bad .pos", args);
+            return;
+        }
+        as->segments = grow(as->segments, as->nsegments, sizeof(as_segment_t));
+        as_segment_t *seg = &as->segments[as->nsegments++];
+        memset(seg, 0, sizeof(*seg));
+        seg->vaddr = addr;
+        if (strcmp(kind, "code") == 0)
+        {
+            seg->type = CODE;
+            seg->flag = RX;
+        }
+        else if (strcmp(kind, "data") == 0)
+        {
+            seg->type = DATA;
+            seg->flag = RW;
+        }
+        else if (strcmp(kind, "rodata") == 0)
+        {
+            seg->type = DATA;
+            seg->flag = RO;
+        }
+        else if (strcmp(kind, "stack") == 0)
+        {
+            seg->type = STACK;
+            seg->flag = RW;
+        }
+        else
+        {
+            error(as, "unknown segment kind", kind);
+        }
+    }
+    else if (strcmp(text, ".quad") == 0)
+    {
+        uint8_t zero[8] = {0};
+        size_t at = emit(as, zero, sizeof(zero));
+        put_value(as, at, args);
+    }
+    else if (strcmp(text, ".string") == 0)
+    {
+        size_t len = strlen(args);
+        if (len < 2 || args[0] != '"' || args[len - 1] != '"')
+        {
+            error(as, "bad .string", args);
+            return;
+        }
+        for (size_t i = 1; i < len - 1; i++)
+        {
+            uint8_t c = args[i];
+            if (c == '\\' && i + 1 < len - 1)
+            {
+                c = args[++i];
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c == '0' ? '\0' : c;
+            }
+            emit(as, &c, 1);
+        }
+        uint8_t nul = 0;
+        emit(as, &nul, 1);
+    }
+    else if (strcmp(text, ".align") == 0)
+    {
+        long align = strtol(args, NULL, 0);
+        if (align <= 0 || (align & (align - 1)) != 0)
+        {
+            error(as, "bad .align", args);
+            return;
+        }
+        uint8_t zero = 0;
+        while (here(as) % align != 0)
+        {
+            emit(as, &zero, 1);
+        }
+    }
+    else if (strcmp(text, "halt") == 0 || strcmp(text, "nop") == 0
+             || strcmp(text, "ret") == 0)
+    {
+        uint8_t op = text[0] == 'h' ? HALT << 4 : text[0] == 'n' ? NOP << 4 : RET << 4;
+        emit(as, &op, 1);
+    }
+    else if ((n = lookup(text, cmov_names, 7)) >= 0 || (n = lookup(text, op_names, 4)) >= 0)
+    {
+        uint8_t icode = lookup(text, cmov_names, 7) >= 0 ? CMOV : OPQ;
+        if (!split2(args, &a, &b))
+        {
+            error(as, "expected two registers", args);
+            return;
+        }
+        int ra = parse_reg(as, a);
+        int rb = parse_reg(as, b);
+        uint8_t bytes[2] = { (uint8_t)(icode << 4 | n), (uint8_t)((ra & 0xF) << 4 | (rb & 0xF)) };
+        emit(as, bytes, sizeof(bytes));
+    }
+    else if (strcmp(text, "irmovq") == 0)
+    {
+        if (!split2(args, &a, &b))
+        {
+            error(as, "expected value and register", args);
+            return;
+        }
+        int rb = parse_reg(as, b);
+        uint8_t bytes[10] = { IRMOVQ << 4, (uint8_t)(0xF0 | (rb & 0xF)) };
+        size_t at = emit(as, bytes, sizeof(bytes));
+        put_value(as, at + 2, a);
+    }
+    else if (strcmp(text, "rmmovq") == 0)
+    {
+        if (!split2(args, &a, &b))
+        {
+            error(as, "expected register and memory operand", args);
+            return;
+        }
+        put_memory(as, RMMOVQ << 4, parse_reg(as, a), b);
+    }
+    else if (strcmp(text, "mrmovq") == 0)
+    {
+        if (!split2(args, &a, &b))
+        {
+            error(as, "expected memory operand and register", args);
+            return;
+        }
+        put_memory(as, MRMOVQ << 4, parse_reg(as, b), a);
+    }
+    else if ((n = lookup(text, jump_names, 7)) >= 0 || strcmp(text, "call") == 0)
+    {
+        uint8_t bytes[9] = { n >= 0 ? (uint8_t)(JUMP << 4 | n) : CALL << 4 };
+        size_t at = emit(as, bytes, sizeof(bytes));
+        put_value(as, at + 1, args);
+    }
+    else if (strcmp(text, "pushq") == 0 || strcmp(text, "popq") == 0)
+    {
+        int ra = parse_reg(as, args);
+        uint8_t bytes[2] = { text[1] == 'u' ? PUSHQ << 4 : POPQ << 4,
+                             (uint8_t)((ra & 0xF) << 4 | 0xF) };
+        emit(as, bytes, sizeof(bytes));
+    }
+    else
+    {
+        error(as, "unknown instruction", text);
+    }
+}
+
+//=======================================================================
+/*
+ * Assemble one source line: strip listing columns and comments, define
+ * the labels, then the statement.
+ */
+static void assemble_line(as_state_t *as, char *line)
+{
+    // "  0x100: 30f4... |   irmovq ..." from a disassembly listing
+    char *s = skip_space(line);
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        char *bar = strchr(s, '|');
+        char *colon = strchr(s, ':');
+        if (bar != NULL && colon != NULL && colon < bar)
+        {
+            s = bar + 1;
+        }
+    }
+    if (strncmp(s, "Disassembly of", 14) == 0)
+    {
+        return;
+    }
+
+    // comments, minding '#' inside strings
+    bool quoted = false;
+    for (char *c = s; *c; c++)
+    {
+        if (*c == '"' && (c == s || c[-1] != '\\'))
+        {
+            quoted = !quoted;
+        }
+        else if (*c == '#' && !quoted)
+        {
+            *c = '\0';
+            break;
+        }
+    }
+
+    s = skip_space(s);
+    trim(s);
+    char *colon;
+    while ((colon = strchr(s, ':')) != NULL && strchr(s, '"') == NULL)
+    {
+        *colon = '\0';
+        trim(s);
+        if (!is_ident(s))
+        {
+            error(as, "bad label", s);
+            return;
+        }
+        for (int i = 0; i < as->nlabels; i++)
+        {
+            if (strcmp(as->labels[i].name, s) == 0)
+            {
+                // a listing repeats _start, the same address is fine
+                if (as->labels[i].value != here(as))
+                {
+                    error(as, "label defined twice", s);
+                }
+                s = NULL;
+                break;
+            }
+        }
+        if (s != NULL)
+        {
+            as->labels = grow(as->labels, as->nlabels, sizeof(as_label_t));
+            as_label_t *label = &as->labels[as->nlabels++];
+            label->name = strdup(s);
+            label->value = here(as);
+            label->line = as->line;
+        }
+        s = skip_space(colon + 1);
+    }
+    if (*s)
+    {
+        statement(as, s);
+    }
+}
+
+//=======================================================================
+static as_label_t *find_label(as_state_t *as, const char *name)
+{
+    for (int i = 0; i < as->nlabels; i++)
+    {
+        if (strcmp(as->labels[i].name, name) == 0)
+        {
+            return &as->labels[i];
+        }
+    }
+    return NULL;
+}
+
+//=======================================================================
+/*
+ * Write the Mini-ELF file: header, program headers, segments and, with
+ * symbols, the symbol and string tables.
+ */
+static bool write_elf(as_state_t *as, const char *path, bool symbols)
+{
+    elf_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.e_version = 1;
+    hdr.e_phdr_start = sizeof(elf_hdr_t);
+    hdr.e_num_phdr = as->nsegments;
+    hdr.magic = 0x00464c45;
+
+    as_label_t *start = find_label(as, "_start");
+    uint64_t entry = start ? start->value : as->nsegments ? as->segments[0].vaddr : 0;
+    for (int i = 0; start == NULL && i < as->nsegments; i++)
+    {
+        if (as->segments[i].type == CODE)
+        {
+            entry = as->segments[i].vaddr;
+            break;
+        }
+    }
+    if (entry > UINT16_MAX)
+    {
+        fprintf(stderr, "%s: entry point 0x%lx does not fit in a Mini-ELF header\n",
+                as->file, entry);
+        return false;
+    }
+    hdr.e_entry = entry;
+
+    uint64_t offset = sizeof(elf_hdr_t) + (uint64_t)as->nsegments * sizeof(elf_phdr_t);
+    elf_phdr_t *phdrs = calloc(as->nsegments ? as->nsegments : 1, sizeof(elf_phdr_t));
+    if (phdrs == NULL)
+    {
+        fprintf(stderr, "y86-as: out of memory\n");
+        return false;
+    }
+    for (int i = 0; i < as->nsegments; i++)
+    {
+        phdrs[i].p_offset = offset;
+        phdrs[i].p_filesz = as->segments[i].len;
+        phdrs[i].p_vaddr = as->segments[i].vaddr;
+        phdrs[i].p_type = as->segments[i].type;
+        phdrs[i].p_flag = as->segments[i].flag;
+        phdrs[i].magic = 0xDEADBEEF;
+        offset += as->segments[i].len;
+    }
+
+    size_t strtab_len = 0;
+    if (symbols && as->nlabels > 0)
+    {
+        for (int i = 0; i < as->nlabels; i++)
+        {
+            strtab_len += strlen(as->labels[i].name) + 1;
+        }
+        uint64_t strtab = offset + (uint64_t)as->nlabels * sizeof(elf_sym_t);
+        if (strtab > UINT16_MAX || strtab + strtab_len > UINT16_MAX + 1)
+        {
+            fprintf(stderr, "%s: too large for symbol tables\n", as->file);
+            free(phdrs);
+            return false;
+        }
+        hdr.e_symtab = offset;
+        hdr.e_strtab = strtab;
+    }
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "y86-as: cannot write %s\n", path);
+        free(phdrs);
+        return false;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    fwrite(phdrs, sizeof(elf_phdr_t), as->nsegments, out);
+    for (int i = 0; i < as->nsegments; i++)
+    {
+        // an empty segment (.pos with nothing after it) has no bytes
+        if (as->segments[i].len > 0)
+        {
+            fwrite(as->segments[i].bytes, 1, as->segments[i].len, out);
+        }
+    }
+    if (hdr.e_symtab != 0)
+    {
+        uint16_t name = 0;
+        for (int i = 0; i < as->nlabels; i++)
+        {
+            elf_sym_t sym = { name, (uint16_t)as->labels[i].value };
+            if (as->labels[i].value > UINT16_MAX)
+            {
+                fprintf(stderr, "%s:%d: warning: %s truncated in the symbol table\n",
+                        as->file, as->labels[i].line, as->labels[i].name);
+            }
+            fwrite(&sym, sizeof(sym), 1, out);
+            name += strlen(as->labels[i].name) + 1;
+        }
+        for (int i = 0; i < as->nlabels; i++)
+        {
+            fwrite(as->labels[i].name, 1, strlen(as->labels[i].name) + 1, out);
+        }
+    }
+    free(phdrs);
+    return fclose(out) == 0;
+}
+
+//=======================================================================
+int main(int argc, char **argv)
+{
+    bool symbols = false;
+    char *output = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "hso:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            symbols = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage_as();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage_as();
+        return EXIT_FAILURE;
+    }
+
+    as_state_t as;
+    memset(&as, 0, sizeof(as));
+    as.file = argv[optind];
+    FILE *in = strcmp(as.file, "-") == 0 ? stdin : fopen(as.file, "r");
+    if (in == NULL)
+    {
+        fprintf(stderr, "y86-as: cannot open %s\n", as.file);
+        return EXIT_FAILURE;
+    }
+
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        as.line++;
+        assemble_line(&as, line);
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+
+    for (int i = 0; i < as.nfixups; i++)
+    {
+        as_fixup_t *fix = &as.fixups[i];
+        as_label_t *label = find_label(&as, fix->label);
+        if (label == NULL)
+        {
+            as.line = fix->line;
+            error(&as, "undefined label", fix->label);
+            continue;
+        }
+        uint64_t value = label->value + fix->addend;
+        memcpy(as.segments[fix->segment].bytes + fix->offset, &value, sizeof(value));
+    }
+    if (as.errors > 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // default output: source name with its suffix replaced by .o
+    char *path = output;
+    if (path == NULL)
+    {
+        const char *base = strcmp(as.file, "-") == 0 ? "a.ys" : as.file;
+        path = malloc(strlen(base) + 3);
+        strcpy(path, base);
+        char *dot = strrchr(path, '.');
+        if (dot == NULL || strchr(dot, '/') != NULL)
+        {
+            dot = path + strlen(path);
+        }
+        strcpy(dot, ".o");
+    }
+    bool ok = write_elf(&as, path, symbols);
+    if (path != output)
+    {
+        free(path);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,260 @@
+/*
+ * y86-gen - write a random Y86 program as a Mini-ELF file, for
+ * differential runs of the engines against each other (make check).
+ *
+ * The program is one code segment: every register loaded with an
+ * address inside memory (%rsp with 0xf00), then from 0x100 on random
+ * instructions with every register, condition and operation in use.
+ * Jumps and calls mostly go forward to instruction boundaries; the rest
+ * go anywhere, as do returns. Stores hit the stack, data and the code
+ * itself, so self-modifying code is covered, and a few percent of the
+ * instructions are random bytes. The same seed always gives the same
+ * program. Some programs never halt; callers bound them in time.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/elf.h"
+#include "../headers/y86.h"
+
+#define GEN_INSTS 60                /* instructions per program */
+#define GEN_BASE 0x100              /* address of the first one */
+#define GEN_STACK 0xf00             /* initial %rsp */
+#define GEN_ENTRY (GEN_BASE - NUMREGS * 10)   /* one irmovq per register */
+
+static uint64_t state;
+
+//=======================================================================
+/*
+ * Next number of an xorshift64* sequence, so programs do not depend on
+ * the C library's rand().
+ */
+static uint64_t next(void)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+//=======================================================================
+/*
+ * Random number in [0, n).
+ */
+static uint64_t below(uint64_t n)
+{
+    return next() % n;
+}
+
+//=======================================================================
+static void put8(uint8_t *code, size_t *len, uint64_t value)
+{
+    memcpy(code + *len, &value, sizeof(value));
+    *len += sizeof(value);
+}
+
+//=======================================================================
+/*
+ * A register number, or with none set also the "no register" 0xf.
+ */
+static uint8_t reg(bool none)
+{
+    return below(none ? NUMREGS + 1 : NUMREGS);
+}
+
+//=======================================================================
+/*
+ * An immediate for irmovq: edge values, small addresses or anything.
+ */
+static uint64_t immediate(void)
+{
+    switch (below(8))
+    {
+    case 0:  return 0;
+    case 1:  return 1;
+    case 2:  return (uint64_t)-1;
+    case 3:  return INT64_MAX;
+    case 4:  return (uint64_t)INT64_MIN;
+    case 5:  return below(MEMSIZE);
+    case 6:  return GEN_STACK;
+    default: return next();
+    }
+}
+
+//=======================================================================
+/*
+ * A displacement for rmmovq and mrmovq. Stores are aimed at the code
+ * now and then.
+ */
+static uint64_t displacement(bool store)
+{
+    switch (below(5))
+    {
+    case 0:  return 0;
+    case 1:  return 8;
+    case 2:  return (uint64_t)-8;
+    case 3:  return store ? GEN_BASE + below(0x200) : below(MEMSIZE);
+    default: return below(MEMSIZE);
+    }
+}
+
+//=======================================================================
+/*
+ * Append one random instruction to code and return its kind, the high
+ * nibble of the opcode (0x10 for random bytes).
+ */
+static int instruction(uint8_t *code, size_t *len)
+{
+    static const int kinds[] = {
+        IRMOVQ, IRMOVQ, OPQ, OPQ, OPQ, CMOV, JUMP, RMMOVQ, MRMOVQ,
+        PUSHQ, POPQ, CALL, RET, NOP
+    };
+    int kind = below(100) < 97 ? kinds[below(sizeof(kinds) / sizeof(kinds[0]))] : 0x10;
+    switch (kind)
+    {
+    case IRMOVQ:
+        code[(*len)++] = 0x30;
+        code[(*len)++] = 0xf0 | reg(false);
+        put8(code, len, immediate());
+        break;
+    case OPQ:
+        code[(*len)++] = 0x60 | below(4);
+        code[(*len)++] = reg(false) << 4 | reg(false);
+        break;
+    case CMOV:
+        code[(*len)++] = 0x20 | below(7);
+        code[(*len)++] = reg(false) << 4 | reg(false);
+        break;
+    case JUMP:
+        code[(*len)++] = 0x70 | below(7);
+        put8(code, len, 0);   // target chosen once all addresses are known
+        break;
+    case CALL:
+        code[(*len)++] = 0x80;
+        put8(code, len, 0);
+        break;
+    case RMMOVQ:
+    case MRMOVQ:
+        code[(*len)++] = kind << 4;
+        code[(*len)++] = reg(false) << 4 | reg(true);
+        put8(code, len, displacement(kind == RMMOVQ));
+        break;
+    case PUSHQ:
+    case POPQ:
+        code[(*len)++] = kind << 4;
+        code[(*len)++] = reg(false) << 4 | 0xf;
+        break;
+    case RET:
+        code[(*len)++] = 0x90;
+        break;
+    case NOP:
+        code[(*len)++] = 0x10;
+        break;
+    default:
+        code[(*len)++] = below(256);
+        code[(*len)++] = below(256);
+        break;
+    }
+    return kind;
+}
+
+//=======================================================================
+/*
+ * Write the program of seed to path. Return false if it cannot be
+ * written.
+ */
+static bool generate(uint64_t seed, const char *path)
+{
+    uint8_t code[NUMREGS * 10 + GEN_INSTS * MAX_INST_SIZE + 1];
+    address_t addrs[GEN_INSTS];
+    int kinds[GEN_INSTS];
+    size_t len = 0;
+
+    state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    // base registers that mostly stay inside memory for a while
+    for (int r = 0; r < NUMREGS; r++)
+    {
+        code[len++] = 0x30;
+        code[len++] = 0xf0 | r;
+        put8(code, &len, r == 4 ? GEN_STACK : 0x400 + 0x40 * r);
+    }
+    for (int i = 0; i < GEN_INSTS; i++)
+    {
+        addrs[i] = GEN_ENTRY + len;
+        kinds[i] = instruction(code, &len);
+    }
+    code[len++] = 0x00;
+
+    // jump and call targets: mostly a later instruction, else anywhere
+    for (int i = 0; i < GEN_INSTS; i++)
+    {
+        if (kinds[i] != JUMP && kinds[i] != CALL)
+        {
+            continue;
+        }
+        uint64_t target;
+        if (below(100) < 80)
+        {
+            target = i + 1 < GEN_INSTS ? addrs[i + 1 + below(GEN_INSTS - i - 1)]
+                                       : GEN_ENTRY + len - 1;
+        }
+        else if (below(100) < 95)
+        {
+            target = below(2) ? addrs[below(GEN_INSTS)] : below(MEMSIZE);
+        }
+        else
+        {
+            target = next();
+        }
+        memcpy(code + addrs[i] - GEN_ENTRY + 1, &target, sizeof(target));
+    }
+
+    elf_hdr_t hdr = { 1, GEN_ENTRY, sizeof(elf_hdr_t), 1, 0, 0, 0x00464c45 };
+    elf_phdr_t phdr = { sizeof(elf_hdr_t) + sizeof(elf_phdr_t), len, GEN_ENTRY,
+                        CODE, RX, 0xDEADBEEF };
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        return false;
+    }
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1 &&
+              fwrite(&phdr, sizeof(phdr), 1, out) == 1 &&
+              fwrite(code, 1, len, out) == len;
+    return fclose(out) == 0 && ok;
+}
+
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_gen()
+{
+    printf("Usage: y86-gen seed mini-elf-file\n");
+    printf("Writes the random Y86 program numbered seed.\n");
+}
+
+//=======================================================================
+int main(int argc, char **argv)
+{
+    char *end;
+    if (argc != 3)
+    {
+        usage_gen();
+        return EXIT_FAILURE;
+    }
+    uint64_t seed = strtoull(argv[1], &end, 0);
+    if (*end != '\0')
+    {
+        usage_gen();
+        return EXIT_FAILURE;
+    }
+    if (!generate(seed, argv[2]))
+    {
+        fprintf(stderr, "y86-gen: cannot write %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,245 @@
+/*
+ * y86-rsp - play a scripted gdb session against "y86 -g socket" and print
+ * every packet sent and every reply, for make check.
+ *
+ * The script holds one packet per line, without the $ and checksum;
+ * blank lines and lines starting with # are skipped. "k" ends the
+ * session without waiting for a reply. Console output ("O" packets)
+ * from monitor commands is printed as text.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RSP_BUFSIZE 4096
+#define RSP_CONNECT_TRIES 200        /* 10 ms apart */
+
+static int fd;
+static bool noack;
+
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_rsp()
+{
+    printf("Usage: y86-rsp socket script\n");
+    printf("Connects to y86 -g socket and plays the packets in script,\n");
+    printf("printing each one and its reply.\n");
+}
+
+//=======================================================================
+/*
+ * Connect to the Unix socket at path, waiting for the simulator to
+ * start listening. Return the descriptor, or -1.
+ */
+static int connect_stub(const char *path)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path))
+    {
+        return -1;
+    }
+    strcpy(sun.sun_path, path);
+    struct timespec pause = { 0, 10000000 };
+    for (int i = 0; i < RSP_CONNECT_TRIES; i++)
+    {
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0)
+        {
+            return -1;
+        }
+        if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+        {
+            return sock;
+        }
+        close(sock);
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+//=======================================================================
+/*
+ * Next byte from the stub, or -1 once it has closed the connection.
+ */
+static int next_byte(void)
+{
+    static uint8_t buf[RSP_BUFSIZE];
+    static ssize_t len, pos;
+    if (pos == len)
+    {
+        len = read(fd, buf, sizeof(buf));
+        pos = 0;
+        if (len <= 0)
+        {
+            len = 0;
+            return -1;
+        }
+    }
+    return buf[pos++];
+}
+
+//=======================================================================
+/*
+ * Send the packet data, framed and checksummed, and wait for its ack.
+ * Return false if the stub has gone.
+ */
+static bool send_packet(const char *data)
+{
+    char frame[RSP_BUFSIZE + 4];
+    uint8_t sum = 0;
+    for (const char *p = data; *p != '\0'; p++)
+    {
+        sum += (uint8_t)*p;
+    }
+    int len = snprintf(frame, sizeof(frame), "$%s#%02x", data, sum);
+    if (len < 0 || len >= (int)sizeof(frame) || write(fd, frame, len) != len)
+    {
+        return false;
+    }
+    if (!noack)
+    {
+        int c;
+        while ((c = next_byte()) != '+')
+        {
+            if (c < 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Read the next packet into data (size bytes), acking it and checking
+ * its checksum. Return false if the stub has gone or the packet is bad.
+ */
+static bool recv_packet(char *data, size_t size)
+{
+    int c;
+    while ((c = next_byte()) != '$')
+    {
+        if (c < 0)
+        {
+            return false;
+        }
+    }
+    size_t len = 0;
+    uint8_t sum = 0;
+    while ((c = next_byte()) != '#')
+    {
+        if (c < 0 || len + 1 >= size)
+        {
+            return false;
+        }
+        data[len++] = c;
+        sum += c;
+    }
+    data[len] = '\0';
+    char hex[3] = { 0 };
+    for (int i = 0; i < 2; i++)
+    {
+        if ((c = next_byte()) < 0)
+        {
+            return false;
+        }
+        hex[i] = c;
+    }
+    if (strtoul(hex, NULL, 16) != sum)
+    {
+        return false;
+    }
+    return noack || write(fd, "+", 1) == 1;
+}
+
+//=======================================================================
+/*
+ * Print the hex-encoded console text of an "O" packet.
+ */
+static void print_console(const char *hex)
+{
+    printf("O ");
+    for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2)
+    {
+        char byte[3] = { hex[0], hex[1], '\0' };
+        putchar((int)strtoul(byte, NULL, 16));
+    }
+}
+
+//=======================================================================
+/*
+ * Play the script at path. Return false if the stub misbehaves.
+ */
+static bool play(const char *path)
+{
+    FILE *script = fopen(path, "r");
+    if (script == NULL)
+    {
+        fprintf(stderr, "y86-rsp: cannot open %s\n", path);
+        return false;
+    }
+    static char line[RSP_BUFSIZE], reply[RSP_BUFSIZE];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), script) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        printf("> %s\n", line);
+        ok = send_packet(line);
+        if (!ok || strcmp(line, "k") == 0)
+        {
+            break;
+        }
+        while ((ok = recv_packet(reply, sizeof(reply))) &&
+               reply[0] == 'O' && strcmp(reply, "OK") != 0)
+        {
+            print_console(reply + 1);
+        }
+        if (ok)
+        {
+            printf("< %s\n", reply);
+            noack = noack || (strcmp(line, "QStartNoAckMode") == 0 &&
+                              strcmp(reply, "OK") == 0);
+        }
+    }
+    fclose(script);
+    if (!ok)
+    {
+        fprintf(stderr, "y86-rsp: %s: the stub closed the connection or sent a bad packet\n",
+                path);
+    }
+    return ok;
+}
+
+//=======================================================================
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        usage_rsp();
+        return EXIT_FAILURE;
+    }
+    fd = connect_stub(argv[1]);
+    if (fd < 0)
+    {
+        fprintf(stderr, "y86-rsp: cannot connect to %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    bool ok = play(argv[2]);
+    close(fd);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
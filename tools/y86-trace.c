@@ -0,0 +1,156 @@
+/*
+ * y86-trace - render a binary trace written by "y86 -T file" as the
+ * text "y86 -E" would have printed for the execution. Given the traced
+ * Mini-ELF file as well, instructions at its symbols get label lines.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../headers/loader.h"
+#include "../headers/trace.h"
+
+//=======================================================================
+/*
+ * Print the usage message for this program.
+ */
+void usage_trace()
+{
+    printf("Usage: y86-trace trace-file [mini-elf-file]\n");
+    printf("Renders a binary trace written by y86 -T as -E text, labelled\n");
+    printf("with the symbols of mini-elf-file if given.\n");
+}
+
+//=======================================================================
+/*
+ * Rebuild the instruction described by rec.
+ */
+static y86_inst_t rec_inst(const trace_rec_t *rec)
+{
+    y86_inst_t inst;
+    memset(&inst, 0, sizeof(inst));
+    inst.type = rec->type;
+    inst.cmov = rec->sub;
+    inst.op = rec->sub;
+    inst.jump = rec->sub;
+    inst.ra = rec->regs >> 4;
+    inst.rb = rec->regs & 0xF;
+    inst.opcode = rec->opcode;
+    switch (inst.type)
+    {
+    case (IRMOVQ):
+        inst.value = rec->operand;
+        break;
+    case (RMMOVQ):
+    case (MRMOVQ):
+        inst.d = rec->operand;
+        break;
+    default:
+        inst.dest = rec->operand;
+        break;
+    }
+    return inst;
+}
+
+//=======================================================================
+/*
+ * Unpack the flags and status of a trace state byte into cpu.
+ */
+static void apply_state(y86_t *cpu, uint8_t state)
+{
+    cpu->zf = state & 1;
+    cpu->sf = (state >> 1) & 1;
+    cpu->of = (state >> 2) & 1;
+    cpu->stat = state >> 4;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        usage_trace();
+        exit(EXIT_FAILURE);
+    }
+
+    elf_image_t image;
+    symbol_index_t syms = { NULL, 0 };
+    if (argc == 3)
+    {
+        if (!map_image(argv[2], &image) || !image_header(&image) ||
+            !image_symbols(&image, &syms))
+        {
+            printf("Failed to Read Symbols\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        printf("Failed to open File\n");
+        exit(EXIT_FAILURE);
+    }
+
+    trace_file_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || hdr.magic != TRACE_MAGIC ||
+        hdr.version != TRACE_VERSION)
+    {
+        printf("Failed to Read Trace Header\n");
+        fclose(in);
+        exit(EXIT_FAILURE);
+    }
+
+    y86_t cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    memcpy(cpu.regs, hdr.regs, sizeof(hdr.regs));
+    cpu.pc = hdr.pc;
+    apply_state(&cpu, hdr.state);
+
+    trace_t trace;
+    if (!trace_open(&trace, STDOUT_FILENO, NULL))
+    {
+        fclose(in);
+        exit(EXIT_FAILURE);
+    }
+    trace.syms = &syms;
+    trace_begin(&trace, &cpu);
+
+    trace_rec_t rec;
+    trace_reg_t regs[NUMREGS];
+    trace_store_t stores[TRACE_MAXSTORES];
+    while (fread(&rec, sizeof(rec), 1, in) == 1)
+    {
+        if (rec.nregs > NUMREGS || rec.nstores > TRACE_MAXSTORES ||
+            fread(regs, sizeof(trace_reg_t), rec.nregs, in) != rec.nregs ||
+            fread(stores, sizeof(trace_store_t), rec.nstores, in) != rec.nstores)
+        {
+            trace_close(&trace);
+            printf("Truncated trace record\n");
+            fclose(in);
+            exit(EXIT_FAILURE);
+        }
+
+        address_t pc = cpu.pc;
+        for (int i = 0; i < rec.nregs; i++)
+        {
+            cpu.regs[regs[i].reg & 0xF] = regs[i].value;
+        }
+        cpu.regs[BADREG] = 0;
+        cpu.pc = rec.pc;
+        apply_state(&cpu, rec.state);
+
+        y86_inst_t inst = rec_inst(&rec);
+        trace_emit_step(&trace, pc, &inst, (rec.state >> 3) & 1,
+                        stores, rec.nstores, &cpu);
+    }
+
+    trace_close(&trace);
+    fclose(in);
+    if (argc == 3)
+    {
+        free_symbols(&syms);
+        unmap_image(&image);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,421 @@
+/*
+ * Buffered writer for the -E debug trace.
+ *
+ * Produces exactly the text of disassemble() and dump_cpu() but formats
+ * it by hand into a large buffer that is handed to write() in big
+ * chunks, instead of going through printf for every field. Optionally
+ * emits compact binary records (see trace.h) that y86-trace renders
+ * back into the same text later.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./headers/trace.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char *reg_names[] = {
+    "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi",
+    "%rdi", "%r8", "%r9", "%r10", "%r11", "%r12", "%r13",
+    "%r14", "%r15"};
+
+// trace receiving stores from trace_mem_write()
+static trace_t *active = NULL;
+//=======================================================================
+/*
+ * Set up t to write text to fd, or binary records to bin when not NULL.
+ * Returns false if the buffer could not be allocated.
+ */
+bool trace_open(trace_t *t, int fd, FILE *bin)
+{
+    if (t == NULL)
+    {
+        return false;
+    }
+    memset(t, 0, sizeof(*t));
+    t->fd = fd;
+    t->bin = bin;
+    t->buf = malloc(TRACE_BUFSIZE);
+    if (t->buf == NULL)
+    {
+        return false;
+    }
+    active = t;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Write out all buffered text.
+ */
+void trace_flush(trace_t *t)
+{
+    size_t done = 0;
+    while (done < t->len)
+    {
+        ssize_t n = write(t->fd, t->buf + done, t->len - done);
+        if (n <= 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    t->len = 0;
+}
+
+//=======================================================================
+/*
+ * Flush and release t.
+ */
+void trace_close(trace_t *t)
+{
+    if (t == NULL || t->buf == NULL)
+    {
+        return;
+    }
+    trace_flush(t);
+    if (t->bin != NULL)
+    {
+        fflush(t->bin);
+    }
+    free(t->buf);
+    t->buf = NULL;
+    if (active == t)
+    {
+        active = NULL;
+    }
+}
+
+//=======================================================================
+/*
+ * Make room for n more bytes of text.
+ */
+static inline char *reserve(trace_t *t, size_t n)
+{
+    if (t->len + n > TRACE_BUFSIZE)
+    {
+        trace_flush(t);
+    }
+    return t->buf + t->len;
+}
+
+//=======================================================================
+/*
+ * Append the string s.
+ */
+void trace_str(trace_t *t, const char *s)
+{
+    size_t n = strlen(s);
+    memcpy(reserve(t, n), s, n);
+    t->len += n;
+}
+
+//=======================================================================
+/*
+ * Append value in lower-case hex, zero padded to at least width digits
+ * (the same as printf's "%0*lx").
+ */
+void trace_hex(trace_t *t, uint64_t value, int width)
+{
+    char digits[16];
+    int n = 0;
+    do
+    {
+        digits[n++] = hex_digits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    while (n < width && n < 16)
+    {
+        digits[n++] = '0';
+    }
+
+    char *out = reserve(t, n);
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = digits[n - 1 - i];
+    }
+    t->len += n;
+}
+
+//=======================================================================
+/*
+ * Append a single character.
+ */
+static inline void trace_char(trace_t *t, char c)
+{
+    *reserve(t, 1) = c;
+    t->len++;
+}
+
+//=======================================================================
+/*
+ * Append "name rA, rB" style operands.
+ */
+static void trace_rr(trace_t *t, const char *name, const y86_inst_t *inst)
+{
+    trace_str(t, name);
+    trace_char(t, ' ');
+    trace_str(t, reg_names[inst->ra & 0xF]);
+    trace_str(t, ", ");
+    trace_str(t, reg_names[inst->rb & 0xF]);
+    trace_char(t, '\n');
+}
+
+//=======================================================================
+/*
+ * Append the disassembly of inst, same text as disassemble().
+ */
+void trace_inst(trace_t *t, const y86_inst_t *inst)
+{
+    static const char *cmov_names[] = {
+        "rrmovq", "cmovle", "cmovl", "cmove", "cmovne", "cmovge", "cmovg", "cmovg"};
+    static const char *op_names[] = {"addq", "subq", "andq", "xorq", "xorq"};
+    static const char *jump_names[] = {
+        "jmp", "jle", "jl", "je", "jne", "jge", "jg", "jg"};
+
+    switch (inst->type)
+    {
+    case HALT:
+        trace_str(t, "halt\n");
+        break;
+    case NOP:
+        trace_str(t, "nop\n");
+        break;
+    case CMOV:
+        trace_rr(t, cmov_names[inst->cmov <= BADCMOV ? inst->cmov : BADCMOV], inst);
+        break;
+    case IRMOVQ:
+        trace_str(t, "irmovq 0x");
+        trace_hex(t, inst->value, 1);
+        trace_str(t, ", ");
+        trace_str(t, reg_names[inst->rb & 0xF]);
+        trace_char(t, '\n');
+        break;
+    case RMMOVQ:
+        trace_str(t, "rmmovq ");
+        trace_str(t, reg_names[inst->ra & 0xF]);
+        trace_str(t, ", 0x");
+        trace_hex(t, inst->d, 1);
+        if (inst->rb != BADREG)
+        {
+            trace_char(t, '(');
+            trace_str(t, reg_names[inst->rb & 0xF]);
+            trace_char(t, ')');
+        }
+        trace_char(t, '\n');
+        break;
+    case MRMOVQ:
+        trace_str(t, "mrmovq 0x");
+        trace_hex(t, inst->d, 1);
+        if (inst->rb != BADREG)
+        {
+            trace_char(t, '(');
+            trace_str(t, reg_names[inst->rb & 0xF]);
+            trace_char(t, ')');
+        }
+        trace_str(t, ", ");
+        trace_str(t, reg_names[inst->ra & 0xF]);
+        trace_char(t, '\n');
+        break;
+    case OPQ:
+        trace_rr(t, op_names[inst->op <= BADOP ? inst->op : BADOP], inst);
+        break;
+    case JUMP:
+        trace_str(t, jump_names[inst->jump <= BADJUMP ? inst->jump : BADJUMP]);
+        trace_str(t, " 0x");
+        trace_hex(t, inst->dest, 1);
+        trace_char(t, '\n');
+        break;
+    case CALL:
+        trace_str(t, "call 0x");
+        trace_hex(t, inst->dest, 1);
+        trace_char(t, '\n');
+        break;
+    case RET:
+        trace_str(t, "ret\n");
+        break;
+    case PUSHQ:
+        trace_str(t, "pushq ");
+        trace_str(t, reg_names[inst->ra & 0xF]);
+        trace_char(t, '\n');
+        break;
+    case POPQ:
+        trace_str(t, "popq ");
+        trace_str(t, reg_names[inst->ra & 0xF]);
+        trace_char(t, '\n');
+        break;
+    default:
+        trace_str(t, "invalid\n");
+    }
+}
+
+//=======================================================================
+/*
+ * Append one "  %rax: ...    %rcx: ..." line of the register dump.
+ */
+static void trace_reg_pair(trace_t *t, const char *left, y86_register_t a,
+                           const char *right, y86_register_t b)
+{
+    trace_str(t, left);
+    trace_hex(t, a, 16);
+    trace_str(t, right);
+    trace_hex(t, b, 16);
+    trace_char(t, '\n');
+}
+
+//=======================================================================
+/*
+ * Append the CPU state, same text as dump_cpu().
+ */
+void trace_cpu(trace_t *t, const y86_t *cpu)
+{
+    static const char *stat_names[] = {"", "AOK\n", "HLT\n", "ADR\n", "INS\n"};
+
+    trace_str(t, "dump of Y86 CPU:\n  %rip: ");
+    trace_hex(t, cpu->pc, 16);
+    trace_str(t, "   flags: SF");
+    trace_char(t, '0' + cpu->sf);
+    trace_str(t, " ZF");
+    trace_char(t, '0' + cpu->zf);
+    trace_str(t, " OF");
+    trace_char(t, '0' + cpu->of);
+    trace_str(t, "  ");
+    if (cpu->stat >= AOK && cpu->stat <= INS)
+    {
+        trace_str(t, stat_names[cpu->stat]);
+    }
+    trace_reg_pair(t, "  %rax: ", cpu->rax, "    %rcx: ", cpu->rcx);
+    trace_reg_pair(t, "  %rdx: ", cpu->rdx, "    %rbx: ", cpu->rbx);
+    trace_reg_pair(t, "  %rsp: ", cpu->rsp, "    %rbp: ", cpu->rbp);
+    trace_reg_pair(t, "  %rsi: ", cpu->rsi, "    %rdi: ", cpu->rdi);
+    trace_reg_pair(t, "   %r8: ", cpu->r8, "     %r9: ", cpu->r9);
+    trace_reg_pair(t, "  %r10: ", cpu->r10, "    %r11: ", cpu->r11);
+    trace_reg_pair(t, "  %r12: ", cpu->r12, "    %r13: ", cpu->r13);
+    trace_str(t, "  %r14: ");
+    trace_hex(t, cpu->r14, 16);
+    trace_str(t, "\n\n");
+}
+
+//=======================================================================
+/*
+ * Memory trace sink (see set_mem_trace()) collecting the stores of the
+ * instruction being traced.
+ */
+void trace_mem_write(address_t addr, y86_register_t value)
+{
+    if (active == NULL || active->nstores == TRACE_MAXSTORES)
+    {
+        return;
+    }
+    active->stores[active->nstores].addr = addr;
+    active->stores[active->nstores].value = value;
+    active->nstores++;
+}
+
+//=======================================================================
+/*
+ * Start a trace from the initial CPU state.
+ */
+void trace_begin(trace_t *t, const y86_t *cpu)
+{
+    if (t->bin != NULL)
+    {
+        trace_file_hdr_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = TRACE_MAGIC;
+        hdr.version = TRACE_VERSION;
+        memcpy(hdr.regs, cpu->regs, sizeof(hdr.regs));
+        hdr.pc = cpu->pc;
+        hdr.state = TRACE_STATE(cpu, false);
+        fwrite(&hdr, sizeof(hdr), 1, t->bin);
+        return;
+    }
+    trace_str(t, "Initial ");
+    trace_cpu(t, cpu);
+}
+
+//=======================================================================
+/*
+ * Emit the text for one executed instruction: the disassembly, the
+ * corrupt instruction notice, its stores and the resulting CPU state.
+ * pc is the address the instruction was fetched from.
+ */
+void trace_emit_step(trace_t *t, address_t pc, const y86_inst_t *inst,
+                     bool corrupt, const trace_store_t *stores,
+                     int nstores, const y86_t *after)
+{
+    int n = 0;
+    const elf_symbol_t *sym = symbol_at(t->syms, pc, &n);
+    for (int i = 0; i < n; i++)
+    {
+        trace_str(t, sym[i].name);
+        trace_str(t, ":\n");
+    }
+    trace_str(t, "Executing: ");
+    trace_inst(t, inst);
+    if (corrupt)
+    {
+        trace_str(t, "Corrupt Instruction (opcode 0x");
+        trace_hex(t, inst->opcode, 2);
+        trace_str(t, ") at address 0x");
+        trace_hex(t, pc, 4);
+        trace_char(t, '\n');
+    }
+    for (int i = 0; i < nstores; i++)
+    {
+        trace_str(t, "Memory write to 0x");
+        trace_hex(t, stores[i].addr, 4);
+        trace_str(t, ": 0x");
+        trace_hex(t, stores[i].value, 1);
+        trace_char(t, '\n');
+    }
+    trace_str(t, after->stat == INS ? "Post-Fetch " : "Post-Exec ");
+    trace_cpu(t, after);
+}
+
+//=======================================================================
+/*
+ * Record one executed instruction. before and after are the CPU state
+ * around it, corrupt is set when decoding found an invalid opcode.
+ */
+void trace_step(trace_t *t, const y86_t *before, const y86_inst_t *inst,
+                const y86_t *after, bool corrupt)
+{
+    if (t->bin == NULL)
+    {
+        trace_emit_step(t, before->pc, inst, corrupt, t->stores, t->nstores, after);
+        t->nstores = 0;
+        return;
+    }
+
+    trace_reg_t regs[NUMREGS];
+    trace_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = inst->type;
+    rec.sub = inst->type == CMOV ? inst->cmov : inst->type == OPQ ? inst->op
+                                            : inst->jump;
+    rec.regs = (inst->ra & 0xF) << 4 | (inst->rb & 0xF);
+    rec.opcode = inst->opcode;
+    rec.state = TRACE_STATE(after, corrupt);
+    rec.operand = inst->type == IRMOVQ ? (uint64_t)inst->value
+                  : inst->type == RMMOVQ || inst->type == MRMOVQ ? (uint64_t)inst->d
+                                                                 : inst->dest;
+    rec.pc = after->pc;
+    for (int i = 0; i < NUMREGS; i++)
+    {
+        if (before->regs[i] != after->regs[i])
+        {
+            regs[rec.nregs].reg = i;
+            regs[rec.nregs].value = after->regs[i];
+            rec.nregs++;
+        }
+    }
+    rec.nstores = t->nstores;
+
+    fwrite(&rec, sizeof(rec), 1, t->bin);
+    fwrite(regs, sizeof(trace_reg_t), rec.nregs, t->bin);
+    fwrite(t->stores, sizeof(trace_store_t), rec.nstores, t->bin);
+    t->nstores = 0;
+}
@@ -0,0 +1,442 @@
+/*
+ * Undo log for reverse execution.
+ *
+ * undo_step() executes one instruction like execute_step() and first
+ * appends what it is about to overwrite: the registers it writes back,
+ * the quad it stores, the pc and the flags. Stepping back pops records
+ * and puts the old values back, so going back N instructions costs N
+ * small records instead of a rerun from the start.
+ *
+ * A record is laid out oldest field first with a trailer byte at the
+ * end, so the log can be walked backwards:
+ *
+ *   [reg, old value] x nregs   [addr, old quad] if stored   pc   trailer
+ *
+ * Keyframes, a copy of the cpu and memory every UNDO_KEYFRAME_INTERVAL
+ * instructions, bound the log: when it outgrows UNDO_BUDGET the records
+ * of the oldest segment go first and are rebuilt from its keyframe if
+ * execution is ever stepped back that far.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/decode-cache.h"
+#include "./headers/interpret.h"
+#include "./headers/mem-access.h"
+#include "./headers/undo.h"
+
+#define REC_STORE 0x04            // trailer: a quad was stored
+#define REC_ZF 0x08               // trailer: flags before the instruction
+#define REC_SF 0x10
+#define REC_OF 0x20
+#define REC_MAX (2 * 9 + 16 + 8 + 1)
+
+//=======================================================================
+/*
+ * Bytes of the record ending in trailer.
+ */
+static inline size_t rec_size(uint8_t trailer)
+{
+    return (trailer & 3) * 9 + (trailer & REC_STORE ? 16 : 0) + 8 + 1;
+}
+
+//=======================================================================
+static void free_segment(undo_segment_t *seg)
+{
+    free(seg->index);
+    free(seg->pages);
+    free(seg->log);
+    memset(seg, 0, sizeof(*seg));
+}
+
+//=======================================================================
+/*
+ * Start a new segment with a keyframe of cpu and memory.
+ * Return false if out of memory.
+ */
+static bool keyframe(undo_log_t *log, y86_t *cpu, memory_t memory)
+{
+    if (log->nsegs == log->cap)
+    {
+        int cap = log->cap ? log->cap * 2 : 16;
+        undo_segment_t *segs = realloc(log->segs, cap * sizeof(undo_segment_t));
+        if (segs == NULL)
+        {
+            return false;
+        }
+        log->segs = segs;
+        log->cap = cap;
+    }
+    undo_segment_t *seg = &log->segs[log->nsegs];
+    memset(seg, 0, sizeof(*seg));
+
+    settle_flags(cpu);
+    seg->cpu = *cpu;
+    seg->start = log->count;
+    seg->npages = memory->used.count;
+    seg->index = malloc(seg->npages * sizeof(uint64_t) + 1);
+    seg->pages = malloc(seg->npages * PAGESIZE + 1);
+    if (seg->index == NULL || seg->pages == NULL)
+    {
+        free_segment(seg);
+        return false;
+    }
+    for (uint64_t n = 0; n < seg->npages; n++)
+    {
+        uint64_t i = memory->used.pages[n];
+        seg->index[n] = i;
+        memcpy(seg->pages + n * PAGESIZE, memory->pages[i], PAGESIZE);
+    }
+    log->bytes += seg->npages * PAGESIZE;
+    log->nsegs++;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Put cpu and memory back to the keyframe of seg.
+ */
+static bool restore_keyframe(undo_log_t *log, undo_segment_t *seg,
+                             y86_t *cpu, memory_t memory)
+{
+    mem_clear(memory);
+    for (uint64_t i = 0; i < seg->npages; i++)
+    {
+        uint8_t *page = mem_alloc_page(memory, seg->index[i] << PAGEBITS);
+        if (page == NULL)
+        {
+            return false;
+        }
+        memcpy(page, seg->pages + i * PAGESIZE, PAGESIZE);
+    }
+    *cpu = seg->cpu;
+    log->count = seg->start;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Free old records, then old keyframes, until the log fits its budget.
+ * The segment execution is in is always kept.
+ */
+static void trim(undo_log_t *log)
+{
+    while (log->bytes > UNDO_BUDGET && log->nsegs > 1)
+    {
+        int i = 0;
+        while (i < log->nsegs - 1 && log->segs[i].dropped)
+        {
+            i++;
+        }
+        if (i < log->nsegs - 1)
+        {
+            log->bytes -= log->segs[i].cap;
+            free(log->segs[i].log);
+            log->segs[i].log = NULL;
+            log->segs[i].len = log->segs[i].cap = 0;
+            log->segs[i].dropped = true;
+            continue;
+        }
+        // every old log is gone, the oldest keyframe goes next
+        log->bytes -= log->segs[0].npages * PAGESIZE;
+        free_segment(&log->segs[0]);
+        memmove(&log->segs[0], &log->segs[1], (log->nsegs - 1) * sizeof(undo_segment_t));
+        log->nsegs--;
+    }
+}
+
+//=======================================================================
+/*
+ * Start recording the machine in cpu and memory, which has executed
+ * count instructions so far. Return false if out of memory.
+ */
+bool undo_init(undo_log_t *log, y86_t *cpu, memory_t memory, uint64_t count)
+{
+    memset(log, 0, sizeof(*log));
+    log->count = count;
+    return keyframe(log, cpu, memory);
+}
+
+//=======================================================================
+/*
+ * Execute the next instruction, recording how to undo it. Nothing
+ * happens once the cpu has stopped. Return false if out of memory.
+ */
+bool undo_step(undo_log_t *log, y86_t *cpu, memory_t memory)
+{
+    if (cpu->stat != AOK)
+    {
+        return true;
+    }
+    undo_segment_t *seg = &log->segs[log->nsegs - 1];
+    if (seg->edit || log->count - seg->start >= UNDO_KEYFRAME_INTERVAL ||
+        seg->len >= UNDO_BUDGET / 4)
+    {
+        if (!keyframe(log, cpu, memory))
+        {
+            return false;
+        }
+        seg = &log->segs[log->nsegs - 1];
+    }
+    if (seg->cap - seg->len < REC_MAX)
+    {
+        size_t cap = seg->cap ? seg->cap * 2 : 1 << 16;
+        uint8_t *buf = realloc(seg->log, cap);
+        if (buf == NULL)
+        {
+            return false;
+        }
+        log->bytes += cap - seg->cap;
+        seg->log = buf;
+        seg->cap = cap;
+    }
+
+    settle_flags(cpu);
+    y86_t probe = *cpu;
+    y86_inst_t ins = fetch_cached(&probe, memory);
+
+    // registers the instruction can write back, and the quad it can store
+    uint8_t regs[2];
+    int nregs = 0;
+    bool store = false;
+    address_t addr = 0;
+    switch (ins.type)
+    {
+    case CMOV:
+    case IRMOVQ:
+    case OPQ:
+        regs[nregs++] = ins.rb & 0xF;
+        break;
+    case MRMOVQ:
+        regs[nregs++] = ins.ra & 0xF;
+        break;
+    case RMMOVQ:
+        store = true;
+        addr = cpu->regs[ins.rb & 0xF] + ins.d;
+        break;
+    case CALL:
+    case PUSHQ:
+        regs[nregs++] = RSP;
+        store = true;
+        addr = cpu->rsp - 8;
+        break;
+    case RET:
+        regs[nregs++] = RSP;
+        break;
+    case POPQ:
+        regs[nregs++] = RSP;
+        regs[nregs++] = ins.ra & 0xF;
+        break;
+    default:
+        break;
+    }
+    // a store beyond the address space faults instead, with the bounds
+    // memory_wb_pc() uses: rmmovq may still store at the size itself
+    store = store && (ins.type == RMMOVQ ? addr <= mem_size(memory)
+                                         : addr < mem_size(memory));
+
+    uint8_t *rec = seg->log + seg->len;
+    for (int i = 0; i < nregs; i++)
+    {
+        *rec++ = regs[i];
+        memcpy(rec, &cpu->regs[regs[i]], 8);
+        rec += 8;
+    }
+    if (store)
+    {
+        uint64_t old = mem_read64(memory, addr);
+        memcpy(rec, &addr, 8);
+        memcpy(rec + 8, &old, 8);
+        rec += 16;
+    }
+    memcpy(rec, &cpu->pc, 8);
+    rec += 8;
+    *rec++ = nregs | (store ? REC_STORE : 0) | (cpu->zf ? REC_ZF : 0) |
+             (cpu->sf ? REC_SF : 0) | (cpu->of ? REC_OF : 0);
+    seg->len = rec - seg->log;
+
+    execute_step(cpu, memory);
+    log->count++;
+    trim(log);
+    return true;
+}
+
+//=======================================================================
+/*
+ * Save cpu and memory before they are changed other than by executing,
+ * e.g. by a debugger, so that stepping back past this point undoes the
+ * change as well. Call it before every such change; a run of changes
+ * with no instruction between them shares one keyframe. Return false
+ * if out of memory, the log then no longer matches the machine.
+ */
+bool undo_edit(undo_log_t *log, y86_t *cpu, memory_t memory)
+{
+    if (log->segs[log->nsegs - 1].edit)
+    {
+        return true;
+    }
+    if (!keyframe(log, cpu, memory))
+    {
+        return false;
+    }
+    log->segs[log->nsegs - 1].edit = true;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Undo the last record of seg.
+ */
+static void pop_record(undo_log_t *log, undo_segment_t *seg, y86_t *cpu,
+                       memory_t memory)
+{
+    uint8_t trailer = seg->log[seg->len - 1];
+    seg->len -= rec_size(trailer);
+    const uint8_t *rec = seg->log + seg->len;
+    for (int i = 0; i < (trailer & 3); i++)
+    {
+        memcpy(&cpu->regs[rec[0]], rec + 1, 8);
+        rec += 9;
+    }
+    cpu->regs[BADREG] = 0;
+    if (trailer & REC_STORE)
+    {
+        address_t addr;
+        uint64_t old;
+        memcpy(&addr, rec, 8);
+        memcpy(&old, rec + 8, 8);
+        mem_write64(memory, addr, old);
+        decode_cache_invalidate(memory, addr, sizeof(old));
+        rec += 16;
+    }
+    memcpy(&cpu->pc, rec, 8);
+    cpu->zf = (trailer & REC_ZF) != 0;
+    cpu->sf = (trailer & REC_SF) != 0;
+    cpu->of = (trailer & REC_OF) != 0;
+    cpu->cc_op = CC_NONE;
+    cpu->stat = AOK;
+    log->count--;
+}
+
+//=======================================================================
+/*
+ * Execute the last segment again from its keyframe, recording, up to
+ * where execution is now. Stores are not traced, watched or marked dirty
+ * a second time.
+ */
+static bool rebuild(undo_log_t *log, y86_t *cpu, memory_t memory)
+{
+    undo_segment_t *seg = &log->segs[log->nsegs - 1];
+    uint64_t target = log->count;
+    if (!restore_keyframe(log, seg, cpu, memory))
+    {
+        return false;
+    }
+    seg->dropped = false;
+    mem_trace_t sink = memory->trace;
+    bool hooks = memory->store_hooks;
+    memory->trace = NULL;
+    memory->store_hooks = false;
+    bool ok = true;
+    while (ok && log->count < target)
+    {
+        ok = undo_step(log, cpu, memory);
+    }
+    memory->trace = sink;
+    memory->store_hooks = hooks;
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Undo the last instruction executed. Return false if there is none
+ * left in the log.
+ */
+static bool back_one(undo_log_t *log, y86_t *cpu, memory_t memory)
+{
+    while (log->nsegs > 0)
+    {
+        undo_segment_t *seg = &log->segs[log->nsegs - 1];
+        if (seg->edit)
+        {
+            // undo the outside change made after this keyframe
+            if (!restore_keyframe(log, seg, cpu, memory))
+            {
+                return false;
+            }
+            seg->edit = false;
+            continue;
+        }
+        if (seg->dropped && log->count > seg->start)
+        {
+            if (!rebuild(log, cpu, memory))
+            {
+                return false;
+            }
+            continue;
+        }
+        if (seg->len > 0)
+        {
+            pop_record(log, seg, cpu, memory);
+            return true;
+        }
+        if (log->nsegs == 1)
+        {
+            return false;
+        }
+        // back at the keyframe, the segment before ends here
+        log->bytes -= seg->cap + seg->npages * PAGESIZE;
+        free_segment(seg);
+        log->nsegs--;
+    }
+    return false;
+}
+
+//=======================================================================
+/*
+ * Step back n instructions, fewer if the log starts sooner. Return the
+ * number undone.
+ */
+uint64_t undo_back(undo_log_t *log, y86_t *cpu, memory_t memory, uint64_t n)
+{
+    uint64_t done = 0;
+    while (done < n && back_one(log, cpu, memory))
+    {
+        done++;
+    }
+    return done;
+}
+
+//=======================================================================
+/*
+ * Step back until the pc is one of the nbreaks addresses in breaks, or
+ * the log starts. Return the number of instructions undone.
+ */
+uint64_t undo_back_to(undo_log_t *log, y86_t *cpu, memory_t memory,
+                      const address_t *breaks, int nbreaks)
+{
+    uint64_t done = 0;
+    while (back_one(log, cpu, memory))
+    {
+        done++;
+        for (int i = 0; i < nbreaks; i++)
+        {
+            if (cpu->pc == breaks[i])
+            {
+                return done;
+            }
+        }
+    }
+    return done;
+}
+
+//=======================================================================
+void undo_free(undo_log_t *log)
+{
+    for (int i = 0; i < log->nsegs; i++)
+    {
+        free_segment(&log->segs[i]);
+    }
+    free(log->segs);
+    memset(log, 0, sizeof(*log));
+}
@@ -0,0 +1,352 @@
+/*
+ * The simulator as a library, see y86sim.h.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "./headers/y86sim.h"
+#include "./headers/batch.h"
+#include "./headers/loader.h"
+#include "./headers/mem-access.h"
+#include "./headers/interpret.h"
+#include "./headers/decode-cache.h"
+#include "./headers/undo.h"
+
+struct y86sim {
+    y86_context_t ctx;
+    uint64_t      count;   /* instructions executed since the last load */
+    const char   *error;   /* why the last load failed, or NULL */
+    undo_log_t   *undo;    /* recording for reverse execution, or NULL */
+};
+
+//=======================================================================
+/*
+ * Create a simulator with an address space of 1 << vaddrbits bytes.
+ * Return NULL if vaddrbits is out of range or allocation fails.
+ */
+y86sim_t *y86sim_create(int vaddrbits)
+{
+    y86sim_t *sim = calloc(1, sizeof(*sim));
+    if (sim == NULL)
+    {
+        return NULL;
+    }
+    if (!context_init(&sim->ctx, vaddrbits))
+    {
+        free(sim);
+        return NULL;
+    }
+    set_mem_trace(sim->ctx.mem, NULL);
+    sim->ctx.cpu.stat = HLT;
+    sim->ctx.cpu.memsize = mem_size(sim->ctx.mem);
+    return sim;
+}
+
+//=======================================================================
+void y86sim_destroy(y86sim_t *sim)
+{
+    if (sim == NULL)
+    {
+        return;
+    }
+    y86sim_record(sim, false);
+    context_free(&sim->ctx);
+    free(sim);
+}
+
+//=======================================================================
+/*
+ * Replace the program of sim with img and reset the cpu.
+ */
+static bool load(y86sim_t *sim, elf_image_t *img)
+{
+    y86sim_record(sim, false);
+    mem_clear(sim->ctx.mem);
+    sim->count = 0;
+
+    y86_t *cpu = &sim->ctx.cpu;
+    memset(cpu, 0x00, sizeof(*cpu));
+    cpu->memsize = mem_size(sim->ctx.mem);
+
+    sim->error = image_load(img, sim->ctx.mem);
+    if (sim->error != NULL)
+    {
+        cpu->stat = HLT;
+        return false;
+    }
+    cpu->stat = AOK;
+    cpu->pc = img->hdr->e_entry;
+    return true;
+}
+
+//=======================================================================
+/*
+ * Load image, the len bytes of a Mini-ELF file, replacing whatever was
+ * loaded before, and reset the cpu to its entry point. Return false if
+ * the image is invalid, see y86sim_error().
+ */
+bool y86sim_load(y86sim_t *sim, const void *image, size_t len)
+{
+    elf_image_t img;
+    image_from_buffer(image, len, &img);
+    return load(sim, &img);
+}
+
+//=======================================================================
+/*
+ * Same as y86sim_load() with the contents of the file at path.
+ */
+bool y86sim_load_file(y86sim_t *sim, const char *path)
+{
+    elf_image_t img;
+    if (!map_image(path, &img))
+    {
+        y86sim_record(sim, false);
+        mem_clear(sim->ctx.mem);
+        memset(&sim->ctx.cpu, 0x00, sizeof(sim->ctx.cpu));
+        sim->ctx.cpu.stat = HLT;
+        sim->ctx.cpu.memsize = mem_size(sim->ctx.mem);
+        sim->count = 0;
+        sim->error = "Failed to open File";
+        return false;
+    }
+    bool ok = load(sim, &img);
+    unmap_image(&img);
+    return ok;
+}
+
+//=======================================================================
+/*
+ * Message of the last failed load, or NULL if it succeeded.
+ */
+const char *y86sim_error(const y86sim_t *sim)
+{
+    return sim->error;
+}
+
+//=======================================================================
+/*
+ * Execute up to n instructions, fewer if the cpu stops first.
+ * Return the number executed.
+ */
+uint64_t y86sim_step(y86sim_t *sim, uint64_t n)
+{
+    y86_t *cpu = &sim->ctx.cpu;
+    uint64_t done = 0;
+    while (done < n && cpu->stat == AOK)
+    {
+        if (sim->undo == NULL)
+        {
+            execute_step(cpu, sim->ctx.mem);
+        }
+        else if (!undo_step(sim->undo, cpu, sim->ctx.mem))
+        {
+            // out of memory for the log
+            break;
+        }
+        done++;
+    }
+    // y86sim_flags() and y86sim_cpu() see the flags in the cpu
+    settle_flags(cpu);
+    sim->count += done;
+    return done;
+}
+
+//=======================================================================
+/*
+ * Execute until the cpu leaves the AOK state.
+ * Return the number of instructions executed.
+ */
+uint64_t y86sim_run(y86sim_t *sim)
+{
+    return y86sim_step(sim, UINT64_MAX);
+}
+
+//=======================================================================
+/*
+ * Instructions executed since the last load.
+ */
+uint64_t y86sim_count(const y86sim_t *sim)
+{
+    return sim->count;
+}
+
+//=======================================================================
+/*
+ * Start (on) or stop recording execution for reverse stepping. Starting
+ * while recording keeps the log. Return false if out of memory.
+ */
+bool y86sim_record(y86sim_t *sim, bool on)
+{
+    if (!on)
+    {
+        if (sim->undo != NULL)
+        {
+            undo_free(sim->undo);
+            free(sim->undo);
+            sim->undo = NULL;
+        }
+        return true;
+    }
+    if (sim->undo != NULL)
+    {
+        return true;
+    }
+    sim->undo = malloc(sizeof(undo_log_t));
+    if (sim->undo == NULL || !undo_init(sim->undo, &sim->ctx.cpu, sim->ctx.mem, sim->count))
+    {
+        free(sim->undo);
+        sim->undo = NULL;
+        return false;
+    }
+    return true;
+}
+
+//=======================================================================
+/*
+ * Tell the recording, if any, that the machine is about to be changed
+ * other than by executing. Recording stops if out of memory.
+ */
+static void before_edit(y86sim_t *sim)
+{
+    if (sim->undo != NULL && !undo_edit(sim->undo, &sim->ctx.cpu, sim->ctx.mem))
+    {
+        y86sim_record(sim, false);
+    }
+}
+
+//=======================================================================
+/*
+ * Undo the last n instructions, fewer if recording started sooner.
+ * Return the number undone.
+ */
+uint64_t y86sim_reverse_step(y86sim_t *sim, uint64_t n)
+{
+    if (sim->undo == NULL)
+    {
+        return 0;
+    }
+    uint64_t done = undo_back(sim->undo, &sim->ctx.cpu, sim->ctx.mem, n);
+    sim->count -= done;
+    return done;
+}
+
+//=======================================================================
+/*
+ * Undo instructions until the pc is one of the nbreaks addresses in
+ * breaks or recording started. Return the number undone.
+ */
+uint64_t y86sim_reverse_continue(y86sim_t *sim, const address_t *breaks,
+                                 int nbreaks)
+{
+    if (sim->undo == NULL)
+    {
+        return 0;
+    }
+    uint64_t done = undo_back_to(sim->undo, &sim->ctx.cpu, sim->ctx.mem,
+                                 breaks, nbreaks);
+    sim->count -= done;
+    return done;
+}
+
+//=======================================================================
+y86_stat_t y86sim_stat(const y86sim_t *sim)
+{
+    return sim->ctx.cpu.stat;
+}
+
+//=======================================================================
+address_t y86sim_pc(const y86sim_t *sim)
+{
+    return sim->ctx.cpu.pc;
+}
+
+//=======================================================================
+/*
+ * Value of register reg (0 for %rax ... 14 for %r14). Any other number
+ * reads as zero, like the "no register" encoding.
+ */
+y86_register_t y86sim_reg(const y86sim_t *sim, int reg)
+{
+    return reg >= 0 && reg < NUMREGS ? sim->ctx.cpu.regs[reg] : 0;
+}
+
+//=======================================================================
+void y86sim_set_reg(y86sim_t *sim, int reg, y86_register_t value)
+{
+    if (reg >= 0 && reg < NUMREGS)
+    {
+        before_edit(sim);
+        sim->ctx.cpu.regs[reg] = value;
+    }
+}
+
+//=======================================================================
+/*
+ * Condition codes. Any pointer may be NULL.
+ */
+void y86sim_flags(const y86sim_t *sim, bool *zf, bool *sf, bool *of)
+{
+    if (zf != NULL)
+    {
+        *zf = sim->ctx.cpu.zf;
+    }
+    if (sf != NULL)
+    {
+        *sf = sim->ctx.cpu.sf;
+    }
+    if (of != NULL)
+    {
+        *of = sim->ctx.cpu.of;
+    }
+}
+
+//=======================================================================
+/*
+ * The whole cpu state, valid until the next call that changes it.
+ */
+const y86_t *y86sim_cpu(const y86sim_t *sim)
+{
+    return &sim->ctx.cpu;
+}
+
+//=======================================================================
+address_t y86sim_mem_size(const y86sim_t *sim)
+{
+    return mem_size(sim->ctx.mem);
+}
+
+//=======================================================================
+/*
+ * Copy len bytes at addr into buf.
+ * Return false if the range is outside the address space.
+ */
+bool y86sim_read(const y86sim_t *sim, address_t addr, void *buf, size_t len)
+{
+    address_t size = mem_size(sim->ctx.mem);
+    if (addr > size || len > size - addr)
+    {
+        return false;
+    }
+    mem_read(sim->ctx.mem, addr, buf, len);
+    return true;
+}
+
+//=======================================================================
+/*
+ * Store len bytes of buf at addr, as if the program had. Instructions
+ * decoded from the range are decoded again when next executed.
+ * Return false if the range is outside the address space.
+ */
+bool y86sim_write(y86sim_t *sim, address_t addr, const void *buf, size_t len)
+{
+    address_t size = mem_size(sim->ctx.mem);
+    if (addr > size || len > size - addr)
+    {
+        return false;
+    }
+    before_edit(sim);
+    mem_write(sim->ctx.mem, addr, buf, len);
+    decode_cache_invalidate(sim->ctx.mem, addr, len);
+    return true;
+}